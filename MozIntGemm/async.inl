@@ -0,0 +1,32 @@
+// Definition of the handle declared in moz_intgemm.inl. Holds the arguments
+// of an asynchronous int8MultiplyAndAddBias and the job running it on the
+// scheduler.
+struct Int8Multiply {
+  explicit Int8Multiply(void (*run)(const void *, size_t))
+      : job(run, this, 1, runtime::threadPriority()) {}
+
+  const int8_t *input_A_prepared;
+  float scale_A;
+  float zero_point_A;
+  const int8_t *input_B_prepared;
+  float scale_B;
+  float zero_point_B;
+  const float *input_bias_prepared;
+  float unquant_multiplier;
+  Index rows_A;
+  Index width;
+  Index cols_B;
+  float *output;
+  bool accumulate;
+
+  void (*callback)(void *user_data);
+  void *user_data;
+
+  // Tag of the issuing thread, see int8SetCallStatsTag.
+  const char *stats_tag;
+
+  // Held until the multiply is waited for, so that the pool outlives it even
+  // if the thread count changes meanwhile.
+  std::shared_ptr<runtime::Scheduler> pool;
+  runtime::Job job;
+};
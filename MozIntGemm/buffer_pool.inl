@@ -0,0 +1,175 @@
+// Thread-caching pool of aligned buffers in size classes.
+//
+// Scratch buffers come in the same few sizes over and over, a set per layer
+// shape. Freed buffers are kept by the thread that freed them, so the next
+// buffer of the same class comes back without a lock or a trip to the system
+// allocator. Full thread caches spill into a small shared cache, which is also
+// where the buffers of threads that exit end up. Both are bounded, anything
+// beyond goes back to the system.
+
+namespace runtime {
+
+// Buffers cached per class and in all, by each thread and shared.
+constexpr size_t kThreadCacheSlots = 4;
+constexpr size_t kThreadCacheBytes = 16 << 20;
+constexpr size_t kSharedCacheSlots = 8;
+constexpr size_t kSharedCacheBytes = 64 << 20;
+
+// Classes are spaced a quarter of a power of two apart, from 256 bytes up to
+// the 64 MB the shared cache holds, so rounding up wastes at most a fifth of
+// a buffer. Larger buffers could never be cached and are not pooled.
+constexpr size_t kPoolMinShift = 8;
+constexpr size_t kPoolMaxShift = 26;
+constexpr size_t kPoolClasses = (kPoolMaxShift - kPoolMinShift) * 4 + 1;
+static_assert(size_t{1} << kPoolMaxShift == kSharedCacheBytes,
+              "The largest class is as large as the shared cache");
+
+class BufferPool;
+inline BufferPool &bufferPool();
+
+class BufferPool {
+public:
+  BufferPool() = default;
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  static size_t classBytes(size_t size_class) {
+    size_t base = size_t{1} << (size_class / 4 + kPoolMinShift);
+    return base + base / 4 * (size_class % 4);
+  }
+
+  // The smallest class holding bytes, or kPoolClasses if bytes is too large
+  // to pool.
+  static size_t sizeClass(size_t bytes) {
+    size_t size_class = 0;
+    while (size_class + 4 < kPoolClasses &&
+           classBytes(size_class + 4) < bytes) {
+      size_class += 4;
+    }
+    while (size_class < kPoolClasses && classBytes(size_class) < bytes) {
+      ++size_class;
+    }
+    return size_class;
+  }
+
+  // A buffer of at least bytes, aligned to kAlignment.
+  void *allocate(size_t bytes) {
+    size_t size_class = sizeClass(bytes);
+    if (size_class == kPoolClasses) {
+      return alignedAlloc(bytes);
+    }
+    if (enabled_.load(std::memory_order_relaxed)) {
+      void *ptr = threadCache().take(size_class);
+      if (ptr) {
+        return ptr;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      ptr = shared_.take(size_class);
+      if (ptr) {
+        return ptr;
+      }
+    }
+    // The full size of the class even when pooling is off, so that the
+    // buffer can be pooled once it is back on.
+    return alignedAlloc(classBytes(size_class));
+  }
+
+  // Returns a buffer from allocate(bytes), for the same bytes.
+  void free(void *ptr, size_t bytes) {
+    size_t size_class = sizeClass(bytes);
+    if (size_class == kPoolClasses ||
+        !enabled_.load(std::memory_order_relaxed)) {
+      alignedFree(ptr);
+      return;
+    }
+    if (!threadCache().put(size_class, ptr)) {
+      share(size_class, ptr);
+    }
+  }
+
+  // Turns pooling on or off. Turning it off frees the shared cache and that
+  // of the calling thread, other threads free theirs as they exit.
+  void setEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+    if (!enabled) {
+      threadCache().flush(*this);
+      std::lock_guard<std::mutex> lock(mutex_);
+      shared_.clear();
+    }
+  }
+
+private:
+  template <size_t kSlots, size_t kBytes> struct Cache {
+    void *slots[kPoolClasses][kSlots];
+    size_t counts[kPoolClasses] = {};
+    size_t bytes = 0;
+
+    void *take(size_t size_class) {
+      if (counts[size_class] == 0) {
+        return nullptr;
+      }
+      bytes -= classBytes(size_class);
+      return slots[size_class][--counts[size_class]];
+    }
+
+    bool put(size_t size_class, void *ptr) {
+      if (counts[size_class] == kSlots ||
+          bytes + classBytes(size_class) > kBytes) {
+        return false;
+      }
+      slots[size_class][counts[size_class]++] = ptr;
+      bytes += classBytes(size_class);
+      return true;
+    }
+
+    void clear() {
+      for (size_t size_class = 0; size_class < kPoolClasses; ++size_class) {
+        while (void *ptr = take(size_class)) {
+          alignedFree(ptr);
+        }
+      }
+    }
+  };
+
+  struct ThreadCache : Cache<kThreadCacheSlots, kThreadCacheBytes> {
+    ~ThreadCache() { flush(bufferPool()); }
+
+    // Hands every cached buffer to the shared cache.
+    void flush(BufferPool &pool) {
+      for (size_t size_class = 0; size_class < kPoolClasses; ++size_class) {
+        while (void *ptr = take(size_class)) {
+          pool.share(size_class, ptr);
+        }
+      }
+    }
+  };
+
+  static ThreadCache &threadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+  }
+
+  void share(size_t size_class, void *ptr) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (enabled_.load(std::memory_order_relaxed) &&
+          shared_.put(size_class, ptr)) {
+        return;
+      }
+    }
+    alignedFree(ptr);
+  }
+
+  std::atomic<bool> enabled_{true};
+  std::mutex mutex_;
+  Cache<kSharedCacheSlots, kSharedCacheBytes> shared_;
+};
+
+// Never destroyed, pool threads may still return buffers while statics are
+// being destroyed at exit.
+inline BufferPool &bufferPool() {
+  static BufferPool *pool = new BufferPool();
+  return *pool;
+}
+
+} // namespace runtime
@@ -0,0 +1,199 @@
+// Coalescing of concurrent multiplies against the same prepared B.
+//
+// The first call to arrive for a B leads a batch and waits up to the window
+// for others to join. It then multiplies the rows of A of every call in the
+// batch at once, so B is streamed once rather than once per call, and applies
+// each call's own bias and unquantization to its slice of the result. Calls
+// that joined block until the leader has written their output, so callers
+// keep the synchronous interface.
+//
+// A leader only waits if some other thread is multiplying against the same B
+// or did within the window. A thread that is alone with its B, such as a
+// single translation running, starts right away instead of paying the window
+// on every call.
+
+namespace runtime {
+
+struct CoalescedCall {
+  const int8_t *A;
+  Index rows;
+  const float *bias;
+  float unquant_multiplier;
+  float *output;
+  bool done;
+};
+
+struct CoalescedBatch {
+  CoalescedBatch(const int8_t *B, Index width, Index cols_B)
+      : B(B), width(width), cols_B(cols_B) {}
+
+  const int8_t *B;
+  Index width;
+  Index cols_B;
+  Index rows = 0;
+  std::vector<CoalescedCall *> calls;
+
+  // Set once no further calls may join, the leader waits on ready for it.
+  bool closed = false;
+  std::condition_variable ready;
+};
+
+class Coalescer {
+public:
+  void configure(uint32_t window_us, Index max_rows) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_ = std::chrono::microseconds(window_us);
+    max_rows_ = max_rows;
+    forget();
+    enabled_.store(window_us != 0 && max_rows != 0, std::memory_order_relaxed);
+  }
+
+  // Multiplies the call as part of a batch, running execute(batch) if this
+  // call leads it. Returns false without doing anything if coalescing is
+  // disabled or the call has too many rows to be coalesced.
+  template <class Execute>
+  bool coalesce(const int8_t *A, const int8_t *B, const float *bias,
+                float unquant_multiplier, Index rows, Index width,
+                Index cols_B, float *output, const Execute &execute) {
+    if (!enabled_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+
+    CoalescedCall call{A, rows, bias, unquant_multiplier, output, false};
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (rows >= max_rows_) {
+      return false;
+    }
+
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    Callers &callers = arrive(B);
+    // Whether anyone else may join a batch this call leads.
+    const bool contended =
+        callers.in_flight > 1 ||
+        (callers.last_thread != std::this_thread::get_id() &&
+         now - callers.last_arrival < window_);
+    callers.last_thread = std::this_thread::get_id();
+    callers.last_arrival = now;
+
+    CoalescedBatch *batch = find(B, width, cols_B);
+    if (batch && batch->rows + rows > max_rows_) {
+      // No room left, let it go and start a new batch.
+      close(batch);
+      batch = nullptr;
+    }
+
+    if (batch) {
+      batch->calls.push_back(&call);
+      batch->rows += rows;
+      ++calls_;
+      if (batch->rows >= max_rows_) {
+        close(batch);
+      }
+      done_.wait(lock, [&call] { return call.done; });
+      --callers.in_flight;
+      return true;
+    }
+
+    CoalescedBatch own(B, width, cols_B);
+    own.calls.push_back(&call);
+    own.rows = rows;
+    ++calls_;
+    ++batches_;
+    if (contended) {
+      open_.push_back(&own);
+      own.ready.wait_until(lock, now + window_, [&own] { return own.closed; });
+      if (!own.closed) {
+        close(&own);
+      }
+    } else {
+      own.closed = true;
+    }
+
+    // Closed, so own.calls no longer changes.
+    lock.unlock();
+    execute(own);
+
+    lock.lock();
+    for (CoalescedCall *joined : own.calls) {
+      joined->done = true;
+    }
+    --callers.in_flight;
+    lock.unlock();
+    done_.notify_all();
+    return true;
+  }
+
+  Int8CoalescingStats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Int8CoalescingStats{calls_, batches_};
+  }
+
+  void resetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    calls_ = batches_ = 0;
+  }
+
+private:
+  // Who multiplies against a B, for its leaders to tell whether anyone may
+  // join them.
+  struct Callers {
+    size_t in_flight = 0;
+    std::thread::id last_thread;
+    std::chrono::steady_clock::time_point last_arrival;
+  };
+
+  // Bs tracked at most before those without calls in flight are forgotten,
+  // as prepared Bs come and go with the models loaded.
+  static constexpr size_t kMaxTrackedBs = 256;
+
+  // Counts a call against B in, which stays in flight until it returns.
+  Callers &arrive(const int8_t *B) {
+    if (callers_.size() >= kMaxTrackedBs && callers_.count(B) == 0) {
+      forget();
+    }
+    Callers &callers = callers_[B];
+    ++callers.in_flight;
+    return callers;
+  }
+
+  // Drops the Bs without calls in flight.
+  void forget() {
+    for (auto it = callers_.begin(); it != callers_.end();) {
+      it = it->second.in_flight == 0 ? callers_.erase(it) : std::next(it);
+    }
+  }
+
+  CoalescedBatch *find(const int8_t *B, Index width, Index cols_B) {
+    for (CoalescedBatch *batch : open_) {
+      if (batch->B == B && batch->width == width && batch->cols_B == cols_B) {
+        return batch;
+      }
+    }
+    return nullptr;
+  }
+
+  void close(CoalescedBatch *batch) {
+    batch->closed = true;
+    open_.erase(std::find(open_.begin(), open_.end(), batch));
+    batch->ready.notify_one();
+  }
+
+  std::atomic<bool> enabled_{false};
+
+  std::mutex mutex_;
+  std::chrono::microseconds window_{0};
+  Index max_rows_ = 0;
+  std::vector<CoalescedBatch *> open_;
+  std::unordered_map<const int8_t *, Callers> callers_;
+  std::condition_variable done_;
+  uint64_t calls_ = 0;
+  uint64_t batches_ = 0;
+};
+
+inline Coalescer &coalescer() {
+  static Coalescer coalescer;
+  return coalescer;
+}
+
+} // namespace runtime
@@ -1,10 +1,12 @@
 #pragma once
 #include "moz_intgemm.h"
+#include "runtime.h"
 #include "ruy/platform.h"
 #include "ruy/system_aligned_alloc.h"
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 
 #if RUY_PLATFORM_NEON
 #include <arm_neon.h>
@@ -1,28 +1,75 @@
 namespace detail {
 
+// Aligned buffer of trivially copyable T from the runtime's buffer pool.
+// Elements are left uninitialized.
 template <class T> class AlignedVector {
 public:
-  AlignedVector(size_t num_elem)
-      : size_(num_elem),
-        storage_(reinterpret_cast<T *>(
-            ruy::detail::SystemAlignedAlloc(sizeof(T) * num_elem))) {}
+  AlignedVector() = default;
+  explicit AlignedVector(size_t num_elem) { resize(num_elem); }
+
+  AlignedVector(AlignedVector &&other) noexcept
+      : storage_(other.storage_), size_(other.size_),
+        capacity_(other.capacity_) {
+    other.storage_ = nullptr;
+    other.size_ = other.capacity_ = 0;
+  }
+
+  AlignedVector &operator=(AlignedVector &&other) noexcept {
+    if (this != &other) {
+      release();
+      storage_ = other.storage_;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.storage_ = nullptr;
+      other.size_ = other.capacity_ = 0;
+    }
+    return *this;
+  }
+
+  // Forbid copy
+  AlignedVector(const AlignedVector &) = delete;
+  AlignedVector &operator=(const AlignedVector &) = delete;
+
+  ~AlignedVector() { release(); }
 
   T *begin() { return storage_; }
+  T *end() { return storage_ + size_; }
   T *data() { return storage_; }
   size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
   size_t memSize() const { return sizeof(T) * size_; }
 
-  // Forbid copy
-  AlignedVector(const AlignedVector &) = delete;
-  AlignedVector &operator=(const AlignedVector &) = delete;
+  // Makes room for num_elem elements, keeping the current ones.
+  void reserve(size_t num_elem) {
+    if (num_elem <= capacity_) {
+      return;
+    }
+    T *storage = static_cast<T *>(
+        runtime::bufferPool().allocate(sizeof(T) * num_elem));
+    if (size_ != 0) {
+      std::memcpy(storage, storage_, sizeof(T) * size_);
+    }
+    release();
+    storage_ = storage;
+    capacity_ = num_elem;
+  }
 
-  ~AlignedVector() {
-    ruy::detail::SystemAlignedFree(reinterpret_cast<void *>(storage_));
+  void resize(size_t num_elem) {
+    reserve(num_elem);
+    size_ = num_elem;
   }
 
 private:
-  T *storage_;
-  size_t size_;
+  void release() {
+    if (storage_) {
+      runtime::bufferPool().free(storage_, sizeof(T) * capacity_);
+    }
+    storage_ = nullptr;
+  }
+
+  T *storage_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
 };
 
 // TODO: Workout similar to ruy. enum value is causing type/value complaints.
@@ -37,6 +84,54 @@ using kHighestPath = kNeon;
 using kHighestPath = kStandardCpp;
 #endif
 
+// Bytes of source columns that gatherColumns prefetches ahead of the column
+// being copied, enough to cover DRAM latency at copy bandwidth.
+constexpr size_t kGatherPrefetchBytes = 4096;
+constexpr size_t kCacheLineSize = 64;
+
+inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address, /*rw=*/0, /*locality=*/0);
+#endif
+}
+
+// Gathers the columns cols[0, num_cols) of a col-major int8 matrix, each width
+// contiguous bytes, into output using copy(dst, src) for single columns. Runs
+// of consecutive indices are copied at once, and isolated columns are
+// prefetched ahead so the gather is bandwidth rather than latency bound.
+template <class CopyColumn>
+void gatherColumns(const int8_t *input, Index width, const Index *cols,
+                   Index num_cols, int8_t *output, CopyColumn copy) {
+  const Index distance =
+      std::max<Index>(2, static_cast<Index>(kGatherPrefetchBytes / width));
+  Index c = 0;
+  while (c < num_cols) {
+    Index run = 1;
+    while (c + run < num_cols && cols[c + run] == cols[c] + run) {
+      ++run;
+    }
+
+    int8_t *dst = output + static_cast<size_t>(c) * width;
+    const int8_t *src = input + static_cast<size_t>(cols[c]) * width;
+    if (run > 1) {
+      // Sequential, the hardware prefetcher keeps up on its own.
+      std::memcpy(dst, src, static_cast<size_t>(run) * width);
+      c += run;
+      continue;
+    }
+
+    if (c + distance < num_cols) {
+      const int8_t *ahead =
+          input + static_cast<size_t>(cols[c + distance]) * width;
+      for (Index i = 0; i < width; i += kCacheLineSize) {
+        prefetch(ahead + i);
+      }
+    }
+    copy(dst, src);
+    ++c;
+  }
+}
+
 template <class Path> struct Preprocess {
   static void quantize(const float *input, float scale, float zero_point,
                        Index rows, Index width, int8_t *output) {
@@ -64,6 +159,33 @@ template <class Path> struct Preprocess {
       }
     }
   }
+  static void selectColumns(const int8_t *input, Index width,
+                            const Index *cols, Index num_cols,
+                            int8_t *output) {
+    // Constant size copies of the common widths compile to unrolled SIMD
+    // moves.
+    switch (width) {
+    case 256:
+      gatherColumns(input, width, cols, num_cols, output,
+                    [](int8_t *dst, const int8_t *src) {
+                      std::memcpy(dst, src, 256);
+                    });
+      break;
+    case 1536:
+      gatherColumns(input, width, cols, num_cols, output,
+                    [](int8_t *dst, const int8_t *src) {
+                      std::memcpy(dst, src, 1536);
+                    });
+      break;
+    default:
+      gatherColumns(input, width, cols, num_cols, output,
+                    [width](int8_t *dst, const int8_t *src) {
+                      std::memcpy(dst, src, width);
+                    });
+      break;
+    }
+  }
+
   static void unquantizeAddBias(const int32_t *input,
                                 const float *input_bias_prepared,
                                 float unquant_multiplier, Index rows_A,
@@ -76,6 +198,59 @@ template <class Path> struct Preprocess {
       }
     }
   }
+
+  static void unquantizeAddBiasAccumulate(const int32_t *input,
+                                          const float *input_bias_prepared,
+                                          float unquant_multiplier,
+                                          Index rows_A, Index cols_B,
+                                          float *output) {
+    for (size_t i = 0; i < rows_A; i++) {
+      for (size_t j = 0; j < cols_B; j++) {
+        Index idx = i * cols_B + j;
+        output[idx] +=
+            (input[idx] * unquant_multiplier) + input_bias_prepared[j];
+      }
+    }
+  }
+
+  static void unquantizeAddBiasLayerNorm(
+      const int32_t *input, const float *input_bias_prepared,
+      float unquant_multiplier, const float *residual, const float *gamma,
+      const float *beta, float epsilon, Index rows_A, Index cols_B,
+      float *output) {
+    for (size_t i = 0; i < rows_A; i++) {
+      const int32_t *input_row = input + i * cols_B;
+      float *output_row = output + i * cols_B;
+
+      // Unquantize, add bias and residual, accumulating the sum for the mean.
+      float sum = 0.0f;
+      for (size_t j = 0; j < cols_B; j++) {
+        float value =
+            (input_row[j] * unquant_multiplier) + input_bias_prepared[j];
+        if (residual) {
+          value += residual[i * cols_B + j];
+        }
+        output_row[j] = value;
+        sum += value;
+      }
+
+      // The row is in L1 by now, so the variance is computed in a second pass
+      // over it rather than from a running sum of squares, which is less
+      // stable.
+      float mean = sum / cols_B;
+      float sum_squares = 0.0f;
+      for (size_t j = 0; j < cols_B; j++) {
+        float diff = output_row[j] - mean;
+        sum_squares += diff * diff;
+      }
+      float inv_std = 1.0f / std::sqrt(sum_squares / cols_B + epsilon);
+
+      for (size_t j = 0; j < cols_B; j++) {
+        float value = (output_row[j] - mean) * inv_std * gamma[j];
+        output_row[j] = beta ? value + beta[j] : value;
+      }
+    }
+  }
 };
 
 #if RUY_PLATFORM_NEON
@@ -224,6 +399,48 @@ template <> struct Preprocess<kNeon> {
     // clang-format on
   }
 
+  static void selectColumns(const int8_t *input, Index width,
+                            const Index *cols, Index num_cols,
+                            int8_t *output) {
+    switch (width) {
+    case 256:
+      gatherColumns(input, width, cols, num_cols, output, copyColumn<256>);
+      break;
+    case 1536:
+      gatherColumns(input, width, cols, num_cols, output, copyColumn<1536>);
+      break;
+    default:
+      gatherColumns(input, width, cols, num_cols, output,
+                    [width](int8_t *dst, const int8_t *src) {
+                      Index i = 0;
+                      for (; i + 64 <= width; i += 64) {
+                        copy64(dst + i, src + i);
+                      }
+                      std::memcpy(dst + i, src + i, width - i);
+                    });
+      break;
+    }
+  }
+
+  template <Index kWidth>
+  static void copyColumn(int8_t *dst, const int8_t *src) {
+    static_assert(kWidth % 64 == 0, "Columns are copied 64 bytes at a time");
+    for (Index i = 0; i < kWidth; i += 64) {
+      copy64(dst + i, src + i);
+    }
+  }
+
+  static void copy64(int8_t *dst, const int8_t *src) {
+    int8x16_t x0 = vld1q_s8(src);
+    int8x16_t x1 = vld1q_s8(src + 16);
+    int8x16_t x2 = vld1q_s8(src + 32);
+    int8x16_t x3 = vld1q_s8(src + 48);
+    vst1q_s8(dst, x0);
+    vst1q_s8(dst + 16, x1);
+    vst1q_s8(dst + 32, x2);
+    vst1q_s8(dst + 48, x3);
+  }
+
   static void unquantizeAddBias(const int32_t *input,
                                 const float *input_bias_prepared,
                                 float unquant_multiplier, Index rows_A,
@@ -253,6 +470,92 @@ template <> struct Preprocess<kNeon> {
       }
     }
   }
+
+  static void unquantizeAddBiasAccumulate(const int32_t *input,
+                                          const float *input_bias_prepared,
+                                          float unquant_multiplier,
+                                          Index rows_A, Index cols_B,
+                                          float *output) {
+    // Same as unquantizeAddBias, except the result is added onto what is
+    // already present in output.
+    float32x4_t multiplier = vdupq_n_f32(unquant_multiplier);
+    const int32x4_t *Input = reinterpret_cast<const int32x4_t *>(input);
+    const int32x4_t *InputEnd =
+        reinterpret_cast<const int32x4_t *>(input + rows_A * cols_B);
+    float32x4_t *Output = reinterpret_cast<float32x4_t *>(output);
+
+    while (Input != InputEnd) {
+      const float32x4_t *Bias =
+          reinterpret_cast<const float32x4_t *>(input_bias_prepared);
+
+      const int32x4_t *RowEnd = reinterpret_cast<const int32x4_t *>(
+          reinterpret_cast<const int32_t *>(Input) + cols_B);
+
+      while (Input != RowEnd) {
+        // output = output + [int32_t]input * [float]quant_mult + [float]bias;
+        float32x4_t floatInput = vcvtq_f32_s32(*Input++);
+        float32x4_t unquantized = vmulq_f32(floatInput, multiplier);
+        float32x4_t biased = vaddq_f32(unquantized, *Bias++);
+        *Output = vaddq_f32(*Output, biased);
+        ++Output;
+      }
+    }
+  }
+
+  static void unquantizeAddBiasLayerNorm(
+      const int32_t *input, const float *input_bias_prepared,
+      float unquant_multiplier, const float *residual, const float *gamma,
+      const float *beta, float epsilon, Index rows_A, Index cols_B,
+      float *output) {
+    float32x4_t multiplier = vdupq_n_f32(unquant_multiplier);
+    const int32x4_t *Input = reinterpret_cast<const int32x4_t *>(input);
+    const float32x4_t *Residual =
+        reinterpret_cast<const float32x4_t *>(residual);
+
+    for (size_t i = 0; i < rows_A; i++) {
+      float32x4_t *RowBegin = reinterpret_cast<float32x4_t *>(output) +
+                              i * cols_B / 4;
+      float32x4_t *RowEnd = RowBegin + cols_B / 4;
+
+      // output = [int32_t]input * [float]quant_mult + [float]bias + residual;
+      // while keeping a running sum for the mean.
+      const float32x4_t *Bias =
+          reinterpret_cast<const float32x4_t *>(input_bias_prepared);
+      float32x4_t sum = vdupq_n_f32(0.0f);
+      for (float32x4_t *Output = RowBegin; Output != RowEnd; ++Output) {
+        float32x4_t floatInput = vcvtq_f32_s32(*Input++);
+        float32x4_t value =
+            vaddq_f32(vmulq_f32(floatInput, multiplier), *Bias++);
+        if (Residual) {
+          value = vaddq_f32(value, *Residual++);
+        }
+        *Output = value;
+        sum = vaddq_f32(sum, value);
+      }
+
+      // Variance from a second pass over the row, which is in L1 by now.
+      float32x4_t mean = vdupq_n_f32(vaddvq_f32(sum) / cols_B);
+      float32x4_t sumSquares = vdupq_n_f32(0.0f);
+      for (float32x4_t *Output = RowBegin; Output != RowEnd; ++Output) {
+        float32x4_t diff = vsubq_f32(*Output, mean);
+        sumSquares = vfmaq_f32(sumSquares, diff, diff);
+      }
+      float32x4_t invStd = vdupq_n_f32(
+          1.0f / std::sqrt(vaddvq_f32(sumSquares) / cols_B + epsilon));
+
+      // output = (output - mean) / std * gamma + beta;
+      const float32x4_t *Gamma = reinterpret_cast<const float32x4_t *>(gamma);
+      const float32x4_t *Beta = reinterpret_cast<const float32x4_t *>(beta);
+      for (float32x4_t *Output = RowBegin; Output != RowEnd; ++Output) {
+        float32x4_t normalized = vmulq_f32(vsubq_f32(*Output, mean), invStd);
+        float32x4_t value = vmulq_f32(normalized, *Gamma++);
+        if (Beta) {
+          value = vaddq_f32(value, *Beta++);
+        }
+        *Output = value;
+      }
+    }
+  }
 };
 #endif
 } // namespace detail
@@ -0,0 +1,180 @@
+// Files of events recorded on the hot path, the machinery shared by the
+// trace of trace.inl and the shape trace of shape_trace.inl.
+//
+// Events go into a ring buffer of the thread that recorded them, written by
+// it alone and read by a flusher thread, so recording takes no lock and never
+// waits for the file. The flusher wakes up every kEventFlushInterval and
+// hands what the rings hold to the log to write out. Events that find their
+// ring full are dropped and counted.
+
+namespace runtime {
+
+constexpr size_t kEventRingEvents = 1 << 14;
+constexpr auto kEventFlushInterval = std::chrono::milliseconds(10);
+
+// Single producer, single consumer ring of events.
+template <class Event> class EventRing {
+public:
+  explicit EventRing(uint32_t thread)
+      : thread(thread), events_(new Event[kEventRingEvents]) {}
+
+  // Called by the owning thread only.
+  void push(const Event &event) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kEventRingEvents) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[head % kEventRingEvents] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Called by one thread at a time, with every event pushed so far.
+  template <class Consume> void drain(Consume consume) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      consume(events_[tail % kEventRingEvents]);
+    }
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  uint64_t takeDropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Id of the thread in the log, in order of the threads' first event.
+  const uint32_t thread;
+  // Whether the thread has been introduced in the current file. Flusher only.
+  bool introduced = false;
+
+private:
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::unique_ptr<Event[]> events_;
+};
+
+// A file events are logged to between open() and close(). Derived writes
+// them out with
+//   void begin();                                  once the file is open
+//   void introduce(uint32_t thread);               before a thread's events
+//   void write(uint32_t thread, const Event &);    for each event
+//   void end();                                    before the file is closed
+// all called with the file locked, and events from before open() left out.
+template <class Derived, class Event> class EventLog {
+public:
+  EventLog() = default;
+  EventLog(const EventLog &) = delete;
+  EventLog &operator=(const EventLog &) = delete;
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  bool open(const char *path, const char *mode) {
+    std::lock_guard<std::mutex> control(control_);
+    if (file_) {
+      return false;
+    }
+    std::FILE *file = std::fopen(path, mode);
+    if (!file) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ = file;
+    dropped_ = 0;
+    // Whatever is left from an earlier file predates this one.
+    for (const std::shared_ptr<EventRing<Event>> &ring : rings_) {
+      ring->drain([](const Event &) {});
+      ring->takeDropped();
+      ring->introduced = false;
+    }
+    static_cast<Derived *>(this)->begin();
+    stopping_ = false;
+    flusher_ = std::thread([this] {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stopping_) {
+        wake_.wait_for(lock, kEventFlushInterval);
+        flush();
+      }
+    });
+    enabled_.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns the number of events dropped.
+  uint64_t close() {
+    std::lock_guard<std::mutex> control(control_);
+    if (!file_) {
+      return 0;
+    }
+    enabled_.store(false, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    flusher_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    flush();
+    static_cast<Derived *>(this)->end();
+    std::fclose(file_);
+    file_ = nullptr;
+    return dropped_;
+  }
+
+  void record(const Event &event) { threadRing().push(event); }
+
+protected:
+  std::FILE *file_ = nullptr;
+
+private:
+  EventRing<Event> &threadRing() {
+    static thread_local std::shared_ptr<EventRing<Event>> ring;
+    if (!ring) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ring = std::make_shared<EventRing<Event>>(next_thread_++);
+      rings_.push_back(ring);
+    }
+    return *ring;
+  }
+
+  // Writes out the events of every ring. Called with mutex_ held.
+  void flush() {
+    Derived &log = *static_cast<Derived *>(this);
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      EventRing<Event> &ring = **it;
+      if (!ring.introduced) {
+        log.introduce(ring.thread);
+        ring.introduced = true;
+      }
+      ring.drain([&](const Event &event) { log.write(ring.thread, event); });
+      dropped_ += ring.takeDropped();
+
+      // Rings of threads that have exited are dropped once drained.
+      if (it->use_count() == 1) {
+        it = rings_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    std::fflush(file_);
+  }
+
+  std::atomic<bool> enabled_{false};
+
+  // Serializes open and close.
+  std::mutex control_;
+
+  // Guards the rings and the file, held by the flusher while it writes.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<std::shared_ptr<EventRing<Event>>> rings_;
+  uint32_t next_thread_ = 1;
+  bool stopping_ = false;
+  uint64_t dropped_ = 0;
+  std::thread flusher_;
+};
+
+} // namespace runtime
@@ -216,15 +216,82 @@ void int8PrepareBias(const int8_t *input_B_prepared, float scale_A,
  * no. of columns of Input matrix B). It should be a multiple of 64.
  * @param[in]   cols_B                 No. of columns of Input matrix B. Should
  * be a multiple of 8.
- * @param[out]  output                 An array representing the result matrix
+ * @param[in,out]  output              An array representing the result matrix
  * in row-major format. Size of the array = `rows_A` * `cols_B`.
+ * @param[in]   accumulate             If true, the result is added to the
+ * existing contents of `output` (i.e. Output += A * B + Bias) instead of
+ * overwriting them. Useful to fuse residual connections into the multiply.
  */
 void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
                             float zero_point_A, const int8_t *input_B_prepared,
                             float scale_B, float zero_point_B,
                             const float *input_bias_prepared,
                             float unquant_multiplier, Index rows_A, Index width,
-                            Index cols_B, float *output);
+                            Index cols_B, float *output,
+                            bool accumulate = false);
+
+/**
+ * Perform multiplication of 2 matrices followed by adding a bias and a
+ * residual, and layer-normalize the rows of the result.
+ *
+ * i.e Output = LayerNorm(A_prepared * B_prepared + Bias_prepared + Residual)
+ *
+ * where each row x of the sum is normalized as
+ *   (x - mean(x)) / sqrt(variance(x) + epsilon) * gamma + beta
+ *
+ * This fuses the residual connection and layer normalization that follow
+ * output projections into the epilogue of the multiply, so each row is
+ * normalized while it is still in cache instead of in separate passes over the
+ * output.
+ *
+ * Inputs are the same as for `int8MultiplyAndAddBias`, in addition to:
+ *
+ * @param[in]   residual               An array representing the residual, in
+ * row-major format. Size of the array = `rows_A` * `cols_B`. Can be nullptr,
+ * in which case no residual is added. Can be the same as `output`.
+ * @param[in]   gamma                  An array representing the layer
+ * normalization scale. Size of the array = `cols_B`
+ * @param[in]   beta                   An array representing the layer
+ * normalization shift. Size of the array = `cols_B`. Can be nullptr.
+ * @param[in]   epsilon                A small value added to the variance for
+ * numerical stability.
+ * @param[out]  output                 An array representing the result matrix
+ * in row-major format. Size of the array = `rows_A` * `cols_B`.
+ */
+void int8MultiplyAddBiasAndLayerNorm(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier,
+    const float *residual, const float *gamma, const float *beta,
+    float epsilon, Index rows_A, Index width, Index cols_B, float *output);
+
+/**
+ * Perform multiplication of A with a subset of columns of B, followed by adding
+ * the corresponding subset of bias.
+ *
+ * i.e Output = A_prepared * B_prepared[:, cols] + Bias_prepared[cols]
+ *
+ * This is equivalent to `int8SelectColumnsOfB` (and selecting the same entries
+ * of bias) followed by `int8MultiplyAndAddBias`, without materializing the
+ * selected B: columns are gathered a cache-sized block at a time as they are
+ * multiplied.
+ *
+ * Inputs are the same as for `int8MultiplyAndAddBias`, in addition to:
+ *
+ * @param[in]   cols               An array of column indices to be selected
+ * from prepared B (and prepared bias). All indices of the array should be
+ * valid. i.e. 0 <= cols[N] < cols_B   where N = 0, 1, 2 .... (`num_cols`-1)
+ * @param[in]   num_cols           Size of the `cols` array. It should be a
+ * multiple of 8.
+ * @param[out]  output             An array representing the result matrix in
+ * row-major format. Size of the array = `rows_A` * `num_cols`.
+ */
+void int8MultiplyAndAddBiasSelected(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier, Index rows_A,
+    Index width, Index cols_B, const Index *cols, Index num_cols,
+    float *output);
 
 /**
  * Select a subset of columns of prepared B.
@@ -249,3 +316,627 @@ void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
 void int8SelectColumnsOfB(const int8_t *input_B_prepared, Index width,
                           Index cols_B, const Index *cols, const Index num_cols,
                           int8_t *output);
+
+/**
+ * Selected columns of prepared B (and entries of prepared bias) held by the
+ * selection cache. Obtained from `int8SelectColumnsOfBCached` and released by
+ * `int8ReleaseSelection`.
+ */
+struct Int8Selection;
+
+/**
+ * Select a subset of columns of prepared B, and the corresponding entries of
+ * prepared bias, through a bounded least-recently-used cache.
+ *
+ * Consecutive decoding steps often select the same columns. If the same
+ * columns have recently been selected from the same `input_B_prepared` and
+ * `input_bias_prepared`, the cached selection is returned instead of gathering
+ * again. Entries are looked up by pointer, so a prepared B or bias must not be
+ * modified or freed while selections from it may be in the cache (see
+ * `int8ClearSelectionCache`). This function is thread-safe.
+ *
+ * @param[in]   input_B_prepared     An array representing the prepared B
+ * matrix. Size of the array = `width` * `cols_B`.
+ * @param[in]   input_bias_prepared  An array representing the prepared bias.
+ * Size of the array = `cols_B`. Can be nullptr, in which case only B is
+ * selected.
+ * @param[in]   width                No. of rows of Input matrix B. It should be
+ * a multiple of 64.
+ * @param[in]   cols_B               No. of columns of Input matrix B. It should
+ * be a multiple of 8.
+ * @param[in]   cols                 An array of column indices to be selected.
+ * All indices of the array should be valid. i.e. 0 <= cols[N] < cols_B where N
+ * = 0, 1, 2 .... (`num_cols`-1)
+ * @param[in]   num_cols             Size of the `cols` array. It should be a
+ * multiple of 8.
+ * @return      A selection, to be accessed through `int8SelectionB` and
+ * `int8SelectionBias` and released through `int8ReleaseSelection`, or nullptr
+ * if there is not enough memory for it even with the cache emptied.
+ */
+const Int8Selection *
+int8SelectColumnsOfBCached(const int8_t *input_B_prepared,
+                           const float *input_bias_prepared, Index width,
+                           Index cols_B, const Index *cols, Index num_cols);
+
+/**
+ * Selected columns of prepared B, as `int8SelectColumnsOfB` would have written
+ * them. Size of the array = `width` * `num_cols`.
+ */
+const int8_t *int8SelectionB(const Int8Selection *selection);
+
+/**
+ * Selected entries of prepared bias. Size of the array = `num_cols`. nullptr
+ * if no bias was given to `int8SelectColumnsOfBCached`.
+ */
+const float *int8SelectionBias(const Int8Selection *selection);
+
+/**
+ * Release a selection obtained from `int8SelectColumnsOfBCached`. The
+ * selection must not be accessed afterwards.
+ */
+void int8ReleaseSelection(const Int8Selection *selection);
+
+/**
+ * Set the maximum size in bytes of the selections held by the cache. Least
+ * recently used selections are evicted beyond this. 0 disables caching.
+ */
+void int8SetSelectionCacheCapacity(size_t bytes);
+
+/**
+ * Evict every selection from the cache. Required before modifying or freeing
+ * a prepared B or bias that selections have been made from.
+ */
+void int8ClearSelectionCache();
+
+struct Int8SelectionCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t entries;
+  size_t bytes;
+};
+
+/**
+ * Hit, miss and eviction counts since the last reset, and current occupancy
+ * of the selection cache.
+ */
+Int8SelectionCacheStats int8GetSelectionCacheStats();
+
+/**
+ * Reset the hit, miss and eviction counts of the selection cache.
+ */
+void int8ResetSelectionCacheStats();
+
+/**
+ * Set the number of threads multiplies may use, including the calling thread.
+ *
+ * Multiplies large enough to be worth splitting are cut into tiles that run
+ * on a single pool of workers shared by every caller, so this should match the
+ * cores available to the process rather than the number of calling threads.
+ * Small multiplies run on the calling thread only. 0 (the default) uses the
+ * CPUs in the affinity mask of the process, capped by its cgroup CPU quota so
+ * that containers are not throttled. This function is thread-safe.
+ *
+ * @param[in]   threads   Number of threads, or 0 for the default.
+ */
+void int8SetThreadCount(size_t threads);
+
+/**
+ * Pin the workers of the pool to distinct physical cores.
+ *
+ * Workers go to one hardware thread of each core the process may run on,
+ * performance cores first on hybrid parts. With the default thread count,
+ * pinning also caps the threads to the number of such cores. Off by default,
+ * as it only pays off when the process has the cores to itself. This function
+ * is thread-safe.
+ *
+ * @param[in]   pin   Whether to pin workers.
+ */
+void int8SetThreadPinning(bool pin);
+
+/**
+ * Keep the workers of the pool awake until the matching `int8EndSession`.
+ *
+ * Idle workers spin for a while before going to sleep, for longer the more
+ * closely multiplies have lately followed one another. Within a session they
+ * do not sleep at all, so the first multiply after a pause finds them awake
+ * too, at the cost of keeping their cores busy. Meant to bracket a burst of
+ * work such as translating a document. Sessions nest and may overlap across
+ * threads. This function is thread-safe.
+ */
+void int8BeginSession();
+
+/**
+ * End a session started with `int8BeginSession`.
+ *
+ * Every `int8BeginSession` must be paired with exactly one call to this
+ * function; workers keep spinning as long as any session has not ended. Calls
+ * without a session to end are ignored. This function is thread-safe.
+ */
+void int8EndSession();
+
+/**
+ * Size in bytes of a workspace large enough for any call on matrices of up to
+ * `rows_A` x `width` by `width` x `cols_B`.
+ *
+ * This covers multiplies with or without accumulation, layer normalization
+ * and selections of up to `cols_B` columns. Preparing B and coalesced batches
+ * (see `int8SetCoalescing`) may need more.
+ *
+ * @param[in]   rows_A   Upper bound on the number of rows of A.
+ * @param[in]   width    Upper bound on the shared dimension.
+ * @param[in]   cols_B   Upper bound on the number of columns of B.
+ * @return      Size in bytes.
+ */
+size_t int8WorkspaceSize(Index rows_A, Index width, Index cols_B);
+
+/**
+ * Give the calling thread a workspace for the scratch buffers of its calls.
+ *
+ * Without a workspace, calls allocate their int32 accumulators, partial sums
+ * and gathered columns on the heap. With one of `int8WorkspaceSize` bytes for
+ * the largest shape used, multiplies on this thread make no heap allocations
+ * once one of that shape has run. That first multiply also readies every
+ * thread of the pool for it (each keeps the buffers of its packing kernels),
+ * except threads of a host executor, which are ready once they have run a
+ * tile of each shape. Calls needing more than the workspace holds fall back
+ * to the heap.
+ *
+ * The workspace belongs to the library until it is replaced or unset, and
+ * may not be shared with other threads. Asynchronous multiplies run on other
+ * threads and do not use it.
+ *
+ * @param[in]   workspace   Memory for the workspace, or nullptr for none.
+ * @param[in]   bytes       Size of `workspace` in bytes.
+ */
+void int8SetWorkspace(void *workspace, size_t bytes);
+
+/**
+ * Turn pooling of internal buffers on or off.
+ *
+ * Scratch buffers that do not come from a workspace are pooled by size, and
+ * freed buffers are cached by each thread (and a shared cache, both bounded)
+ * for the next call of the same shape. On by default. Turning it off frees
+ * the shared cache and that of the calling thread; the caches of other
+ * threads are freed as they exit. This function is thread-safe.
+ *
+ * @param[in]   enabled   Whether to pool buffers.
+ */
+void int8SetBufferPooling(bool enabled);
+
+/**
+ * Replicate a prepared B onto every NUMA node.
+ *
+ * Multiplies (and column selections) against `input_B_prepared` then read the
+ * copy local to the node of the thread doing the work instead of wherever B
+ * was first touched. Only worthwhile on multi-socket machines; on a single
+ * node, or where NUMA placement is unsupported, nothing is replicated.
+ * `input_B_prepared` must not be modified while it is replicated, and
+ * `int8ReleaseReplicas` must be called before freeing it. This function is
+ * thread-safe, but must not be called while multiplies against
+ * `input_B_prepared` are running.
+ *
+ * @param[in]   input_B_prepared   An array of the output of `int8PrepareB*`.
+ * @param[in]   width              No. of rows of Input matrix B.
+ * @param[in]   cols_B             No. of columns of Input matrix B.
+ * @return      Whether replicas were made.
+ */
+bool int8ReplicateB(const int8_t *input_B_prepared, Index width,
+                    Index cols_B);
+
+/**
+ * Free the replicas of a prepared B made by `int8ReplicateB`. Multiplies
+ * against `input_B_prepared` that are running keep reading their replicas,
+ * which are freed once the last of them returns.
+ */
+void int8ReleaseReplicas(const int8_t *input_B_prepared);
+
+/**
+ * Options for memory holding prepared weights, combined with bitwise or.
+ */
+enum Int8MemoryOptions : uint32_t {
+  // Transparent 2 MB pages (madvise(MADV_HUGEPAGE)).
+  Int8HugePages = 1,
+  // 2 MB pages reserved in the hugetlbfs pool (MAP_HUGETLB), falling back to
+  // transparent ones if the pool cannot provide them.
+  Int8ReservedHugePages = 2,
+  // Pages locked in memory (mlock), so that they are never paged out.
+  Int8LockedPages = 4,
+};
+
+/**
+ * Allocate memory for prepared weights, such as the output of
+ * `int8PrepareB*`.
+ *
+ * Weights are read in a strided way across layers for every token, and
+ * backing them with 2 MB pages saves most of the TLB misses of walking them.
+ * Options the system does not grant (no huge pages configured, a lock limit
+ * too low) are left out rather than failing the allocation. Only Linux
+ * supports any of them. The memory is aligned to 64 bytes, or 2 MB with huge
+ * pages. This function is thread-safe.
+ *
+ * @param[in]   bytes     Size in bytes.
+ * @param[in]   options   `Int8MemoryOptions` to ask for.
+ * @param[out]  applied   If not nullptr, receives the options that took
+ * effect.
+ * @return      The memory, or nullptr if it could not be allocated.
+ */
+void *int8AllocatePrepared(size_t bytes, uint32_t options, uint32_t *applied);
+
+/**
+ * Free memory from `int8AllocatePrepared`. This function is thread-safe.
+ *
+ * @param[in]   ptr   Memory from `int8AllocatePrepared`.
+ */
+void int8FreePrepared(void *ptr);
+
+/**
+ * Apply `Int8HugePages` and `Int8LockedPages` to memory the caller mapped,
+ * such as weights read with mmap.
+ *
+ * Transparent huge pages only back anonymous and tmpfs mappings, and
+ * read-only file mappings on kernels built with CONFIG_READ_ONLY_THP_FOR_FS.
+ * `Int8ReservedHugePages` only applies when allocating and is treated as
+ * `Int8HugePages`. This function is thread-safe.
+ *
+ * @param[in]   ptr       Start of the memory.
+ * @param[in]   bytes     Size of the memory in bytes.
+ * @param[in]   options   `Int8MemoryOptions` to ask for.
+ * @return      The options that took effect.
+ */
+uint32_t int8AdvisePrepared(void *ptr, size_t bytes, uint32_t options);
+
+/**
+ * Handle of an asynchronous multiply, see `int8MultiplyAndAddBiasAsync`.
+ */
+struct Int8Multiply;
+
+/**
+ * Asynchronous variant of `int8MultiplyAndAddBias`.
+ *
+ * Queues the multiply on the library's thread pool and returns a handle right
+ * away, so the caller can do other work (e.g. prepare the next A) while it
+ * runs. The inputs must stay valid and unchanged, and `output` must not be
+ * accessed, until the multiply has completed. The multiply runs at the
+ * priority class of the calling thread. Without a pool to run on (see
+ * `int8SetThreadCount`) it runs before this function returns.
+ *
+ * Every handle must be passed to `int8WaitMultiply` exactly once.
+ *
+ * The parameters up to `accumulate` are those of `int8MultiplyAndAddBias`.
+ * @param[in]   callback    If not nullptr, called with `user_data` on the
+ * thread that ran the multiply once `output` has been written.
+ * @param[in]   user_data   Passed to `callback`.
+ * @return      Handle of the multiply.
+ */
+Int8Multiply *int8MultiplyAndAddBiasAsync(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier, Index rows_A,
+    Index width, Index cols_B, float *output, bool accumulate,
+    void (*callback)(void *user_data) = nullptr, void *user_data = nullptr);
+
+/**
+ * Whether an asynchronous multiply has completed, without blocking.
+ *
+ * @param[in]   multiply   Handle from `int8MultiplyAndAddBiasAsync`.
+ */
+bool int8PollMultiply(const Int8Multiply *multiply);
+
+/**
+ * Wait for an asynchronous multiply to complete and release its handle. The
+ * calling thread helps run the multiply's tiles meanwhile. The handle must not
+ * be used afterwards.
+ *
+ * @param[in]   multiply   Handle from `int8MultiplyAndAddBiasAsync`.
+ */
+void int8WaitMultiply(Int8Multiply *multiply);
+
+/**
+ * Priority classes of multiplies, see `int8SetThreadPriority`.
+ */
+enum class Int8Priority {
+  // Latency sensitive work, e.g. decoding steps of an interactive translation.
+  Interactive = 0,
+  // Throughput oriented work, e.g. translating whole documents.
+  Bulk = 1,
+};
+
+/**
+ * Set the priority class of the multiplies subsequently issued by the calling
+ * thread.
+ *
+ * Tiles of interactive multiplies are picked up by the thread pool before any
+ * bulk tile, and bulk multiplies are cut into short tiles so a worker busy
+ * with bulk work gets to interactive tiles quickly. Threads start out
+ * `Int8Priority::Interactive`.
+ *
+ * @param[in]   priority   Priority class of the calling thread.
+ */
+void int8SetThreadPriority(Int8Priority priority);
+
+/**
+ * The priority class of the calling thread, see `int8SetThreadPriority`.
+ */
+Int8Priority int8GetThreadPriority();
+
+/**
+ * Enable coalescing of concurrent `int8MultiplyAndAddBias` calls against the
+ * same prepared B.
+ *
+ * The first call for a given `input_B_prepared` waits up to `window_us` for
+ * other calls against it to arrive, as long as another thread has a call
+ * against it in flight or made one within the window; a thread alone with its
+ * B never waits. The rows of A of every call gathered are then multiplied at
+ * once, so B is read once for all of them, and each call returns with its own
+ * output as usual. Calls with `accumulate` set or with at least `max_rows`
+ * rows are never coalesced. Coalescing is disabled by default. This function
+ * is thread-safe.
+ *
+ * @param[in]   window_us   Time the first call waits for others to join, in
+ * microseconds. 0 disables coalescing.
+ * @param[in]   max_rows    Rows of A at which a coalesced multiply starts
+ * without waiting for the rest of the window.
+ */
+void int8SetCoalescing(uint32_t window_us, Index max_rows);
+
+/**
+ * Statistics of coalescing of multiplies, see `int8SetCoalescing`.
+ */
+struct Int8CoalescingStats {
+  // Calls that went through the coalescer.
+  uint64_t calls;
+  // Multiplies issued for them. calls / batches is the mean batch size.
+  uint64_t batches;
+};
+
+/**
+ * Coalesced calls and batches since the last reset.
+ */
+Int8CoalescingStats int8GetCoalescingStats();
+
+/**
+ * Reset the counts of coalesced calls and batches.
+ */
+void int8ResetCoalescingStats();
+
+/**
+ * A thread pool of the host application, for the library to run its parallel
+ * work (tiles of multiplies and large column selections) on instead of its
+ * own pool. See `int8SetExecutor`.
+ */
+struct Int8Executor {
+  /**
+   * Runs `run(context, index)` for every `index` in [0, `count`), possibly in
+   * parallel, returning once all have completed. The calling thread may take
+   * part. Tasks never block on one another.
+   */
+  void (*parallel_for)(void *user_data, size_t count,
+                       void (*run)(void *context, size_t index),
+                       void *context, Int8Priority priority);
+
+  /**
+   * Optional. Queues `run(context)` to be run once, soon, without waiting for
+   * it. Used by asynchronous multiplies, which run synchronously if nullptr.
+   * `run` may call `parallel_for`.
+   */
+  void (*post)(void *user_data, void (*run)(void *context), void *context,
+               Int8Priority priority);
+
+  /**
+   * Number of threads `parallel_for` runs on, used to decide how finely work
+   * is split.
+   */
+  size_t concurrency;
+
+  /**
+   * Passed to `parallel_for` and `post`.
+   */
+  void *user_data;
+};
+
+/**
+ * Run the library's parallel work on the host application's thread pool.
+ *
+ * Once set, the library starts no threads of its own, `int8SetThreadCount`
+ * has no effect and the internal pool winds down once the multiplies running
+ * on it return. Priority classes are passed on to the executor, which decides
+ * what to do with them. The executor is copied, but `user_data` must stay
+ * valid until another executor is set. This function is thread-safe.
+ *
+ * @param[in]   executor   The host's executor, or nullptr to go back to the
+ * internal pool.
+ */
+void int8SetExecutor(const Int8Executor *executor);
+
+/**
+ * Interface functions whose calls are recorded by `int8GetCallStats`.
+ * Variants of a function (e.g. of `int8PrepareB`, or the cached and uncached
+ * column selection) are recorded as one.
+ */
+enum class Int8Operation {
+  PrepareA = 0,
+  PrepareB = 1,
+  PrepareBias = 2,
+  SelectColumnsOfB = 3,
+  MultiplyAndAddBias = 4,
+  MultiplyAddBiasAndLayerNorm = 5,
+  MultiplyAndAddBiasSelected = 6,
+};
+
+/**
+ * Phases calls spend their time in, see `int8GetCallStats`.
+ */
+enum class Int8Phase {
+  // Quantizing float inputs to int8.
+  Quantize = 0,
+  // Rearranging or copying int8 data into the layout of the backend.
+  Layout = 1,
+  // Gathering columns of B, or rows of A of coalesced calls.
+  Gather = 2,
+  // The int8 multiply itself, including any packing the backend does as part
+  // of it, and for intgemm the unquantization it fuses into its output.
+  Kernel = 3,
+  // Unquantizing int32 results, adding bias, accumulating and normalizing.
+  Epilogue = 4,
+  Count = 5,
+};
+
+struct Int8PhaseStats {
+  // Times the phase ran. A multiply split into tiles runs its kernel once per
+  // tile.
+  uint64_t runs;
+  // Time spent in the phase, summed over the threads it ran on.
+  uint64_t nanoseconds;
+  // Bytes read and written by the phase, estimated from the shapes involved.
+  uint64_t bytes;
+};
+
+/**
+ * Statistics of the calls to an interface function with a given shape and
+ * tag, see `int8GetCallStats`.
+ */
+struct Int8CallStats {
+  // Tag the calls were made under, see `int8SetCallStatsTag`. Valid for the
+  // life of the process.
+  const char *tag;
+  Int8Operation operation;
+  // Shape of the calls. Dimensions the function does not take are 0, e.g.
+  // `rows_A` for `int8PrepareB`. For selections `cols_B` is `num_cols`.
+  Index rows_A;
+  Index width;
+  Index cols_B;
+  uint64_t calls;
+  // Wall time of the calls.
+  uint64_t nanoseconds;
+  Int8PhaseStats phases[static_cast<size_t>(Int8Phase::Count)];
+};
+
+/**
+ * Set the tag the calls subsequently made by the calling thread are recorded
+ * and traced under, e.g. the name of the layer they compute. Asynchronous
+ * multiplies are recorded under the tag of the thread that issued them. The
+ * tag is copied. Threads start out with the empty tag.
+ *
+ * @param[in]   tag   The tag, nullptr for the empty tag.
+ */
+void int8SetCallStatsTag(const char *tag);
+
+/**
+ * Statistics of calls since the last reset, one entry per function, shape and
+ * tag, ordered by tag, function and shape.
+ *
+ * Calls are only recorded if the library was compiled with MOZINTGEMM_STATS
+ * defined; otherwise recording compiles away and there are never any entries.
+ * This function is thread-safe, calls running concurrently may be partially
+ * included.
+ *
+ * @param[out]  stats      Array of at least `capacity` entries receiving the
+ * first ones.
+ * @param[in]   capacity   Entries `stats` has room for.
+ * @param[in]   reset      Whether to reset the entries returned, atomically
+ * with reading them.
+ * @return      The number of entries there are, which may exceed `capacity`.
+ */
+size_t int8GetCallStats(Int8CallStats *stats, size_t capacity,
+                        bool reset = false);
+
+/**
+ * Reset the statistics of every call.
+ */
+void int8ResetCallStats();
+
+/**
+ * Text formats of `int8FormatCallStats`.
+ */
+enum class Int8StatsFormat {
+  // Prometheus text exposition format, a set of counters labelled by tag,
+  // function, shape and phase.
+  Prometheus = 0,
+  // A JSON array with an object per entry.
+  Json = 1,
+};
+
+/**
+ * Format entries from `int8GetCallStats` as text.
+ *
+ * Behaves like snprintf: at most `size` bytes are written, including a
+ * terminating null character, and the length of the full text is returned.
+ *
+ * @param[in]   stats    Entries to format.
+ * @param[in]   count    Number of entries.
+ * @param[in]   format   Format to use.
+ * @param[out]  buffer   Buffer of `size` bytes, may be nullptr if `size` is 0.
+ * @param[in]   size     Size of `buffer`.
+ * @return      The length of the text, excluding the null character.
+ */
+size_t int8FormatCallStats(const Int8CallStats *stats, size_t count,
+                           Int8StatsFormat format, char *buffer, size_t size);
+
+/**
+ * Start writing a trace of calls and their phases to a file, in the Chrome
+ * trace-event format that ui.perfetto.dev and chrome://tracing open.
+ *
+ * Every call appears on the thread that made it, with its tag and shape, and
+ * its phases on the threads that ran them, so that stragglers, gaps before
+ * workers pick up tiles and concurrent calls holding each other up show. Each
+ * thread records into a buffer of its own without locking, a background
+ * thread writes the buffers out every few milliseconds. This does not require
+ * MOZINTGEMM_STATS, and while no trace runs a call only checks a flag. This
+ * function is thread-safe.
+ *
+ * @param[in]   path   File to write the trace to, replaced if it exists.
+ * @return      Whether tracing started. It does not if a trace is already
+ * running or the file cannot be opened.
+ */
+bool int8StartTrace(const char *path);
+
+/**
+ * Stop the trace started by `int8StartTrace`, writing out the remaining
+ * events and closing the file. Calls still running are left out. This
+ * function is thread-safe.
+ *
+ * @return      The number of events dropped because a thread recorded them
+ * faster than they were written out.
+ */
+uint64_t int8StopTrace();
+
+/**
+ * File formats of `int8StartShapeTrace`.
+ */
+enum class Int8ShapeTraceFormat {
+  // Comma-separated values with a header line,
+  // `timestamp_ns,thread,operation,rows_A,width,cols_B`.
+  Csv = 0,
+  // The magic `MOZSHAPE`, a version and record size, then fixed-size
+  // little-endian records of the same fields, see shape_trace.inl.
+  Binary = 1,
+};
+
+/**
+ * Start recording the function and shape of every interface call to a file,
+ * so that benchmarks can replay the shapes a production workload calls with.
+ *
+ * Each call made from outside the library is recorded with the time since
+ * the trace started and the thread that made it; calls the library makes to
+ * its own interface are not. Each thread records into a buffer of its own
+ * without locking, a background thread writes the buffers out every few
+ * milliseconds. Like `int8StartTrace` this does not require
+ * MOZINTGEMM_STATS, and while no trace runs a call only checks a flag. This
+ * function is thread-safe.
+ *
+ * @param[in]   path     File to record to, replaced if it exists.
+ * @param[in]   format   Format of the file.
+ * @return      Whether recording started. It does not if a shape trace is
+ * already running or the file cannot be opened.
+ */
+bool int8StartShapeTrace(const char *path, Int8ShapeTraceFormat format);
+
+/**
+ * Stop the shape trace started by `int8StartShapeTrace`, writing out the
+ * remaining calls and closing the file. This function is thread-safe.
+ *
+ * @return      The number of calls dropped because a thread made them faster
+ * than they were written out.
+ */
+uint64_t int8StopShapeTrace();
@@ -0,0 +1,180 @@
+// Interface functions implemented the same way for every backend, on top of
+// the backend specific functions in moz_intgemm_{ruy,intgemm}.inl.
+
+const Int8Selection *
+int8SelectColumnsOfBCached(const int8_t *input_B_prepared,
+                           const float *input_bias_prepared, Index width,
+                           Index cols_B, const Index *cols, Index num_cols) {
+  runtime::CallScope call(Int8Operation::SelectColumnsOfB, 0, width, num_cols);
+  return runtime::selectionCache().acquire(
+      input_B_prepared, input_bias_prepared, width, cols_B, cols, num_cols,
+      [&](int8_t *B_selected, float *bias_selected) {
+        int8SelectColumnsOfB(input_B_prepared, width, cols_B, cols, num_cols,
+                             B_selected);
+        if (bias_selected) {
+          for (Index c = 0; c < num_cols; c++) {
+            bias_selected[c] = input_bias_prepared[cols[c]];
+          }
+        }
+      });
+}
+
+const int8_t *int8SelectionB(const Int8Selection *selection) {
+  return selection->B_selected;
+}
+
+const float *int8SelectionBias(const Int8Selection *selection) {
+  return selection->bias_selected;
+}
+
+void int8ReleaseSelection(const Int8Selection *selection) {
+  runtime::SelectionCache::release(selection);
+}
+
+void int8SetSelectionCacheCapacity(size_t bytes) {
+  runtime::selectionCache().setCapacity(bytes);
+}
+
+void int8ClearSelectionCache() { runtime::selectionCache().clear(); }
+
+Int8SelectionCacheStats int8GetSelectionCacheStats() {
+  return runtime::selectionCache().stats();
+}
+
+void int8ResetSelectionCacheStats() { runtime::selectionCache().resetStats(); }
+
+void int8SetThreadCount(size_t threads) { runtime::setThreadCount(threads); }
+
+void int8SetThreadPinning(bool pin) { runtime::setThreadPinning(pin); }
+
+void int8BeginSession() { runtime::spinPolicy().beginSession(); }
+
+void int8EndSession() { runtime::spinPolicy().endSession(); }
+
+void int8SetWorkspace(void *workspace, size_t bytes) {
+  runtime::setWorkspace(workspace, bytes);
+}
+
+void int8SetBufferPooling(bool enabled) {
+  runtime::bufferPool().setEnabled(enabled);
+}
+
+void *int8AllocatePrepared(size_t bytes, uint32_t options, uint32_t *applied) {
+  return runtime::preparedAllocations().allocate(bytes, options, applied);
+}
+
+void int8FreePrepared(void *ptr) { runtime::preparedAllocations().free(ptr); }
+
+uint32_t int8AdvisePrepared(void *ptr, size_t bytes, uint32_t options) {
+  return runtime::advisePages(ptr, bytes, options);
+}
+
+void int8SetExecutor(const Int8Executor *executor) {
+  runtime::setExecutor(executor);
+}
+
+bool int8ReplicateB(const int8_t *input_B_prepared, Index width,
+                    Index cols_B) {
+  return runtime::replicaRegistry().replicate(
+      input_B_prepared, static_cast<size_t>(width) * cols_B);
+}
+
+void int8ReleaseReplicas(const int8_t *input_B_prepared) {
+  runtime::replicaRegistry().release(input_B_prepared);
+}
+
+Int8Multiply *int8MultiplyAndAddBiasAsync(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier, Index rows_A,
+    Index width, Index cols_B, float *output, bool accumulate,
+    void (*callback)(void *user_data), void *user_data) {
+  Int8Multiply *multiply = new Int8Multiply([](const void *closure, size_t) {
+    const Int8Multiply *m = static_cast<const Int8Multiply *>(closure);
+    runtime::StatsTagScope stats_tag(m->stats_tag);
+    int8MultiplyAndAddBias(m->input_A_prepared, m->scale_A, m->zero_point_A,
+                           m->input_B_prepared, m->scale_B, m->zero_point_B,
+                           m->input_bias_prepared, m->unquant_multiplier,
+                           m->rows_A, m->width, m->cols_B, m->output,
+                           m->accumulate);
+    if (m->callback) {
+      m->callback(m->user_data);
+    }
+  });
+  multiply->input_A_prepared = input_A_prepared;
+  multiply->scale_A = scale_A;
+  multiply->zero_point_A = zero_point_A;
+  multiply->input_B_prepared = input_B_prepared;
+  multiply->scale_B = scale_B;
+  multiply->zero_point_B = zero_point_B;
+  multiply->input_bias_prepared = input_bias_prepared;
+  multiply->unquant_multiplier = unquant_multiplier;
+  multiply->rows_A = rows_A;
+  multiply->width = width;
+  multiply->cols_B = cols_B;
+  multiply->output = output;
+  multiply->accumulate = accumulate;
+  multiply->callback = callback;
+  multiply->user_data = user_data;
+  multiply->stats_tag = runtime::statsContext().tag;
+
+  multiply->pool = runtime::scheduler();
+  multiply->pool->spawn(multiply->job);
+  return multiply;
+}
+
+bool int8PollMultiply(const Int8Multiply *multiply) {
+  return multiply->job.remaining.load(std::memory_order_acquire) == 0;
+}
+
+void int8WaitMultiply(Int8Multiply *multiply) {
+  multiply->pool->wait(multiply->job);
+  delete multiply;
+}
+
+void int8SetThreadPriority(Int8Priority priority) {
+  runtime::threadPriority() = priority;
+}
+
+Int8Priority int8GetThreadPriority() { return runtime::threadPriority(); }
+
+void int8SetCoalescing(uint32_t window_us, Index max_rows) {
+  runtime::coalescer().configure(window_us, max_rows);
+}
+
+Int8CoalescingStats int8GetCoalescingStats() {
+  return runtime::coalescer().stats();
+}
+
+void int8ResetCoalescingStats() { runtime::coalescer().resetStats(); }
+
+void int8SetCallStatsTag(const char *tag) { runtime::setStatsTag(tag); }
+
+size_t int8GetCallStats(Int8CallStats *stats, size_t capacity, bool reset) {
+  return runtime::callStats().snapshot(stats, capacity, reset);
+}
+
+void int8ResetCallStats() { runtime::callStats().reset(); }
+
+size_t int8FormatCallStats(const Int8CallStats *stats, size_t count,
+                           Int8StatsFormat format, char *buffer, size_t size) {
+  const std::string text = format == Int8StatsFormat::Json
+                               ? runtime::formatJson(stats, count)
+                               : runtime::formatPrometheus(stats, count);
+  if (size != 0) {
+    const size_t copied = std::min(size - 1, text.size());
+    std::memcpy(buffer, text.data(), copied);
+    buffer[copied] = '\0';
+  }
+  return text.size();
+}
+
+bool int8StartTrace(const char *path) { return runtime::startTrace(path); }
+
+uint64_t int8StopTrace() { return runtime::stopTrace(); }
+
+bool int8StartShapeTrace(const char *path, Int8ShapeTraceFormat format) {
+  return runtime::startShapeTrace(path, format);
+}
+
+uint64_t int8StopShapeTrace() { return runtime::stopShapeTrace(); }
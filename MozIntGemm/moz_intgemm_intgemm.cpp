@@ -6,8 +6,14 @@
  * implementation of "wasm_gemm_interface.h".
  */
 
+#include "3rd-party/intgemm/intgemm/aligned.h"
 #include "3rd-party/intgemm/intgemm/intgemm.h"
 #include "moz_intgemm.h"
+#include "runtime.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
 #include "moz_intgemm_intgemm.inl"
+#include "moz_intgemm_common.inl"
@@ -1,12 +1,28 @@
 
+// Size in bytes of the scratch block used by epilogues intgemm callbacks cannot
+// express (accumulate, layer normalization). Kept within L2 so the block is
+// still hot when it is consumed.
+constexpr size_t kAccumulateBlockSize = 256 * 1024;
+
+// Size in bytes of the block of selected B columns gathered at a time by
+// int8MultiplyAndAddBiasSelected.
+constexpr size_t kSelectBlockSize = 32 * 1024;
+
 void int8PrepareA(const float *input_A, float scale, float zero_point,
                   Index rows_A, Index width, int8_t *output) {
+  runtime::CallScope call(Int8Operation::PrepareA, rows_A, width, 0);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Quantize,
+                            uint64_t{5} * rows_A * width);
   intgemm::Int8Shift::PrepareA(input_A, output, scale, /*Quant Mult*/
                                rows_A, width);
 }
 
 void int8PrepareB(const float *input_B, float scale, float zero_point,
                   Index width, Index cols_B, int8_t *output) {
+  // Quantizes and rearranges in a single pass.
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Quantize,
+                            uint64_t{5} * width * cols_B);
   intgemm::Int8::PrepareB(input_B, output, scale, /*Quant Mult*/
                           width, cols_B);
 }
@@ -14,6 +30,9 @@ void int8PrepareB(const float *input_B, float scale, float zero_point,
 void int8PrepareBFromTransposed(const float *input_B_transposed, float scale,
                                 float zero_point, Index width, Index cols_B,
                                 int8_t *output) {
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Quantize,
+                            uint64_t{5} * width * cols_B);
   intgemm::Int8::PrepareBTransposed(input_B_transposed, output, scale, width,
                                     cols_B);
 }
@@ -21,6 +40,9 @@ void int8PrepareBFromTransposed(const float *input_B_transposed, float scale,
 void int8PrepareBFromQuantizedTransposed(const int8_t *input_B_quant_transposed,
                                          Index width, Index cols_B,
                                          int8_t *output) {
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Layout,
+                            uint64_t{2} * width * cols_B);
   intgemm::Int8::PrepareBQuantizedTransposed(input_B_quant_transposed, output,
                                              width, cols_B);
 }
@@ -31,28 +53,323 @@ void int8PrepareBias(const int8_t *input_B_prepared, float scale_A,
                      float *output) {
   float unquant_factor =
       (-1) * ((127.0f / scale_A) * (127.0f / scale_B)) / (127.0f);
+  // Multiplies a row of ones with B, the compensation of Int8Shift.
+  runtime::CallScope call(Int8Operation::PrepareBias, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Kernel,
+                            runtime::multiplyBytes(1, width, cols_B) +
+                                uint64_t{4} * cols_B);
   intgemm::Int8Shift::PrepareBias(
       input_B_prepared, width, cols_B,
       intgemm::callbacks::UnquantizeAndAddBiasAndWrite(unquant_factor,
                                                        input_bias, output));
 }
 
+// Columns gathered at a time by int8MultiplyAndAddBiasSelected.
+Index selectBlockCols(Index width, Index num_cols) {
+  return std::min<Index>(
+      num_cols, std::max<Index>(8, (kSelectBlockSize / width) / 8 * 8));
+}
+
+size_t int8WorkspaceSize(Index rows_A, Index width, Index cols_B) {
+  // A staging buffer for the float result, which also covers the block of
+  // rows layer normalization goes through.
+  const size_t multiply =
+      runtime::roundUpToAlignment(sizeof(float) * rows_A * cols_B);
+
+  // Selecting up to cols_B columns, through an output block unless there is
+  // a single row.
+  const Index block_cols = selectBlockCols(width, cols_B);
+  const size_t selected =
+      runtime::roundUpToAlignment(width * block_cols) +
+      runtime::roundUpToAlignment(sizeof(float) * block_cols) +
+      (rows_A > 1 ? runtime::roundUpToAlignment(sizeof(float) * rows_A *
+                                                block_cols)
+                  : 0);
+  return std::max(multiply, selected);
+}
+
+// Multiplies the rows of A of every call in a coalesced batch at once, then
+// unquantizes and adds bias for each call's slice of the result. The shift
+// compensation of Int8Shift lives in each call's prepared bias, so unscaled
+// results are produced first and scaled per call.
+void multiplyCoalesced(const runtime::CoalescedBatch &batch) {
+  const Index width = batch.width;
+  const Index cols_B = batch.cols_B;
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+  runtime::Scratch<int8_t> A(batch.rows * width);
+  runtime::Scratch<float> result(batch.rows * cols_B);
+
+  Index row = 0;
+  {
+    runtime::PhaseTimer timer(stats, Int8Phase::Gather,
+                              uint64_t{2} * batch.rows * width);
+    for (const runtime::CoalescedCall *call : batch.calls) {
+      std::memcpy(A.begin() + row * width, call->A, call->rows * width);
+      row += call->rows;
+    }
+  }
+
+  const runtime::PinnedReplica replica(batch.B);
+  runtime::TileGrid grid = runtime::partition(
+      batch.rows, width, cols_B, /*row_grain=*/8, /*col_grain=*/cols_B);
+  runtime::runTiles(grid, [&](Index row_begin, Index row_end, Index, Index) {
+    runtime::PhaseTimer timer(
+        stats, Int8Phase::Kernel,
+        runtime::multiplyBytes(row_end - row_begin, width, cols_B));
+    intgemm::Int8Shift::Multiply(
+        A.begin() + row_begin * width, replica.local(), row_end - row_begin,
+        width, cols_B,
+        intgemm::callbacks::UnquantizeAndWrite(
+            1.0f, result.begin() + row_begin * cols_B));
+  });
+
+  row = 0;
+  for (const runtime::CoalescedCall *call : batch.calls) {
+    runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                              uint64_t{8} * call->rows * cols_B +
+                                  uint64_t{4} * cols_B);
+    const float *call_result = result.begin() + row * cols_B;
+    for (Index i = 0; i < call->rows; i++) {
+      for (Index j = 0; j < cols_B; j++) {
+        call->output[i * cols_B + j] =
+            call_result[i * cols_B + j] * call->unquant_multiplier +
+            call->bias[j];
+      }
+    }
+    row += call->rows;
+  }
+}
+
 void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
                             float zero_point_A, const int8_t *input_B_prepared,
                             float scale_B, float zero_point_B,
                             const float *input_bias_prepared,
                             float unquant_multiplier, Index rows_A, Index width,
-                            Index cols_B, float *output) {
+                            Index cols_B, float *output, bool accumulate) {
   float unquant_factor = unquant_multiplier / (scale_A * scale_B);
-  intgemm::Int8Shift::Multiply(
-      input_A_prepared, input_B_prepared, rows_A, width, cols_B,
-      intgemm::callbacks::UnquantizeAndAddBiasAndWrite(
-          unquant_factor, input_bias_prepared, output));
+  runtime::CallScope call(Int8Operation::MultiplyAndAddBias, rows_A, width,
+                          cols_B);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  if (!accumulate &&
+      runtime::coalescer().coalesce(input_A_prepared, input_B_prepared,
+                                    input_bias_prepared, unquant_factor,
+                                    rows_A, width, cols_B, output,
+                                    multiplyCoalesced)) {
+    return;
+  }
+
+  // Prepared B is stored in blocks of 8 columns, so a tile's columns are a
+  // prepared B of their own. The shared dimension is interleaved within each
+  // block and cannot be split.
+  runtime::TileGrid grid = runtime::partition(
+      rows_A, width, cols_B, /*row_grain=*/8, /*col_grain=*/8);
+
+  // intgemm callbacks write rows as wide as the columns multiplied, which
+  // lands in place only for full rows or a single row. Other tiles (and any
+  // tile when adding onto the existing contents of output, which callbacks
+  // cannot read) are produced in their own part of a staging buffer, a
+  // band_rows x cols block at offset row_begin * cols_B + col_begin *
+  // band_rows, and then copied or added into place.
+  const bool staged = accumulate || (grid.col_tiles > 1 && rows_A > 1);
+  runtime::Scratch<float> staging(staged ? rows_A * cols_B : 0);
+  const runtime::PinnedReplica replica(input_B_prepared);
+  runtime::runTiles(grid, [&](Index row_begin, Index row_end, Index col_begin,
+                              Index col_end) {
+    const int8_t *A_band = input_A_prepared + row_begin * width;
+    const int8_t *B = replica.local() + col_begin * width;
+    const float *bias = input_bias_prepared + col_begin;
+    float *output_tile = output + row_begin * cols_B + col_begin;
+    const Index band_rows = row_end - row_begin;
+    const Index cols = col_end - col_begin;
+    if (!accumulate && (cols == cols_B || band_rows == 1)) {
+      runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                runtime::multiplyBytes(band_rows, width, cols));
+      intgemm::Int8Shift::Multiply(
+          A_band, B, band_rows, width, cols,
+          intgemm::callbacks::UnquantizeAndAddBiasAndWrite(
+              unquant_factor, bias, output_tile));
+      return;
+    }
+
+    // Rows go in blocks small enough to still be in cache when they are
+    // moved into place, so output is still read and written once.
+    const Index block_rows = std::min<Index>(
+        band_rows,
+        std::max<Index>(1, kAccumulateBlockSize / (sizeof(float) * cols)));
+    float *tile_staging =
+        staging.data() + row_begin * cols_B + col_begin * band_rows;
+    for (Index row = 0; row < band_rows; row += block_rows) {
+      const Index rows = std::min<Index>(block_rows, band_rows - row);
+      float *block = tile_staging + row * cols;
+      {
+        runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                  runtime::multiplyBytes(rows, width, cols));
+        intgemm::Int8Shift::Multiply(
+            A_band + row * width, B, rows, width, cols,
+            intgemm::callbacks::UnquantizeAndAddBiasAndWrite(unquant_factor,
+                                                             bias, block));
+      }
+
+      runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                                uint64_t{4} * rows * cols *
+                                    (accumulate ? 3 : 2));
+      for (Index i = 0; i < rows; i++) {
+        float *output_row = output_tile + (row + i) * cols_B;
+        const float *block_row = block + i * cols;
+        if (accumulate) {
+          for (Index j = 0; j < cols; j++) {
+            output_row[j] += block_row[j];
+          }
+        } else {
+          std::memcpy(output_row, block_row, sizeof(float) * cols);
+        }
+      }
+    }
+  });
+}
+
+// Adds residual onto row, then writes the layer-normalized row into output.
+// row is used as scratch and is expected to be in cache.
+void layerNormRow(float *row, const float *residual, const float *gamma,
+                  const float *beta, float epsilon, Index cols,
+                  float *output) {
+  float sum = 0.0f;
+  for (Index j = 0; j < cols; j++) {
+    if (residual) {
+      row[j] += residual[j];
+    }
+    sum += row[j];
+  }
+
+  float mean = sum / cols;
+  float sum_squares = 0.0f;
+  for (Index j = 0; j < cols; j++) {
+    float diff = row[j] - mean;
+    sum_squares += diff * diff;
+  }
+  float inv_std = 1.0f / std::sqrt(sum_squares / cols + epsilon);
+
+  for (Index j = 0; j < cols; j++) {
+    float value = (row[j] - mean) * inv_std * gamma[j];
+    output[j] = beta ? value + beta[j] : value;
+  }
+}
+
+void int8MultiplyAddBiasAndLayerNorm(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier,
+    const float *residual, const float *gamma, const float *beta,
+    float epsilon, Index rows_A, Index width, Index cols_B, float *output) {
+  float unquant_factor = unquant_multiplier / (scale_A * scale_B);
+  runtime::CallScope call(Int8Operation::MultiplyAddBiasAndLayerNorm, rows_A,
+                          width, cols_B);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  // As with accumulate, rows are produced in blocks small enough to stay in
+  // cache. Residual and layer normalization are then applied row by row, so
+  // output is only written once.
+  const Index block_rows = std::min<Index>(
+      rows_A,
+      std::max<Index>(1, kAccumulateBlockSize / (sizeof(float) * cols_B)));
+  runtime::Scratch<float> block(block_rows * cols_B);
+  const runtime::PinnedReplica replica(input_B_prepared);
+  const int8_t *B = replica.local();
+  for (Index row = 0; row < rows_A; row += block_rows) {
+    const Index rows = std::min<Index>(block_rows, rows_A - row);
+    {
+      runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                runtime::multiplyBytes(rows, width, cols_B));
+      intgemm::Int8Shift::Multiply(
+          input_A_prepared + row * width, B, rows, width, cols_B,
+          intgemm::callbacks::UnquantizeAndAddBiasAndWrite(
+              unquant_factor, input_bias_prepared, block.begin()));
+    }
+
+    runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                              uint64_t{4} * rows * cols_B * (residual ? 3 : 2) +
+                                  uint64_t{8} * cols_B);
+    for (Index i = 0; i < rows; i++) {
+      const Index offset = (row + i) * cols_B;
+      layerNormRow(block.begin() + i * cols_B,
+                   residual ? residual + offset : nullptr, gamma, beta, epsilon,
+                   cols_B, output + offset);
+    }
+  }
+}
+
+void int8MultiplyAndAddBiasSelected(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float unquant_multiplier, Index rows_A,
+    Index width, Index cols_B, const Index *cols, Index num_cols,
+    float *output) {
+  float unquant_factor = unquant_multiplier / (scale_A * scale_B);
+  runtime::CallScope call(Int8Operation::MultiplyAndAddBiasSelected, rows_A,
+                          width, num_cols);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  // Selected columns of B and their bias are gathered a block at a time, into
+  // buffers small enough to stay in cache while the block is multiplied.
+  const Index block_cols = selectBlockCols(width, num_cols);
+  runtime::Scratch<int8_t> B_block(width * block_cols);
+  runtime::Scratch<float> bias_block(block_cols);
+
+  // intgemm writes rows of the block contiguously, while they are strided in
+  // output. Unless there is a single row, go through a scratch block.
+  runtime::Scratch<float> output_block(rows_A == 1 ? 0 : rows_A * block_cols);
+
+  const runtime::PinnedReplica replica(input_B_prepared);
+  const int8_t *B = replica.local();
+  for (Index c = 0; c < num_cols; c += block_cols) {
+    const Index block = std::min<Index>(block_cols, num_cols - c);
+    {
+      runtime::PhaseTimer timer(stats, Int8Phase::Gather,
+                                uint64_t{2} * width * block +
+                                    uint64_t{8} * block);
+      intgemm::Int8::SelectColumnsB(B, B_block.begin(), width, cols + c,
+                                    cols + c + block);
+      for (Index j = 0; j < block; j++) {
+        bias_block[j] = input_bias_prepared[cols[c + j]];
+      }
+    }
+
+    float *target = rows_A == 1 ? output + c : output_block.begin();
+    {
+      runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                runtime::multiplyBytes(rows_A, width, block));
+      intgemm::Int8Shift::Multiply(
+          input_A_prepared, B_block.begin(), rows_A, width, block,
+          intgemm::callbacks::UnquantizeAndAddBiasAndWrite(
+              unquant_factor, bias_block.begin(), target));
+    }
+
+    if (rows_A != 1) {
+      runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                                uint64_t{8} * rows_A * block);
+      for (Index i = 0; i < rows_A; i++) {
+        std::memcpy(output + i * num_cols + c, output_block.begin() + i * block,
+                    sizeof(float) * block);
+      }
+    }
+  }
 }
 
 void int8SelectColumnsOfB(const int8_t *input_B_prepared, Index width,
                           Index cols_B, const Index *cols, const Index num_cols,
                           int8_t *output) {
-  intgemm::Int8::SelectColumnsB(input_B_prepared, output, width, cols,
-                                cols + num_cols);
+  // Prepared B is stored in blocks of 8 columns, so chunks of the selection
+  // land at c * width in output as long as they start on a multiple of 8.
+  runtime::CallScope call(Int8Operation::SelectColumnsOfB, 0, width, num_cols);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+  size_t min_chunk = runtime::kParallelGatherMinBytes / width;
+  const runtime::PinnedReplica replica(input_B_prepared);
+  runtime::parallelFor(
+      num_cols, min_chunk, /*grain=*/8, [&](size_t begin, size_t end) {
+        runtime::PhaseTimer timer(stats, Int8Phase::Gather,
+                                  uint64_t{2} * width * (end - begin));
+        intgemm::Int8::SelectColumnsB(replica.local(), output + begin * width,
+                                      width, cols + begin, cols + end);
+      });
 }
@@ -1,5 +1,6 @@
 #include "detail.h"
 #include "moz_intgemm.h"
+#include "runtime.h"
 #include "ruy/ruy.h"
 #include "ruy/system_aligned_alloc.h"
 #include <algorithm>
@@ -7,3 +8,4 @@
 #include <cmath>
 
 #include "moz_intgemm_ruy.inl"
+#include "moz_intgemm_common.inl"
@@ -4,18 +4,34 @@
   } while (0)
 #endif
 
+// Size in bytes of the block of selected B columns gathered at a time by
+// int8MultiplyAndAddBiasSelected. Sized to stay in L1 while it is packed.
+constexpr size_t kSelectBlockSize = 32 * 1024;
+
+// Size in bytes of the block of int32 results int8MultiplyAddBiasAndLayerNorm
+// produces at a time in each tile. Kept within L2 so the block is still hot
+// when it is normalized.
+constexpr size_t kAccumulateBlockSize = 256 * 1024;
+
 void int8PrepareB(const float *input_B, float scale, float zero_point,
                   Index width, Index cols_B, int8_t *output) {
   // Client matrix is expected to be row-major. We are allowed to change
   // internal representation starting here. Column major is preferable for B
   // when A*B (dot product of A row with B column). Ideally this function is
   // called once, offline.
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+  const uint64_t elements = uint64_t{width} * cols_B;
   PRINT_MATRIX_DEBUG(input_B, width, cols_B, Order::RowMajor);
-  std::vector<int8_t> B_quantized(width * cols_B);
-  detail::Preprocess<detail::kHighestPath>::quantize(
-      input_B, scale, zero_point, width, cols_B, B_quantized.data());
+  runtime::Scratch<int8_t> B_quantized(width * cols_B);
+  {
+    runtime::PhaseTimer timer(stats, Int8Phase::Quantize, 5 * elements);
+    detail::Preprocess<detail::kHighestPath>::quantize(
+        input_B, scale, zero_point, width, cols_B, B_quantized.data());
+  }
   PRINT_MATRIX_DEBUG(B_quantized.data(), width, cols_B, Order::RowMajor);
 
+  runtime::PhaseTimer timer(stats, Int8Phase::Layout, 2 * elements);
   detail::Preprocess<detail::kHighestPath>::transpose(B_quantized.data(), width,
                                                       cols_B, output);
 }
@@ -25,6 +41,9 @@ void int8PrepareBFromTransposed(const float *input_B_transposed, float scale,
                                 int8_t *output) {
   // Assuming B is transposed, we like it transposed(?). What's left is
   // quantize.
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Quantize,
+                            uint64_t{5} * width * cols_B);
   detail::Preprocess<detail::kHighestPath>::quantize(
       input_B_transposed, scale, zero_point, width, cols_B, output);
 }
@@ -33,12 +52,18 @@ void int8PrepareBFromQuantizedTransposed(const int8_t *input_B_quant_transposed,
                                          Index width, Index cols_B,
                                          int8_t *output) {
   // Isn't this a no-op, or more specifically a copy.
+  runtime::CallScope call(Int8Operation::PrepareB, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Layout,
+                            uint64_t{2} * width * cols_B);
   std::memcpy(output, input_B_quant_transposed,
               /*count=*/sizeof(int8_t) * (width * cols_B));
 }
 
 void int8PrepareA(const float *input_A, float scale, float zero_point,
                   Index rows_A, Index width, int8_t *output) {
+  runtime::CallScope call(Int8Operation::PrepareA, rows_A, width, 0);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Quantize,
+                            uint64_t{5} * rows_A * width);
   detail::Preprocess<detail::kHighestPath>::quantize(input_A, scale, zero_point,
                                                      rows_A, width, output);
 }
@@ -49,28 +74,30 @@ void int8PrepareBias(const int8_t *input_B_prepared, float scale_A,
                      float *output) {
   // Copy bias as is. Ruy supports int8_t*int8_t -> int32_t, so we don't need to
   // do any trickery with bias to add/substract offset.
+  runtime::CallScope call(Int8Operation::PrepareBias, 0, width, cols_B);
+  runtime::PhaseTimer timer(runtime::callStatsEntry(), Int8Phase::Layout,
+                            uint64_t{8} * cols_B);
   std::memcpy(output, input_bias, /*count=*/sizeof(float) * (1 * cols_B));
 }
 
-void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
-                            float zero_point_A, const int8_t *input_B_prepared,
-                            float scale_B, float zero_point_B,
-                            const float *input_bias_prepared,
-                            float scale_output, Index rows_A, Index width,
-                            Index cols_B, float *output) {
-
-  // It is expected that somehow we have managed to call all prepare by the time
-  // we are here, with inputs (prepared) in int8_t. All that's left to do is use
-  // ruy for multiply and then start with the reverse ops to get to fp32.
-
+// Multiplies prepared A (row-major) with prepared B (col-major) through ruy,
+// writing the int32 result in row-major order to output, with consecutive rows
+// output_stride elements apart. Rows of A and columns of B are input_stride
+// apart, 0 if they are packed (width apart).
+void ruyMultiply(ruy::Context *context, const int8_t *input_A_prepared,
+                 const int8_t *input_B_prepared, Index rows_A, Index width,
+                 Index cols_B, std::int32_t *output, Index output_stride,
+                 Index input_stride = 0) {
   // Use ruy to multiply.
   // The following is adapted from
   // https://github.com/google/ruy/blob/878283640de7946a43053e8ebf4f15114fbc9156/example/example.cc#L129-L152
 
-  ruy::Context context;
   ruy::Matrix<std::int8_t> lhs;
   ruy::MakeSimpleLayout(rows_A, width, ruy::Order::kRowMajor,
                         lhs.mutable_layout());
+  if (input_stride) {
+    lhs.mutable_layout()->set_stride(input_stride);
+  }
   lhs.set_data(input_A_prepared);
 
   PRINT_MATRIX_DEBUG(input_A_prepared, rows_A, width, Order::RowMajor);
@@ -78,6 +105,9 @@ void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
   ruy::Matrix<std::int8_t> rhs;
   ruy::MakeSimpleLayout(width, cols_B, ruy::Order::kColMajor,
                         rhs.mutable_layout());
+  if (input_stride) {
+    rhs.mutable_layout()->set_stride(input_stride);
+  }
   rhs.set_data(input_B_prepared);
 
   PRINT_MATRIX_DEBUG(input_B_prepared, width, cols_B, Order::ColMajor);
@@ -85,19 +115,376 @@ void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
   ruy::Matrix<std::int32_t> dst;
   ruy::MakeSimpleLayout(rows_A, cols_B, ruy::Order::kRowMajor,
                         dst.mutable_layout());
-
-  std::int32_t *dest_ptr = reinterpret_cast<std::int32_t *>(output);
-  dst.set_data(dest_ptr);
+  dst.mutable_layout()->set_stride(output_stride);
+  dst.set_data(output);
 
   // When Dst is int32, mul_params is unused.
   ruy::MulParams<std::int32_t, std::int32_t> mul_params;
-  ruy::Mul(lhs, rhs, mul_params, &context, &dst);
+  ruy::Mul(lhs, rhs, mul_params, context, &dst);
+}
+
+// Columns gathered at a time by int8MultiplyAndAddBiasSelected.
+Index selectBlockCols(Index width, Index num_cols) {
+  return std::min<Index>(
+      num_cols, std::max<Index>(8, (kSelectBlockSize / width) / 8 * 8));
+}
+
+size_t int8WorkspaceSize(Index rows_A, Index width, Index cols_B) {
+  // An int32 accumulator, plus partial sums for every slice of the shared
+  // dimension but the first if it is split.
+  const size_t result =
+      runtime::roundUpToAlignment(sizeof(std::int32_t) * rows_A * cols_B);
+  const size_t slices = std::max<Index>(1, width / runtime::kMinTileDepth);
+  const size_t multiply = result * slices;
+
+  // Selecting up to cols_B columns.
+  const size_t selected =
+      runtime::roundUpToAlignment(width * selectBlockCols(width, cols_B)) +
+      runtime::roundUpToAlignment(sizeof(float) * cols_B);
+  return std::max(multiply, selected);
+}
+
+// ruy::Context of the calling thread. Multiplies are split into tiles by the
+// library's scheduler, so each tile runs single-threaded on a context that
+// lives as long as its thread rather than one created per call.
+ruy::Context *threadContext() {
+  static thread_local ruy::Context context;
+  return &context;
+}
+
+// Largest multiply, in each dimension, that a context has run. Its packing
+// buffers only grow, so it holds anything up to that size without allocating.
+struct ContextExtent {
+  Index rows = 0;
+  Index depth = 0;
+  Index cols = 0;
+
+  bool covers(Index r, Index d, Index c) const {
+    return rows >= r && depth >= d && cols >= c;
+  }
+};
+
+// Grows the context of the calling thread to hold a multiply of rows x depth
+// by depth x cols, unless it already does, by running one on zeros.
+void warmThreadContext(Index rows, Index depth, Index cols) {
+  static thread_local ContextExtent extent;
+  if (extent.covers(rows, depth, cols)) {
+    return;
+  }
+  extent = ContextExtent{std::max(extent.rows, rows),
+                         std::max(extent.depth, depth),
+                         std::max(extent.cols, cols)};
+  runtime::Scratch<int8_t> A(extent.rows * extent.depth);
+  runtime::Scratch<int8_t> B(extent.depth * extent.cols);
+  runtime::Scratch<std::int32_t> result(extent.rows * extent.cols);
+  std::memset(A.data(), 0, extent.rows * extent.depth);
+  std::memset(B.data(), 0, extent.depth * extent.cols);
+  ruyMultiply(threadContext(), A.data(), B.data(), extent.rows, extent.depth,
+              extent.cols, result.data(), extent.cols);
+}
+
+// Readies the contexts of the calling thread and of every worker of grid's
+// pool for tiles of up to rows x depth by depth x cols. Otherwise a context
+// grows on the first tile of a new largest shape it picks up, and whichever
+// threads work stealing kept from those allocate on some later multiply. The
+// workers are only reached once per pool and shape; host executor threads
+// (see int8SetExecutor) are not reached and grow as they go.
+void warmContexts(const runtime::TileGrid &grid, Index rows, Index depth,
+                  Index cols) {
+  if (!grid.pool) {
+    return;
+  }
+  warmThreadContext(rows, depth, cols);
+
+  struct Warmed {
+    std::mutex mutex;
+    // Compared by owner, a new pool never passes for one that is gone.
+    std::weak_ptr<runtime::Scheduler> pool;
+    ContextExtent extent;
+  };
+  static Warmed warmed;
+  ContextExtent extent;
+  {
+    std::lock_guard<std::mutex> lock(warmed.mutex);
+    const bool same = !warmed.pool.owner_before(grid.pool) &&
+                      !grid.pool.owner_before(warmed.pool);
+    if (same && warmed.extent.covers(rows, depth, cols)) {
+      return;
+    }
+    if (same) {
+      extent = warmed.extent;
+    }
+  }
+  extent = ContextExtent{std::max(extent.rows, rows),
+                         std::max(extent.depth, depth),
+                         std::max(extent.cols, cols)};
+  grid.pool->broadcast(
+      [&extent] { warmThreadContext(extent.rows, extent.depth, extent.cols); });
+
+  std::lock_guard<std::mutex> lock(warmed.mutex);
+  warmed.pool = grid.pool;
+  warmed.extent = extent;
+}
 
-  // Unquantizes, then adds bias in a single statement on the output.
+// Multiplies the rows of A of every call in a coalesced batch at once, then
+// unquantizes and adds bias for each call's slice of the result.
+void multiplyCoalesced(const runtime::CoalescedBatch &batch) {
+  const Index width = batch.width;
+  const Index cols_B = batch.cols_B;
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+  runtime::Scratch<int8_t> A(batch.rows * width);
+  runtime::Scratch<std::int32_t> result(batch.rows * cols_B);
+
+  Index row = 0;
+  {
+    runtime::PhaseTimer timer(stats, Int8Phase::Gather,
+                              uint64_t{2} * batch.rows * width);
+    for (const runtime::CoalescedCall *call : batch.calls) {
+      std::memcpy(A.data() + row * width, call->A, call->rows * width);
+      row += call->rows;
+    }
+  }
+
+  const runtime::PinnedReplica replica(batch.B);
+  runtime::TileGrid grid = runtime::partition(
+      batch.rows, width, cols_B, /*row_grain=*/8, /*col_grain=*/8);
+  warmContexts(grid, grid.tile_rows, width, grid.tile_cols);
+  runtime::runTiles(grid, [&](Index row_begin, Index row_end, Index col_begin,
+                              Index col_end) {
+    const Index rows = row_end - row_begin;
+    const Index cols = col_end - col_begin;
+    runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                              runtime::multiplyBytes(rows, width, cols));
+    ruyMultiply(threadContext(), A.data() + row_begin * width,
+                replica.local() + col_begin * width, rows, width, cols,
+                result.data() + row_begin * cols_B + col_begin, cols_B);
+  });
+
+  row = 0;
+  for (const runtime::CoalescedCall *call : batch.calls) {
+    runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                              uint64_t{8} * call->rows * cols_B +
+                                  uint64_t{4} * cols_B);
+    detail::Preprocess<detail::kHighestPath>::unquantizeAddBias(
+        result.data() + row * cols_B, call->bias, call->unquant_multiplier,
+        call->rows, cols_B, call->output);
+    row += call->rows;
+  }
+}
+
+void int8MultiplyAndAddBias(const int8_t *input_A_prepared, float scale_A,
+                            float zero_point_A, const int8_t *input_B_prepared,
+                            float scale_B, float zero_point_B,
+                            const float *input_bias_prepared,
+                            float scale_output, Index rows_A, Index width,
+                            Index cols_B, float *output, bool accumulate) {
+
+  // It is expected that somehow we have managed to call all prepare by the time
+  // we are here, with inputs (prepared) in int8_t. All that's left to do is use
+  // ruy for multiply and then start with the reverse ops to get to fp32.
   float unquant_multiplier = (1.0f * scale_output) / (scale_A * scale_B);
+  runtime::CallScope call(Int8Operation::MultiplyAndAddBias, rows_A, width,
+                          cols_B);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  if (!accumulate &&
+      runtime::coalescer().coalesce(input_A_prepared, input_B_prepared,
+                                    input_bias_prepared, unquant_multiplier,
+                                    rows_A, width, cols_B, output,
+                                    multiplyCoalesced)) {
+    return;
+  }
+
+  // The int32 result is written in place into output, unless the existing
+  // contents of output are needed for the epilogue (accumulate).
+  runtime::Scratch<std::int32_t> accumulator(accumulate ? rows_A * cols_B : 0);
+  std::int32_t *dest_ptr = accumulate
+                               ? accumulator.data()
+                               : reinterpret_cast<std::int32_t *>(output);
+
+  // Unquantizes, adds bias (and adds onto output) in a single pass. Tiles
+  // narrower than output are not contiguous, they go a row at a time.
+  auto epilogue = [&](Index row_begin, Index rows, Index col_begin,
+                      Index cols) {
+    runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                              uint64_t{4} * rows * cols * (accumulate ? 3 : 2) +
+                                  uint64_t{4} * cols);
+    std::int32_t *tile = dest_ptr + row_begin * cols_B + col_begin;
+    const Index passes = cols == cols_B ? 1 : rows;
+    const Index pass_rows = cols == cols_B ? rows : 1;
+    for (Index pass = 0; pass < passes; ++pass) {
+      std::int32_t *input = tile + pass * cols_B;
+      float *tile_output = output + (row_begin + pass) * cols_B + col_begin;
+      if (accumulate) {
+        detail::Preprocess<detail::kHighestPath>::unquantizeAddBiasAccumulate(
+            input, input_bias_prepared + col_begin, unquant_multiplier,
+            pass_rows, cols, tile_output);
+      } else {
+        detail::Preprocess<detail::kHighestPath>::unquantizeAddBias(
+            input, input_bias_prepared + col_begin, unquant_multiplier,
+            pass_rows, cols, tile_output);
+      }
+    }
+  };
+
+  const runtime::PinnedReplica replica(input_B_prepared);
+  runtime::TileGrid grid =
+      runtime::partition(rows_A, width, cols_B, /*row_grain=*/8,
+                         /*col_grain=*/8, /*depth_grain=*/64);
+  warmContexts(grid, grid.tile_rows, grid.tile_depth, grid.tile_cols);
+  if (grid.depth_tiles == 1) {
+    runtime::runTiles(grid, [&](Index row_begin, Index row_end,
+                                Index col_begin, Index col_end) {
+      const Index rows = row_end - row_begin;
+      const Index cols = col_end - col_begin;
+      {
+        runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                  runtime::multiplyBytes(rows, width, cols));
+        ruyMultiply(threadContext(), input_A_prepared + row_begin * width,
+                    replica.local() + col_begin * width, rows, width, cols,
+                    dest_ptr + row_begin * cols_B + col_begin, cols_B);
+      }
+      epilogue(row_begin, rows, col_begin, cols);
+    });
+    return;
+  }
+
+  // The output is too small to keep every thread busy, so the shared
+  // dimension is split too. Each slice of it sums into its own buffer (the
+  // first into dest_ptr), and the int32 partial sums add up to exactly the
+  // unsplit result.
+  runtime::Scratch<std::int32_t> partials((grid.depth_tiles - 1) * rows_A *
+                                          cols_B);
+  runtime::runDepthTiles(grid, [&](Index row_begin, Index row_end,
+                                   Index col_begin, Index col_end,
+                                   Index depth_begin, Index depth_end,
+                                   Index slice) {
+    std::int32_t *sums =
+        slice == 0 ? dest_ptr : partials.data() + (slice - 1) * rows_A * cols_B;
+    runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                              runtime::multiplyBytes(row_end - row_begin,
+                                                     depth_end - depth_begin,
+                                                     col_end - col_begin));
+    ruyMultiply(threadContext(),
+                input_A_prepared + row_begin * width + depth_begin,
+                replica.local() + col_begin * width + depth_begin,
+                row_end - row_begin, depth_end - depth_begin,
+                col_end - col_begin, sums + row_begin * cols_B + col_begin,
+                cols_B, width);
+  });
+
+  // Small by construction, a few rows at most.
+  {
+    runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                              uint64_t{8} * grid.depth_tiles * rows_A * cols_B);
+    for (Index slice = 1; slice < grid.depth_tiles; ++slice) {
+      const std::int32_t *sums =
+          partials.data() + (slice - 1) * rows_A * cols_B;
+      for (Index i = 0; i < rows_A * cols_B; ++i) {
+        dest_ptr[i] += sums[i];
+      }
+    }
+  }
+  epilogue(0, rows_A, 0, cols_B);
+}
+
+void int8MultiplyAddBiasAndLayerNorm(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float scale_output,
+    const float *residual, const float *gamma, const float *beta,
+    float epsilon, Index rows_A, Index width, Index cols_B, float *output) {
+  float unquant_multiplier = (1.0f * scale_output) / (scale_A * scale_B);
+  runtime::CallScope call(Int8Operation::MultiplyAddBiasAndLayerNorm, rows_A,
+                          width, cols_B);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  // Tiles are bands of whole rows, which normalization needs. Each produces
+  // its rows a block at a time into its own part of a scratch buffer and
+  // normalizes the block while it is still in cache, so output is written
+  // once and the int32 result never makes a full pass through memory.
+  runtime::TileGrid grid = runtime::partition(
+      rows_A, width, cols_B, /*row_grain=*/8, /*col_grain=*/cols_B);
+  const Index block_rows = std::min<Index>(
+      grid.tile_rows,
+      std::max<Index>(1, kAccumulateBlockSize / (sizeof(std::int32_t) *
+                                                 cols_B)));
+  // The last band may be shorter than a block, so at most rows_A rows.
+  const Index last_rows = rows_A - (grid.row_tiles - 1) * grid.tile_rows;
+  runtime::Scratch<std::int32_t> blocks(
+      ((grid.row_tiles - 1) * block_rows + std::min(block_rows, last_rows)) *
+      cols_B);
+  warmContexts(grid, block_rows, width, cols_B);
+  const runtime::PinnedReplica replica(input_B_prepared);
+  runtime::runTiles(grid, [&](Index row_begin, Index row_end, Index, Index) {
+    std::int32_t *block =
+        blocks.data() + (row_begin / grid.tile_rows) * block_rows * cols_B;
+    const int8_t *B = replica.local();
+    for (Index row = row_begin; row < row_end; row += block_rows) {
+      const Index rows = std::min<Index>(block_rows, row_end - row);
+      {
+        runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                                  runtime::multiplyBytes(rows, width, cols_B));
+        ruyMultiply(threadContext(), input_A_prepared + row * width, B, rows,
+                    width, cols_B, block, cols_B);
+      }
+
+      const Index offset = row * cols_B;
+      runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                                uint64_t{4} * rows * cols_B *
+                                        (residual ? 3 : 2) +
+                                    uint64_t{12} * cols_B);
+      detail::Preprocess<detail::kHighestPath>::unquantizeAddBiasLayerNorm(
+          block, input_bias_prepared, unquant_multiplier,
+          residual ? residual + offset : nullptr, gamma, beta, epsilon, rows,
+          cols_B, output + offset);
+    }
+  });
+}
+
+void int8MultiplyAndAddBiasSelected(
+    const int8_t *input_A_prepared, float scale_A, float zero_point_A,
+    const int8_t *input_B_prepared, float scale_B, float zero_point_B,
+    const float *input_bias_prepared, float scale_output, Index rows_A,
+    Index width, Index cols_B, const Index *cols, Index num_cols,
+    float *output) {
+  float unquant_multiplier = (1.0f * scale_output) / (scale_A * scale_B);
+  runtime::CallScope call(Int8Operation::MultiplyAndAddBiasSelected, rows_A,
+                          width, num_cols);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+
+  // ruy packs from a matrix and has no hook to gather while packing. Instead
+  // of materializing all of the selected B, columns are gathered a block at a
+  // time into a buffer small enough to still be in cache when ruy packs it.
+  // Each block writes its int32 result in place into its columns of output.
+  const Index block_cols = selectBlockCols(width, num_cols);
+  runtime::Scratch<int8_t> B_block(width * block_cols);
+  std::int32_t *dest_ptr = reinterpret_cast<std::int32_t *>(output);
+
+  for (Index c = 0; c < num_cols; c += block_cols) {
+    const Index block = std::min<Index>(block_cols, num_cols - c);
+    int8SelectColumnsOfB(input_B_prepared, width, cols_B, cols + c, block,
+                         B_block.data());
+    runtime::PhaseTimer timer(stats, Int8Phase::Kernel,
+                              runtime::multiplyBytes(rows_A, width, block));
+    ruyMultiply(threadContext(), input_A_prepared, B_block.data(), rows_A,
+                width, block, dest_ptr + c, num_cols);
+  }
+
+  // Bias is only num_cols floats, gather it once for the epilogue.
+  runtime::Scratch<float> bias(num_cols);
+  {
+    runtime::PhaseTimer timer(stats, Int8Phase::Gather, uint64_t{8} * num_cols);
+    for (Index c = 0; c < num_cols; ++c) {
+      bias.data()[c] = input_bias_prepared[cols[c]];
+    }
+  }
+
+  runtime::PhaseTimer timer(stats, Int8Phase::Epilogue,
+                            uint64_t{8} * rows_A * num_cols +
+                                uint64_t{4} * num_cols);
   detail::Preprocess<detail::kHighestPath>::unquantizeAddBias(
-      dest_ptr, input_bias_prepared, unquant_multiplier, rows_A, cols_B,
-      output);
+      dest_ptr, bias.data(), unquant_multiplier, rows_A, num_cols, output);
 }
 
 void int8SelectColumnsOfB(const int8_t *input_B_prepared, Index width,
@@ -105,9 +492,18 @@ void int8SelectColumnsOfB(const int8_t *input_B_prepared, Index width,
                           int8_t *output) {
   // B_prepared is expected to be col-major, for our implementation via ruy. If
   // col-major we can memcpy the respective column entries as they're
-  // sequential. There are width=rows entries.
-  for (Index c = 0; c < num_cols; ++c) {
-    std::memcpy(&(output[c * width]), &(input_B_prepared[cols[c] * width]),
-                width);
-  }
+  // sequential. There are width=rows entries. Large selections are split
+  // across threads, the gather is memory bound.
+  runtime::CallScope call(Int8Operation::SelectColumnsOfB, 0, width, num_cols);
+  runtime::StatsEntry *stats = runtime::callStatsEntry();
+  size_t min_chunk = runtime::kParallelGatherMinBytes / width;
+  const runtime::PinnedReplica replica(input_B_prepared);
+  runtime::parallelFor(
+      num_cols, min_chunk, /*grain=*/1, [&](size_t begin, size_t end) {
+        runtime::PhaseTimer timer(stats, Int8Phase::Gather,
+                                  uint64_t{2} * width * (end - begin));
+        detail::Preprocess<detail::kHighestPath>::selectColumns(
+            replica.local(), width, cols + begin, end - begin,
+            output + begin * width);
+      });
 }
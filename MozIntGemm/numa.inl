@@ -0,0 +1,181 @@
+// Replication of prepared weights across NUMA nodes.
+//
+// Prepared B lives on whichever node first touched it, so threads on other
+// nodes read it at remote bandwidth. A registered B gets a copy bound to each
+// node, and multiplies against it read the copy local to the thread running
+// each tile. A multiply looks its copies up once and holds them until it
+// returns, so releasing them meanwhile only frees them after it; tiles just
+// ask which node they run on. Only implemented on Linux, through the raw
+// syscalls so that no libnuma is needed; elsewhere there is a single node and
+// nothing to do.
+
+namespace runtime {
+
+#ifdef __linux__
+
+// Node of the CPU the calling thread is running on. glibc's getcpu goes
+// through the vDSO where the kernel has it, without entering the kernel.
+inline unsigned currentNode() {
+  unsigned cpu = 0, node = 0;
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+  if (getcpu(&cpu, &node) != 0) {
+    return 0;
+  }
+#else
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return 0;
+  }
+#endif
+  return node;
+}
+
+inline std::vector<unsigned> onlineNodes() {
+  std::ifstream file("/sys/devices/system/node/online");
+  std::string list;
+  if (!std::getline(file, list)) {
+    return {0};
+  }
+  std::vector<unsigned> nodes = parseList(list);
+  return nodes.empty() ? std::vector<unsigned>{0} : nodes;
+}
+
+// Maps bytes with their pages bound to node, or returns nullptr.
+inline void *allocateOnNode(size_t bytes, unsigned node) {
+  constexpr int kMpolBind = 2;
+  unsigned long mask[16] = {};
+  constexpr unsigned kMaxNodes = sizeof(mask) * 8;
+  if (node >= kMaxNodes) {
+    return nullptr;
+  }
+  mask[node / (sizeof(unsigned long) * 8)] |=
+      1ul << (node % (sizeof(unsigned long) * 8));
+
+  void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return nullptr;
+  }
+  if (syscall(SYS_mbind, ptr, bytes, kMpolBind, mask, kMaxNodes + 1, 0) !=
+      0) {
+    munmap(ptr, bytes);
+    return nullptr;
+  }
+  return ptr;
+}
+
+inline void freeOnNode(void *ptr, size_t bytes) { munmap(ptr, bytes); }
+
+#else
+
+inline unsigned currentNode() { return 0; }
+inline std::vector<unsigned> onlineNodes() { return {0}; }
+inline void *allocateOnNode(size_t, unsigned) { return nullptr; }
+inline void freeOnNode(void *, size_t) {}
+
+#endif
+
+class ReplicaRegistry {
+public:
+  ReplicaRegistry() = default;
+  ReplicaRegistry(const ReplicaRegistry &) = delete;
+  ReplicaRegistry &operator=(const ReplicaRegistry &) = delete;
+
+  // The copies of a B, freed once released and no multiply holds them.
+  struct Replicas {
+    Replicas() = default;
+    Replicas(const Replicas &) = delete;
+    Replicas &operator=(const Replicas &) = delete;
+
+    ~Replicas() {
+      for (int8_t *replica : by_node) {
+        if (replica) {
+          freeOnNode(replica, bytes);
+        }
+      }
+    }
+
+    size_t bytes = 0;
+    // Indexed by node, nullptr for nodes that are not online.
+    std::vector<int8_t *> by_node;
+  };
+
+  // Copies B to every node, returning whether there is more than one node
+  // and every copy could be made.
+  bool replicate(const int8_t *B, size_t bytes) {
+    std::vector<unsigned> nodes = onlineNodes();
+    if (nodes.size() <= 1) {
+      return false;
+    }
+
+    auto replicas = std::make_shared<Replicas>();
+    replicas->bytes = bytes;
+    unsigned max_node = *std::max_element(nodes.begin(), nodes.end());
+    replicas->by_node.resize(max_node + 1);
+    for (unsigned node : nodes) {
+      void *replica = allocateOnNode(bytes, node);
+      if (!replica) {
+        return false;
+      }
+      std::memcpy(replica, B, bytes);
+      replicas->by_node[node] = static_cast<int8_t *>(replica);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    replicas_[B] = std::move(replicas);
+    size_.store(replicas_.size(), std::memory_order_relaxed);
+    return true;
+  }
+
+  void release(const int8_t *B) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    replicas_.erase(B);
+    size_.store(replicas_.size(), std::memory_order_relaxed);
+  }
+
+  // The copies of B, nullptr if it has none.
+  std::shared_ptr<const Replicas> find(const int8_t *B) {
+    if (size_.load(std::memory_order_relaxed) == 0) {
+      return nullptr;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto found = replicas_.find(B);
+    return found == replicas_.end() ? nullptr : found->second;
+  }
+
+private:
+  std::atomic<size_t> size_{0};
+  std::shared_mutex mutex_;
+  std::unordered_map<const int8_t *, std::shared_ptr<const Replicas>>
+      replicas_;
+};
+
+inline ReplicaRegistry &replicaRegistry() {
+  static ReplicaRegistry registry;
+  return registry;
+}
+
+// The copies of B held for the length of a multiply, looked up once by its
+// calling thread for the tiles to use.
+class PinnedReplica {
+public:
+  explicit PinnedReplica(const int8_t *B)
+      : B_(B), replicas_(replicaRegistry().find(B)) {}
+
+  // The copy of B local to the calling thread, B itself if it has none.
+  const int8_t *local() const {
+    if (!replicas_) {
+      return B_;
+    }
+    unsigned node = currentNode();
+    const std::vector<int8_t *> &by_node = replicas_->by_node;
+    return node < by_node.size() && by_node[node] ? by_node[node] : B_;
+  }
+
+private:
+  const int8_t *B_;
+  std::shared_ptr<const ReplicaRegistry::Replicas> replicas_;
+};
+
+} // namespace runtime
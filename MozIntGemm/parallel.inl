@@ -0,0 +1,29 @@
+// Splitting of bandwidth-bound work across threads.
+
+namespace runtime {
+
+// Below this many bytes per chunk, handing a column gather to another core
+// costs more than the bandwidth it adds.
+constexpr size_t kParallelGatherMinBytes = 2 * 1024 * 1024;
+
+// Runs fn(begin, end) over chunks covering [0, n) on the scheduler, in
+// parallel when there is enough work for more than one chunk of at least
+// min_chunk items. Chunk boundaries are multiples of grain.
+template <class Fn>
+void parallelFor(size_t n, size_t min_chunk, size_t grain, const Fn &fn) {
+  size_t chunks = n / std::max<size_t>(min_chunk, 1);
+  if (chunks <= 1) {
+    fn(size_t{0}, n);
+    return;
+  }
+
+  std::shared_ptr<Scheduler> pool = scheduler();
+  chunks = std::min(chunks, pool->concurrency());
+  size_t chunk = (n + chunks - 1) / chunks;
+  chunk = (chunk + grain - 1) / grain * grain;
+  pool->run((n + chunk - 1) / chunk, [&](size_t i) {
+    fn(i * chunk, std::min((i + 1) * chunk, n));
+  });
+}
+
+} // namespace runtime
@@ -0,0 +1,159 @@
+// Splitting of a multiply's output into tiles for the scheduler.
+
+namespace runtime {
+
+// Multiply-accumulates per tile below which scheduling costs more than
+// another core saves. Small multiplies (decoder steps) stay a single tile and
+// never leave the calling thread.
+constexpr size_t kTileMacs = 1 << 21;
+
+// Upper bound on tiles per interactive multiply, plenty to balance any core
+// count we run on. Bulk multiplies keep tiles of about kTileMacs however large
+// they are, which bounds how long a worker busy with bulk work takes to get
+// to newly submitted interactive tiles.
+constexpr size_t kMaxTiles = 256;
+constexpr size_t kMaxBulkTiles = 64 * 1024;
+
+// Multiply-accumulates per byte moved below which a multiply is bound by
+// memory bandwidth rather than arithmetic. Every byte of B is used once per
+// row of A, so this is about the number of rows: decoder steps (a handful of
+// rows against a large B) are memory bound however many MACs they have.
+constexpr size_t kComputeBoundIntensity = 16;
+
+// Bytes a tile of a memory bound multiply streams at the least. Below that, a
+// thread takes longer to pick the tile up than to read it.
+constexpr size_t kTileBytes = 64 * 1024;
+
+// Narrowest and shallowest tiles worth handing to the kernels, which pack B
+// and run their inner loops over blocks of about this size. Outputs too
+// narrow to give every thread columns of at least kMinTileCols are split
+// along the shared dimension instead.
+constexpr Index kMinTileCols = 64;
+constexpr Index kMinTileDepth = 256;
+
+// A rows x cols output with a shared dimension of depth, cut into row_tiles x
+// col_tiles x depth_tiles tiles of tile_rows x tile_cols x tile_depth
+// (smaller at the edges). Tiles that only differ in depth produce partial
+// sums of the same outputs, which the caller adds up. pool is the scheduler
+// partition sized the grid for, which runs its tiles; none for a single tile.
+struct TileGrid {
+  Index rows;
+  Index cols;
+  Index depth;
+  Index tile_rows;
+  Index tile_cols;
+  Index tile_depth;
+  Index row_tiles;
+  Index col_tiles;
+  Index depth_tiles;
+  std::shared_ptr<Scheduler> pool;
+
+  size_t size() const {
+    return static_cast<size_t>(row_tiles) * col_tiles * depth_tiles;
+  }
+};
+
+inline Index ceilDiv(Index a, Index b) { return (a + b - 1) / b; }
+
+// Number of tiles to cut a multiply into. Compute bound multiplies get tiles
+// of about kTileMacs, as many as balance the load. Memory bound ones are done
+// once the pool streams B at full bandwidth: they get a tile per thread of
+// its concurrency, as long as each has kTileBytes to read, as more threads
+// would only contend for the same bandwidth.
+inline size_t tileCount(Index rows, Index width, Index cols,
+                        size_t concurrency) {
+  size_t macs = static_cast<size_t>(rows) * width * cols;
+  size_t bytes = static_cast<size_t>(width) * cols +
+                 static_cast<size_t>(rows) * width +
+                 sizeof(int32_t) * rows * cols;
+  if (macs >= kComputeBoundIntensity * bytes) {
+    size_t max_tiles =
+        threadPriority() == Int8Priority::Bulk ? kMaxBulkTiles : kMaxTiles;
+    return std::min(max_tiles, std::max<size_t>(1, macs / kTileMacs));
+  }
+  if (bytes < 2 * kTileBytes) {
+    return 1;
+  }
+  return std::min(concurrency, bytes / kTileBytes);
+}
+
+// Splits rows x cols (with a shared dimension of width) into tileCount
+// tiles. Rows are split first, they need no extra reads of B; then columns,
+// for wide outputs such as vocabulary projections; and only then the shared
+// dimension, which costs a reduction. Tile edges are multiples of the grains,
+// pass col_grain = cols to never split columns and depth_grain = width (the
+// default) to never split the shared dimension. The scheduler is looked up
+// once here, for both the tile count and running the tiles.
+inline TileGrid partition(Index rows, Index width, Index cols,
+                          Index row_grain, Index col_grain,
+                          Index depth_grain = 0) {
+  if (depth_grain == 0) {
+    depth_grain = width;
+  }
+  std::shared_ptr<Scheduler> pool = scheduler();
+  Index tiles =
+      static_cast<Index>(tileCount(rows, width, cols, pool->concurrency()));
+  if (tiles == 1) {
+    return TileGrid{rows, cols, width, rows, cols, width, 1, 1, 1, nullptr};
+  }
+
+  Index row_tiles = std::min(tiles, ceilDiv(rows, row_grain));
+  Index min_cols = ceilDiv(std::max(col_grain, kMinTileCols), col_grain) *
+                   col_grain;
+  Index col_tiles = std::min(ceilDiv(tiles, row_tiles),
+                             std::max<Index>(1, cols / min_cols));
+  Index min_depth = ceilDiv(std::max(depth_grain, kMinTileDepth),
+                            depth_grain) *
+                    depth_grain;
+  Index depth_tiles = std::min(ceilDiv(tiles, row_tiles * col_tiles),
+                               std::max<Index>(1, width / min_depth));
+
+  TileGrid grid;
+  grid.rows = rows;
+  grid.cols = cols;
+  grid.depth = width;
+  grid.tile_rows = ceilDiv(ceilDiv(rows, row_tiles), row_grain) * row_grain;
+  grid.tile_cols = ceilDiv(ceilDiv(cols, col_tiles), col_grain) * col_grain;
+  grid.tile_depth =
+      ceilDiv(ceilDiv(width, depth_tiles), depth_grain) * depth_grain;
+  grid.row_tiles = ceilDiv(rows, grid.tile_rows);
+  grid.col_tiles = ceilDiv(cols, grid.tile_cols);
+  grid.depth_tiles = ceilDiv(width, grid.tile_depth);
+  grid.pool = grid.size() == 1 ? nullptr : std::move(pool);
+  return grid;
+}
+
+// Runs fn(row_begin, row_end, col_begin, col_end, depth_begin, depth_end,
+// slice) for every tile of grid on its pool, or directly when there is a
+// single tile. slice is the index of the tile's depth range, so that tiles of
+// different slices can sum into separate buffers.
+template <class Fn> void runDepthTiles(const TileGrid &grid, const Fn &fn) {
+  if (grid.size() == 1) {
+    fn(Index{0}, grid.rows, Index{0}, grid.cols, Index{0}, grid.depth,
+       Index{0});
+    return;
+  }
+
+  grid.pool->run(grid.size(), [&grid, &fn](size_t tile) {
+    Index slice = static_cast<Index>(tile % grid.depth_tiles);
+    tile /= grid.depth_tiles;
+    Index row = static_cast<Index>(tile / grid.col_tiles) * grid.tile_rows;
+    Index col = static_cast<Index>(tile % grid.col_tiles) * grid.tile_cols;
+    Index depth = slice * grid.tile_depth;
+    fn(row, std::min(row + grid.tile_rows, grid.rows), col,
+       std::min(col + grid.tile_cols, grid.cols), depth,
+       std::min(depth + grid.tile_depth, grid.depth), slice);
+  });
+}
+
+// Runs fn(row_begin, row_end, col_begin, col_end) for every tile of a grid
+// that does not split the shared dimension (partitioned with the default
+// depth_grain).
+template <class Fn> void runTiles(const TileGrid &grid, const Fn &fn) {
+  runDepthTiles(grid, [&fn](Index row_begin, Index row_end, Index col_begin,
+                            Index col_end, Index, Index, Index) {
+    fn(row_begin, row_end, col_begin, col_end);
+  });
+}
+
+} // namespace runtime
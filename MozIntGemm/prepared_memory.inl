@@ -0,0 +1,179 @@
+// Memory for prepared weights.
+//
+// Prepared B of a whole model is tens of MB, read in a strided way across
+// layers for every token, and with 4 KB pages the walk through it misses the
+// TLB. Buffers from int8AllocatePrepared can be backed by 2 MB pages, reserved
+// from the hugetlbfs pool or transparent ones, and locked so that they are
+// never paged out. Each option falls back to what the system grants and the
+// caller is told which took effect. Only implemented on Linux; elsewhere
+// buffers are plain aligned allocations.
+
+namespace runtime {
+
+constexpr size_t kHugePageSize = 2 << 20;
+
+#ifdef __linux__
+
+#ifdef MAP_HUGETLB
+// Asks the hugetlbfs pool for pages of kHugePageSize rather than of its
+// default size, which may be 1 GB, or 512 MB on arm64 with 64 KB pages, so
+// that lengths rounded to kHugePageSize are whole pages. Without a pool of
+// that size the mapping fails and falls back to transparent pages.
+#ifdef MAP_HUGE_SHIFT
+constexpr int kReservedHugePageFlags = MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+#else
+constexpr int kReservedHugePageFlags = MAP_HUGETLB;
+#endif
+#endif
+
+// Whether transparent huge pages may be used for madvise'd memory.
+inline bool transparentHugePagesAvailable() {
+  std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string modes;
+  std::getline(file, modes);
+  return !modes.empty() && modes.find("[never]") == std::string::npos;
+}
+
+// Applies the transparent huge page and lock options to the pages of
+// [ptr, ptr + bytes), returning those that took effect.
+inline uint32_t advisePages(void *ptr, size_t bytes, uint32_t options) {
+  uint32_t applied = 0;
+#ifdef MADV_HUGEPAGE
+  if (options & (Int8HugePages | Int8ReservedHugePages)) {
+    // madvise wants whole pages, leave out partial ones at either end.
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = begin + bytes;
+    begin = (begin + page - 1) / page * page;
+    end = end / page * page;
+    if (begin < end && transparentHugePagesAvailable() &&
+        madvise(reinterpret_cast<void *>(begin), end - begin,
+                MADV_HUGEPAGE) == 0) {
+      applied |= Int8HugePages;
+    }
+  }
+#endif
+  if ((options & Int8LockedPages) && mlock(ptr, bytes) == 0) {
+    applied |= Int8LockedPages;
+  }
+  return applied;
+}
+
+// Maps length bytes starting on a huge page boundary, so that all of it can
+// be backed by huge pages, or returns nullptr.
+inline void *mapHugeAligned(size_t length) {
+  size_t padded = length + kHugePageSize;
+  void *mapping = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+  char *begin = static_cast<char *>(mapping);
+  char *aligned = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(begin) + kHugePageSize - 1) /
+      kHugePageSize * kHugePageSize);
+  if (aligned != begin) {
+    munmap(begin, aligned - begin);
+  }
+  size_t tail = (begin + padded) - (aligned + length);
+  if (tail != 0) {
+    munmap(aligned + length, tail);
+  }
+  return aligned;
+}
+
+#else
+
+inline uint32_t advisePages(void *, size_t, uint32_t) { return 0; }
+
+#endif
+
+class PreparedAllocations {
+public:
+  void *allocate(size_t bytes, uint32_t options, uint32_t *applied_options) {
+    uint32_t applied = 0;
+    Allocation allocation{bytes, false};
+    void *ptr = nullptr;
+
+#ifdef __linux__
+    allocation.mapped = true;
+    if (options & (Int8HugePages | Int8ReservedHugePages)) {
+      allocation.length =
+          (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+#ifdef MAP_HUGETLB
+    if (options & Int8ReservedHugePages) {
+      ptr = mmap(nullptr, allocation.length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | kReservedHugePageFlags, -1, 0);
+      if (ptr == MAP_FAILED) {
+        ptr = nullptr;
+      } else {
+        applied |= Int8ReservedHugePages;
+      }
+    }
+#endif
+    if (!ptr && (options & (Int8HugePages | Int8ReservedHugePages))) {
+      ptr = mapHugeAligned(allocation.length);
+    } else if (!ptr) {
+      ptr = mmap(nullptr, allocation.length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      ptr = ptr == MAP_FAILED ? nullptr : ptr;
+    }
+    if (ptr) {
+      applied |= advisePages(
+          ptr, allocation.length,
+          applied & Int8ReservedHugePages ? options & Int8LockedPages
+                                          : options);
+    }
+#else
+    ptr = alignedAlloc(bytes);
+#endif
+
+    if (applied_options) {
+      *applied_options = applied;
+    }
+    if (!ptr) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    allocations_.emplace(ptr, allocation);
+    return ptr;
+  }
+
+  void free(void *ptr) {
+    Allocation allocation;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = allocations_.find(ptr);
+      if (found == allocations_.end()) {
+        return;
+      }
+      allocation = found->second;
+      allocations_.erase(found);
+    }
+#ifdef __linux__
+    if (allocation.mapped) {
+      // Unmapping also unlocks.
+      munmap(ptr, allocation.length);
+      return;
+    }
+#endif
+    alignedFree(ptr);
+  }
+
+private:
+  struct Allocation {
+    size_t length;
+    bool mapped;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<void *, Allocation> allocations_;
+};
+
+inline PreparedAllocations &preparedAllocations() {
+  static PreparedAllocations allocations;
+  return allocations;
+}
+
+} // namespace runtime
@@ -0,0 +1,57 @@
+// Backend independent machinery shared by the ruy and intgemm
+// implementations. Like detail.inl, this is included into a namespace by the
+// wrappers in extras/, so it must not include headers itself and everything
+// here must be safe to include from multiple translation units.
+
+namespace runtime {
+
+// Alignment of buffers allocated by the library, sufficient for any SIMD width
+// we target.
+constexpr size_t kAlignment = 64;
+
+inline void *alignedAlloc(size_t size) {
+#ifdef _WIN32
+  return _aligned_malloc(size, kAlignment);
+#else
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, kAlignment, size) != 0) {
+    return nullptr;
+  }
+  return ptr;
+#endif
+}
+
+inline void alignedFree(void *ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+inline size_t roundUpToAlignment(size_t size) {
+  return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Same as boost::hash_combine.
+inline void hashCombine(size_t &seed, size_t value) {
+  seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+} // namespace runtime
+
+#include "buffer_pool.inl"
+#include "workspace.inl"
+#include "topology.inl"
+#include "scheduler.inl"
+#include "partition.inl"
+#include "parallel.inl"
+#include "numa.inl"
+#include "prepared_memory.inl"
+#include "coalescer.inl"
+#include "async.inl"
+#include "selection_cache.inl"
+#include "event_log.inl"
+#include "stats.inl"
+#include "shape_trace.inl"
+#include "trace.inl"
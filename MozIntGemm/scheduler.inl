@@ -0,0 +1,638 @@
+// Work-stealing executor running the tiles of every multiply in flight.
+//
+// Each worker owns a deque of tiles. A submitted multiply is spread over the
+// deques in contiguous ranges; workers take tiles from the back of their own
+// deque and, once it runs dry, steal from the front of the others. Idle cores
+// therefore pick up tiles of a large multiply whichever thread submitted it,
+// and concurrent callers share one pool instead of each bringing their own.
+//
+// Every deque is split by priority class. Workers take any interactive tile
+// before a bulk one, and as tiles are short a worker is at most one tile away
+// from picking up newly submitted interactive work. A waiting caller only
+// helps with the tiles of its own multiply, so it never picks up another
+// caller's longer tiles and finishes later than its own work allows.
+//
+// Idle workers spin for a while before parking, as long as multiplies have
+// lately been arriving closer together than a worker takes to wake up, so
+// bursts of decoder steps find them awake while idle stretches cost no CPU.
+// Sessions keep them spinning regardless, for callers that know a burst is
+// coming.
+//
+// When the host application supplies its own thread pool (Int8Executor), the
+// scheduler has no workers and hands tiles to the host's pool instead.
+//
+// Tasks can also be addressed to a particular worker (broadcast), for state
+// every worker keeps for itself to be set up before it runs the tiles that
+// need it, whichever those turn out to be.
+
+namespace runtime {
+
+constexpr size_t kPriorities = 2;
+
+// Longest an idle worker spins before parking outside of a session, a few
+// times what waking a parked thread costs. Gaps between multiplies longer
+// than this count as idle time.
+constexpr std::chrono::nanoseconds kMaxSpin = std::chrono::microseconds(200);
+
+inline int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Tracks the gaps between submitted multiplies to decide how long idle
+// threads spin. Updates race benignly between concurrent submitters.
+class SpinPolicy {
+public:
+  void recordSubmit(int64_t now_ns) {
+    int64_t last = last_submit_ns_.exchange(now_ns, std::memory_order_relaxed);
+    if (last == 0) {
+      return;
+    }
+    // A single idle stretch must not keep workers parked through the burst
+    // that follows, so long gaps all count as barely too long to spin.
+    int64_t gap = std::min<int64_t>(now_ns - last, 2 * kMaxSpin.count());
+    int64_t average = average_gap_ns_.load(std::memory_order_relaxed);
+    average_gap_ns_.store(average + (gap - average) / 4,
+                          std::memory_order_relaxed);
+  }
+
+  // How long to spin for the next multiply: twice the typical gap if that
+  // is short enough to be worth it, nothing otherwise.
+  std::chrono::nanoseconds budget() const {
+    std::chrono::nanoseconds average(
+        average_gap_ns_.load(std::memory_order_relaxed));
+    return average < kMaxSpin / 2 ? 2 * average
+                                  : std::chrono::nanoseconds(0);
+  }
+
+  bool inSession() const {
+    return sessions_.load(std::memory_order_relaxed) != 0;
+  }
+
+  void beginSession() { sessions_.fetch_add(1, std::memory_order_relaxed); }
+  // An end without a matching begin is ignored rather than leaving a session
+  // open for good.
+  void endSession() {
+    size_t sessions = sessions_.load(std::memory_order_relaxed);
+    while (sessions != 0 &&
+           !sessions_.compare_exchange_weak(sessions, sessions - 1,
+                                            std::memory_order_relaxed)) {
+    }
+  }
+
+private:
+  std::atomic<int64_t> last_submit_ns_{0};
+  std::atomic<int64_t> average_gap_ns_{2 * kMaxSpin.count()};
+  std::atomic<size_t> sessions_{0};
+};
+
+inline SpinPolicy &spinPolicy() {
+  static SpinPolicy policy;
+  return policy;
+}
+
+// Calls done() until it returns true or the spin budget runs out (never in a
+// session, unless stop() does), returning whether done() did.
+template <class Done, class Stop>
+bool spinUntil(const Done &done, const Stop &stop) {
+  const SpinPolicy &policy = spinPolicy();
+  const int64_t deadline = nowNs() + policy.budget().count();
+  while (!done()) {
+    if (stop() || (!policy.inSession() && nowNs() >= deadline)) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// Priority class of the multiplies submitted by the calling thread.
+inline Int8Priority &threadPriority() {
+  static thread_local Int8Priority priority = Int8Priority::Interactive;
+  return priority;
+}
+
+class Scheduler;
+
+// A multiply split into independent tiles. It lives on the stack of the
+// submitting thread, which does not return before remaining drops to zero.
+struct Job {
+  Job(void (*run)(const void *, size_t), const void *closure, size_t tiles,
+      Int8Priority priority)
+      : run(run), closure(closure), remaining(tiles), priority(priority) {}
+
+  void (*run)(const void *closure, size_t tile);
+  const void *closure;
+  std::atomic<size_t> remaining;
+  Int8Priority priority;
+  // Deque holding the first tiles, where the submitter starts helping.
+  size_t first = 0;
+  // Set for jobs posted to a host executor.
+  Scheduler *scheduler = nullptr;
+};
+
+struct Task {
+  Job *job;
+  size_t tile;
+};
+
+// Ring buffer of tasks guarded by a mutex. It only grows, so once it has
+// held the largest backlog it will see, pushing tasks no longer allocates.
+class TaskDeque {
+public:
+  TaskDeque() : tasks_(kInitialCapacity) {}
+
+  // Pushes the tiles [begin, end) of job, to be popped in increasing order.
+  void push(Job *job, size_t begin, size_t end) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ + (end - begin) > tasks_.size()) {
+      grow(size_ + (end - begin));
+    }
+    for (size_t tile = end; tile-- > begin;) {
+      tasks_[(head_ + size_++) & (tasks_.size() - 1)] = Task{job, tile};
+    }
+  }
+
+  // Takes the most recently pushed task, used by the owner.
+  bool pop(Task &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ == 0) {
+      return false;
+    }
+    task = tasks_[(head_ + --size_) & (tasks_.size() - 1)];
+    return true;
+  }
+
+  // Takes the oldest task, used by everyone else.
+  bool steal(Task &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_ == 0) {
+      return false;
+    }
+    task = tasks_[head_];
+    head_ = (head_ + 1) & (tasks_.size() - 1);
+    --size_;
+    return true;
+  }
+
+  // Takes the most recently pushed task of job, used by its submitter. The
+  // submitter waits right after pushing, so its tasks are usually the last
+  // ones and the search is short.
+  bool take(const Job *job, Task &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = size_; i-- > 0;) {
+      if (at(i).job == job) {
+        task = at(i);
+        for (size_t j = i + 1; j < size_; ++j) {
+          at(j - 1) = at(j);
+        }
+        --size_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static constexpr size_t kInitialCapacity = 256;
+
+  Task &at(size_t i) { return tasks_[(head_ + i) & (tasks_.size() - 1)]; }
+
+  void grow(size_t needed) {
+    size_t capacity = tasks_.size();
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    std::vector<Task> tasks(capacity);
+    for (size_t i = 0; i < size_; ++i) {
+      tasks[i] = tasks_[(head_ + i) & (tasks_.size() - 1)];
+    }
+    tasks_.swap(tasks);
+    head_ = 0;
+  }
+
+  std::mutex mutex_;
+  std::vector<Task> tasks_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+class Scheduler {
+public:
+  // Uses threads - 1 workers, the submitting thread makes up the last one.
+  // Worker i is pinned to cpus[i % cpus.size()] unless cpus is empty.
+  explicit Scheduler(size_t threads, std::vector<unsigned> cpus = {})
+      : cpus_(std::move(cpus)) {
+    for (size_t i = 1; i < threads; ++i) {
+      queues_.emplace_back(new WorkerQueues());
+    }
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      workers_.emplace_back(&Scheduler::work, this, i);
+    }
+  }
+
+  // Runs everything on the host's executor rather than on workers.
+  explicit Scheduler(const Int8Executor &executor)
+      : executor_(executor), has_executor_(true) {}
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_.store(true, std::memory_order_relaxed);
+    }
+    wake_.notify_all();
+    for (std::thread &worker : workers_) {
+      worker.join();
+    }
+    // A posted job's submitter may return, and drop the scheduler, while the
+    // executor's thread is still signalling that the job is done.
+    while (posted_.load(std::memory_order_acquire) != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  size_t concurrency() const {
+    if (has_executor_) {
+      return std::max<size_t>(1, executor_.concurrency);
+    }
+    return workers_.size() + 1;
+  }
+
+  // Runs fn(tile) for every tile in [0, tiles) at the calling thread's
+  // priority, returning once all have run. The calling thread runs tiles too
+  // while it waits.
+  template <class Fn> void run(size_t tiles, const Fn &fn) {
+    if (tiles > 1 && has_executor_) {
+      executor_.parallel_for(
+          executor_.user_data, tiles,
+          [](void *closure, size_t tile) {
+            (*static_cast<const Fn *>(closure))(tile);
+          },
+          const_cast<Fn *>(&fn), threadPriority());
+      return;
+    }
+    if (tiles <= 1 || workers_.empty()) {
+      for (size_t tile = 0; tile < tiles; ++tile) {
+        fn(tile);
+      }
+      return;
+    }
+
+    Job job(
+        [](const void *closure, size_t tile) {
+          (*static_cast<const Fn *>(closure))(tile);
+        },
+        &fn, tiles, threadPriority());
+    submit(job, tiles);
+    wait(job);
+  }
+
+  // Runs fn() once on every worker, returning once all have. Called from a
+  // worker, that worker runs fn() too. Without workers (or with a host
+  // executor, whose threads the scheduler does not know) it does nothing.
+  template <class Fn> void broadcast(const Fn &fn) {
+    if (workers_.empty()) {
+      return;
+    }
+    const size_t queues = queues_.size();
+    Job job(
+        [](const void *closure, size_t) {
+          (*static_cast<const Fn *>(closure))();
+        },
+        &fn, queues, threadPriority());
+    addressed_.fetch_add(queues, std::memory_order_release);
+    for (size_t q = 0; q < queues; ++q) {
+      queues_[q]->addressed.push(&job, q, q + 1);
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_all();
+
+    // A worker has to keep running the tasks addressed to it, its own among
+    // them, as other workers may be broadcasting at the same time.
+    const CurrentWorker &current = currentWorker();
+    if (current.scheduler != this) {
+      wait(job);
+      return;
+    }
+    Task task;
+    while (job.remaining.load(std::memory_order_acquire) != 0) {
+      if (popAddressed(current.index, task)) {
+        execute(task);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Queues job as a single task without waiting for it, job must stay alive
+  // until it has run. Without workers (or a host executor that can post) it
+  // runs before spawn returns.
+  void spawn(Job &job) {
+    if (has_executor_ && executor_.post) {
+      job.scheduler = this;
+      executor_.post(executor_.user_data, &Scheduler::runPosted, &job,
+                     job.priority);
+      return;
+    }
+    if (workers_.empty()) {
+      execute(Task{&job, 0});
+      return;
+    }
+    submit(job, 1);
+  }
+
+  // Waits for every task of job, running the ones no worker has taken yet.
+  void wait(Job &job) {
+    Task task;
+    while (job.remaining.load(std::memory_order_acquire) != 0 &&
+           take(job, task)) {
+      execute(task);
+    }
+
+    // Whatever is left of job is running on workers.
+    auto finished = [&job] {
+      return job.remaining.load(std::memory_order_acquire) == 0;
+    };
+    if (spinUntil(finished, [] { return false; })) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_.wait(lock, [&job] {
+      return job.remaining.load(std::memory_order_acquire) == 0;
+    });
+  }
+
+private:
+  struct WorkerQueues {
+    TaskDeque tasks[kPriorities];
+    // Tasks for this worker only, never stolen.
+    TaskDeque addressed;
+  };
+
+  // The scheduler and index of the worker running on this thread, if any.
+  struct CurrentWorker {
+    const Scheduler *scheduler = nullptr;
+    size_t index = 0;
+  };
+
+  static CurrentWorker &currentWorker() {
+    static thread_local CurrentWorker current;
+    return current;
+  }
+
+  // Spreads the tiles of job over the deques.
+  void submit(Job &job, size_t tiles) {
+    const size_t queues = queues_.size();
+    const size_t priority = static_cast<size_t>(job.priority);
+    const size_t first =
+        next_queue_.fetch_add(1, std::memory_order_relaxed) % queues;
+    job.first = first;
+
+    spinPolicy().recordSubmit(nowNs());
+
+    // Counted before the tasks are visible so that taking one never drives
+    // pending_ below zero.
+    pending_[priority].fetch_add(tiles, std::memory_order_release);
+
+    // Neighbouring tiles share rows of A or columns of B, keep them together.
+    for (size_t q = 0; q < queues; ++q) {
+      size_t begin = tiles * q / queues;
+      size_t end = tiles * (q + 1) / queues;
+      if (begin != end) {
+        queues_[(first + q) % queues]->tasks[priority].push(&job, begin, end);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_all();
+  }
+
+  void work(size_t index) {
+    if (!cpus_.empty()) {
+      pinCurrentThread(cpus_[index % cpus_.size()]);
+    }
+    currentWorker() = CurrentWorker{this, index};
+    Task task;
+    for (;;) {
+      bool found = popAddressed(index, task);
+      for (size_t priority = 0; priority < kPriorities && !found; ++priority) {
+        found = pop(index, priority, task) || steal(index + 1, priority, task);
+      }
+      if (found) {
+        execute(task);
+        continue;
+      }
+
+      auto stopping = [this] { return stop_.load(std::memory_order_relaxed); };
+      if (spinUntil([this] { return anyPending(); }, stopping)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [&] { return stopping() || anyPending(); });
+      if (stopping() && !anyPending()) {
+        return;
+      }
+    }
+  }
+
+  bool anyPending() const {
+    for (const std::atomic<size_t> &pending : pending_) {
+      if (pending.load(std::memory_order_acquire) != 0) {
+        return true;
+      }
+    }
+    return addressed_.load(std::memory_order_acquire) != 0;
+  }
+
+  bool popAddressed(size_t index, Task &task) {
+    if (addressed_.load(std::memory_order_acquire) == 0 ||
+        !queues_[index]->addressed.pop(task)) {
+      return false;
+    }
+    addressed_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool pop(size_t index, size_t priority, Task &task) {
+    if (pending_[priority].load(std::memory_order_acquire) == 0 ||
+        !queues_[index]->tasks[priority].pop(task)) {
+      return false;
+    }
+    pending_[priority].fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Steals a task of the given priority from the deques in turn, starting at
+  // start.
+  bool steal(size_t start, size_t priority, Task &task) {
+    const size_t queues = queues_.size();
+    for (size_t i = 0;
+         i < queues && pending_[priority].load(std::memory_order_acquire) != 0;
+         ++i) {
+      if (queues_[(start + i) % queues]->tasks[priority].steal(task)) {
+        pending_[priority].fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Takes a task of job from the deques in turn, starting where its tiles
+  // start.
+  bool take(const Job &job, Task &task) {
+    const size_t queues = queues_.size();
+    const size_t priority = static_cast<size_t>(job.priority);
+    for (size_t i = 0;
+         i < queues && pending_[priority].load(std::memory_order_acquire) != 0;
+         ++i) {
+      if (queues_[(job.first + i) % queues]->tasks[priority].take(&job,
+                                                                  task)) {
+        pending_[priority].fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Counted in posted_ until the scheduler is no longer touched, for the
+  // destructor to wait for.
+  static void runPosted(void *job) {
+    Job *posted = static_cast<Job *>(job);
+    Scheduler *scheduler = posted->scheduler;
+    scheduler->posted_.fetch_add(1, std::memory_order_relaxed);
+    scheduler->execute(Task{posted, 0});
+    scheduler->posted_.fetch_sub(1, std::memory_order_release);
+  }
+
+  void execute(const Task &task) {
+    Job *job = task.job;
+    // Anything the task submits itself (an asynchronous multiply's tiles)
+    // inherits its priority.
+    Int8Priority priority = threadPriority();
+    threadPriority() = job->priority;
+    job->run(job->closure, task.tile);
+    threadPriority() = priority;
+    // The submitter may return as soon as remaining hits zero, job must not
+    // be touched afterwards.
+    if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(done_mutex_);
+      done_.notify_all();
+    }
+  }
+
+  std::vector<unsigned> cpus_;
+  std::vector<std::unique_ptr<WorkerQueues>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_queue_{0};
+  std::atomic<size_t> pending_[kPriorities] = {};
+  // Tasks in the addressed deques.
+  std::atomic<size_t> addressed_{0};
+  // Posted jobs the host executor is running.
+  std::atomic<size_t> posted_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> stop_{false};
+
+  std::mutex done_mutex_;
+  std::condition_variable done_;
+
+  Int8Executor executor_ = {};
+  bool has_executor_ = false;
+};
+
+struct SchedulerConfig {
+  // Held to start or replace the scheduler and to change the settings below.
+  std::mutex mutex;
+  // Read and written with std::atomic_load and std::atomic_store, so that
+  // callers only take the mutex while there is no scheduler.
+  std::shared_ptr<Scheduler> scheduler;
+  size_t threads = 0;
+  bool pin = false;
+  Int8Executor executor = {};
+  bool has_executor = false;
+};
+
+inline SchedulerConfig &schedulerConfig() {
+  static SchedulerConfig config;
+  return config;
+}
+
+// Returns the shared scheduler, starting it on first use. Callers hold on to
+// the returned pointer for the duration of a multiply, so the pool can be
+// replaced by setThreadCount while multiplies are in flight.
+inline std::shared_ptr<Scheduler> scheduler() {
+  SchedulerConfig &config = schedulerConfig();
+  std::shared_ptr<Scheduler> current =
+      std::atomic_load_explicit(&config.scheduler, std::memory_order_acquire);
+  if (current) {
+    return current;
+  }
+
+  std::lock_guard<std::mutex> lock(config.mutex);
+  current = config.scheduler;
+  if (current) {
+    return current;
+  }
+  if (config.has_executor) {
+    current = std::make_shared<Scheduler>(config.executor);
+  } else {
+    size_t threads = config.threads ? config.threads : defaultThreadCount();
+    std::vector<unsigned> cores;
+    if (config.pin) {
+      cores = physicalCores();
+      // Left to itself, a core per thread.
+      if (!config.threads && !cores.empty()) {
+        threads = std::min(threads, cores.size());
+      }
+    }
+    current = std::make_shared<Scheduler>(threads, std::move(cores));
+  }
+  std::atomic_store_explicit(&config.scheduler, current,
+                             std::memory_order_release);
+  return current;
+}
+
+// Drops the scheduler for the next multiply to start a new one, config.mutex
+// must be held.
+inline void resetScheduler(SchedulerConfig &config) {
+  std::atomic_store_explicit(&config.scheduler, std::shared_ptr<Scheduler>(),
+                             std::memory_order_release);
+}
+
+// Sets the number of threads, 0 for the default. The current pool winds down
+// once the last multiply using it returns.
+inline void setThreadCount(size_t threads) {
+  SchedulerConfig &config = schedulerConfig();
+  std::lock_guard<std::mutex> lock(config.mutex);
+  config.threads = threads;
+  resetScheduler(config);
+}
+
+// Pins workers to distinct physical cores from now on, or lets them float.
+inline void setThreadPinning(bool pin) {
+  SchedulerConfig &config = schedulerConfig();
+  std::lock_guard<std::mutex> lock(config.mutex);
+  config.pin = pin;
+  resetScheduler(config);
+}
+
+// Hands parallel work to executor from now on, or back to the internal pool
+// if nullptr.
+inline void setExecutor(const Int8Executor *executor) {
+  SchedulerConfig &config = schedulerConfig();
+  std::lock_guard<std::mutex> lock(config.mutex);
+  config.has_executor = executor != nullptr;
+  config.executor = executor ? *executor : Int8Executor{};
+  resetScheduler(config);
+}
+
+} // namespace runtime
@@ -0,0 +1,242 @@
+// Definition of the handle declared in moz_intgemm.inl. Holds selected columns
+// of prepared B (and entries of prepared bias), reference counted between the
+// cache and the callers that acquired it.
+struct Int8Selection {
+  // What was selected from.
+  const int8_t *source_B;
+  const float *source_bias;
+  Index width;
+  Index cols_B;
+  std::vector<Index> cols;
+  size_t hash;
+
+  // Storage for the selection, B_selected and bias_selected share a single
+  // allocation of size bytes.
+  int8_t *B_selected;
+  float *bias_selected;
+  size_t bytes;
+
+  mutable std::atomic<size_t> references;
+};
+
+namespace runtime {
+
+// A bounded least-recently-used cache of selections, keyed by the source
+// matrix and the column indices selected from it.
+//
+// Decoding steps (and sentences in the same batch) often reuse the same
+// shortlist, in which case a lookup replaces gathering width * num_cols bytes.
+// Entries are looked up by pointer, so a source matrix must not be modified
+// or freed while selections from it may still be in the cache.
+class SelectionCache {
+public:
+  static constexpr size_t kDefaultCapacity = 64 * 1024 * 1024;
+
+  SelectionCache() = default;
+  SelectionCache(const SelectionCache &) = delete;
+  SelectionCache &operator=(const SelectionCache &) = delete;
+
+  ~SelectionCache() { clear(); }
+
+  // Returns the selection of cols from B (and bias, if not nullptr), or
+  // nullptr if there is no memory for it. On a miss fill(B_selected,
+  // bias_selected) is called to populate a new entry. The caller owns a
+  // reference to the result and must release() it.
+  template <class Fill>
+  const Int8Selection *acquire(const int8_t *B, const float *bias, Index width,
+                               Index cols_B, const Index *cols,
+                               Index num_cols, Fill fill) {
+    size_t hash = hashKey(B, bias, width, cols_B, cols, num_cols);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (Int8Selection *selection =
+              find(hash, B, bias, width, cols_B, cols, num_cols)) {
+        ++hits_;
+        return selection;
+      }
+    }
+
+    // Gather outside the lock, so other lookups aren't held up by this one.
+    Int8Selection *created = create(B, bias, width, cols_B, cols, num_cols);
+    if (!created) {
+      // Out of memory. Drop the cached selections no caller holds on to and
+      // try once more.
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        evict(0);
+      }
+      created = create(B, bias, width, cols_B, cols, num_cols);
+      if (!created) {
+        return nullptr;
+      }
+    }
+    created->hash = hash;
+    fill(created->B_selected, created->bias_selected);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++misses_;
+    if (created->bytes > capacity_) {
+      // Too large to cache, the caller holds the only reference.
+      return created;
+    }
+
+    // Another thread might have inserted the same selection meanwhile.
+    if (Int8Selection *selection =
+            find(hash, B, bias, width, cols_B, cols, num_cols)) {
+      release(created);
+      return selection;
+    }
+
+    // One reference for the cache, one for the caller.
+    created->references.store(2, std::memory_order_relaxed);
+    lru_.push_front(created);
+    index_.emplace(hash, lru_.begin());
+    bytes_ += created->bytes;
+    evict(capacity_);
+    return created;
+  }
+
+  static void release(const Int8Selection *selection) {
+    if (selection->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      alignedFree(selection->B_selected);
+      delete selection;
+    }
+  }
+
+  void setCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = bytes;
+    evict(capacity_);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evict(0);
+  }
+
+  Int8SelectionCacheStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Int8SelectionCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    stats.entries = lru_.size();
+    stats.bytes = bytes_;
+    return stats;
+  }
+
+  void resetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+  }
+
+private:
+  using Entries = std::list<Int8Selection *>;
+
+  static size_t hashKey(const int8_t *B, const float *bias, Index width,
+                        Index cols_B, const Index *cols, Index num_cols) {
+    std::hash<const void *> pointer_hasher;
+    size_t seed = pointer_hasher(B);
+    hashCombine(seed, pointer_hasher(bias));
+    hashCombine(seed, width);
+    hashCombine(seed, cols_B);
+    hashCombine(seed, num_cols);
+    for (Index c = 0; c < num_cols; c++) {
+      hashCombine(seed, cols[c]);
+    }
+    return seed;
+  }
+
+  // Looks up an entry, marking it most recently used and adding a reference
+  // for the caller if found. Requires mutex_ to be held.
+  Int8Selection *find(size_t hash, const int8_t *B, const float *bias,
+                      Index width, Index cols_B, const Index *cols,
+                      Index num_cols) {
+    auto range = index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      Int8Selection *selection = *(it->second);
+      // A matching hash is not enough, the column indices are compared to
+      // rule out collisions. This is still much cheaper than gathering.
+      if (selection->source_B == B && selection->source_bias == bias &&
+          selection->width == width && selection->cols_B == cols_B &&
+          selection->cols.size() == num_cols &&
+          std::memcmp(selection->cols.data(), cols,
+                      sizeof(Index) * num_cols) == 0) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        selection->references.fetch_add(1, std::memory_order_relaxed);
+        return selection;
+      }
+    }
+    return nullptr;
+  }
+
+  // A new selection, or nullptr if its storage cannot be allocated.
+  static Int8Selection *create(const int8_t *B, const float *bias, Index width,
+                               Index cols_B, const Index *cols,
+                               Index num_cols) {
+    size_t B_bytes = roundUpToAlignment(sizeof(int8_t) * width * num_cols);
+    size_t bias_bytes = bias ? sizeof(float) * num_cols : 0;
+    // Never empty, so that nullptr only ever means out of memory.
+    void *storage = alignedAlloc(std::max<size_t>(1, B_bytes + bias_bytes));
+    if (!storage) {
+      return nullptr;
+    }
+
+    Int8Selection *selection = new Int8Selection();
+    selection->source_B = B;
+    selection->source_bias = bias;
+    selection->width = width;
+    selection->cols_B = cols_B;
+    selection->cols.assign(cols, cols + num_cols);
+
+    selection->bytes = B_bytes + bias_bytes;
+    selection->B_selected = reinterpret_cast<int8_t *>(storage);
+    selection->bias_selected =
+        bias ? reinterpret_cast<float *>(selection->B_selected + B_bytes)
+             : nullptr;
+    selection->references.store(1, std::memory_order_relaxed);
+    return selection;
+  }
+
+  // Drops least recently used entries until at most target bytes are held.
+  // Callers still holding references keep their entries alive. Requires
+  // mutex_ to be held.
+  void evict(size_t target) {
+    while (bytes_ > target && !lru_.empty()) {
+      Int8Selection *selection = lru_.back();
+      auto range = index_.equal_range(selection->hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (*(it->second) == selection) {
+          index_.erase(it);
+          break;
+        }
+      }
+      lru_.pop_back();
+      bytes_ -= selection->bytes;
+      ++evictions_;
+      release(selection);
+    }
+  }
+
+  mutable std::mutex mutex_;
+
+  // Most recently used first.
+  Entries lru_;
+  std::unordered_multimap<size_t, Entries::iterator> index_;
+
+  size_t capacity_ = kDefaultCapacity;
+  size_t bytes_ = 0;
+
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+inline SelectionCache &selectionCache() {
+  static SelectionCache cache;
+  return cache;
+}
+
+} // namespace runtime
@@ -0,0 +1,120 @@
+// Recording of call shapes, see int8StartShapeTrace.
+//
+// Every interface call made while a shape trace runs is handed to the
+// recorder with its function and shape, on the thread that made it, and
+// written out by the flusher of event_log.inl. Calls the library makes to its
+// own interface are part of the outer call and not recorded. Like the trace
+// of trace.inl this does not need MOZINTGEMM_STATS, so that it can run in
+// production builds: a call costs a relaxed load while no trace runs.
+//
+// The binary format is a header of the magic "MOZSHAPE" and two little-endian
+// uint32, the format version and the size of a record, followed by records of
+// little-endian
+//   uint64 timestamp_ns, uint32 thread, uint32 operation,
+//   uint32 rows_A, uint32 width, uint32 cols_B, uint32 reserved
+// with operation the value of Int8Operation. The CSV format has a header line
+// and the same fields, operation named as in the call statistics.
+
+namespace runtime {
+
+constexpr char kShapeTraceMagic[8] = {'M', 'O', 'Z', 'S', 'H', 'A', 'P', 'E'};
+constexpr uint32_t kShapeTraceVersion = 1;
+constexpr uint32_t kShapeTraceRecordSize = 32;
+
+struct ShapeEvent {
+  std::chrono::steady_clock::time_point timestamp;
+  Int8Operation operation;
+  Index rows;
+  Index width;
+  Index cols;
+};
+
+class ShapeRecorder : public EventLog<ShapeRecorder, ShapeEvent> {
+public:
+  bool start(const char *path, Int8ShapeTraceFormat format) {
+    // Taken up by begin() if the file opens, a running trace keeps its own.
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    opening_format_ = format;
+    return open(path, format == Int8ShapeTraceFormat::Csv ? "w" : "wb");
+  }
+
+private:
+  friend class EventLog<ShapeRecorder, ShapeEvent>;
+
+  static void put32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+  }
+
+  void begin() {
+    format_ = opening_format_;
+    epoch_ = std::chrono::steady_clock::now();
+    if (format_ == Int8ShapeTraceFormat::Csv) {
+      std::fputs("timestamp_ns,thread,operation,rows_A,width,cols_B\n", file_);
+      return;
+    }
+    unsigned char header[16];
+    std::memcpy(header, kShapeTraceMagic, sizeof(kShapeTraceMagic));
+    put32(header + 8, kShapeTraceVersion);
+    put32(header + 12, kShapeTraceRecordSize);
+    std::fwrite(header, 1, sizeof(header), file_);
+  }
+
+  void introduce(uint32_t) {}
+
+  void write(uint32_t thread, const ShapeEvent &event) {
+    if (event.timestamp < epoch_) {
+      return;
+    }
+    const uint64_t timestamp =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(event.timestamp -
+                                                             epoch_)
+            .count();
+    if (format_ == Int8ShapeTraceFormat::Csv) {
+      std::fprintf(file_, "%llu,%u,%s,%u,%u,%u\n",
+                   static_cast<unsigned long long>(timestamp), thread,
+                   operationName(event.operation), event.rows, event.width,
+                   event.cols);
+      return;
+    }
+    unsigned char record[kShapeTraceRecordSize] = {};
+    put32(record, static_cast<uint32_t>(timestamp));
+    put32(record + 4, static_cast<uint32_t>(timestamp >> 32));
+    put32(record + 8, thread);
+    put32(record + 12, static_cast<uint32_t>(event.operation));
+    put32(record + 16, event.rows);
+    put32(record + 20, event.width);
+    put32(record + 24, event.cols);
+    std::fwrite(record, 1, sizeof(record), file_);
+  }
+
+  void end() {}
+
+  std::mutex start_mutex_;
+  Int8ShapeTraceFormat opening_format_ = Int8ShapeTraceFormat::Csv;
+  Int8ShapeTraceFormat format_ = Int8ShapeTraceFormat::Csv;
+  std::chrono::steady_clock::time_point epoch_;
+};
+
+// Never destroyed, pool threads may still be recording at exit.
+inline ShapeRecorder &shapeRecorder() {
+  static ShapeRecorder *instance = new ShapeRecorder();
+  return *instance;
+}
+
+inline bool shapeRecording() { return shapeRecorder().enabled(); }
+
+inline void recordShape(Int8Operation operation, Index rows, Index width,
+                        Index cols) {
+  shapeRecorder().record(ShapeEvent{std::chrono::steady_clock::now(),
+                                    operation, rows, width, cols});
+}
+
+inline bool startShapeTrace(const char *path, Int8ShapeTraceFormat format) {
+  return shapeRecorder().start(path, format);
+}
+
+inline uint64_t stopShapeTrace() { return shapeRecorder().close(); }
+
+} // namespace runtime
@@ -0,0 +1,565 @@
+// Per-call statistics, see int8GetCallStats.
+//
+// Each interface call looks up the entry of its function, shape and the tag of
+// the calling thread once, and phases within the call add their time and
+// bytes to it with relaxed atomics, from whichever thread runs them. Entries
+// are never removed, a reset only zeroes them, so a thread can keep a pointer
+// to its last entry and skip the lookup on repeated calls. Recording is only
+// compiled in with MOZINTGEMM_STATS defined. In either case, while a trace is
+// running CallScope and PhaseTimer hand their events to trace.inl, and while
+// a shape trace is running CallScope hands the shapes of calls to
+// shape_trace.inl; otherwise they cost a relaxed load each without
+// MOZINTGEMM_STATS.
+
+namespace runtime {
+
+constexpr size_t kPhases = static_cast<size_t>(Int8Phase::Count);
+
+inline const char *operationName(Int8Operation operation) {
+  switch (operation) {
+  case Int8Operation::PrepareA:
+    return "prepare_a";
+  case Int8Operation::PrepareB:
+    return "prepare_b";
+  case Int8Operation::PrepareBias:
+    return "prepare_bias";
+  case Int8Operation::SelectColumnsOfB:
+    return "select_columns_of_b";
+  case Int8Operation::MultiplyAndAddBias:
+    return "multiply_and_add_bias";
+  case Int8Operation::MultiplyAddBiasAndLayerNorm:
+    return "multiply_add_bias_and_layer_norm";
+  case Int8Operation::MultiplyAndAddBiasSelected:
+    return "multiply_and_add_bias_selected";
+  }
+  return "unknown";
+}
+
+inline const char *phaseName(size_t phase) {
+  static const char *const names[kPhases] = {"quantize", "layout", "gather",
+                                             "kernel", "epilogue"};
+  return phase < kPhases ? names[phase] : "unknown";
+}
+
+// Bytes an int8 multiply reads and writes, with an int32 or float result.
+inline uint64_t multiplyBytes(Index rows, Index width, Index cols) {
+  return uint64_t{width} * (rows + cols) + uint64_t{4} * rows * cols;
+}
+
+struct PhaseCounters {
+  std::atomic<uint64_t> runs{0};
+  std::atomic<uint64_t> nanoseconds{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+struct StatsEntry {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> nanoseconds{0};
+  PhaseCounters phases[kPhases];
+};
+
+class CallStats {
+public:
+  struct Key {
+    // Interned, so that equal tags are the same pointer.
+    const char *tag;
+    Int8Operation operation;
+    Index rows;
+    Index width;
+    Index cols;
+
+    bool operator==(const Key &other) const {
+      return tag == other.tag && operation == other.operation &&
+             rows == other.rows && width == other.width && cols == other.cols;
+    }
+  };
+
+  CallStats() = default;
+  CallStats(const CallStats &) = delete;
+  CallStats &operator=(const CallStats &) = delete;
+
+  // A copy of tag that lives as long as the process, the same one for equal
+  // tags.
+  const char *intern(const char *tag) {
+    std::lock_guard<std::mutex> lock(tags_mutex_);
+    auto found = tags_.find(std::string_view(tag));
+    if (found != tags_.end()) {
+      return found->data();
+    }
+    storage_.emplace_back(tag);
+    tags_.insert(std::string_view(storage_.back()));
+    return storage_.back().c_str();
+  }
+
+  StatsEntry *entry(const Key &key) {
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+      auto found = entries_.find(key);
+      if (found != entries_.end()) {
+        return &found->second;
+      }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return &entries_[key];
+  }
+
+  size_t snapshot(Int8CallStats *stats, size_t capacity, bool reset) {
+    std::vector<std::pair<Key, StatsEntry *>> sorted;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+      for (auto &entry : entries_) {
+        sorted.emplace_back(entry.first, &entry.second);
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<Key, StatsEntry *> &a,
+                 const std::pair<Key, StatsEntry *> &b) {
+                const Key &x = a.first, &y = b.first;
+                int tags = std::strcmp(x.tag, y.tag);
+                if (tags != 0) {
+                  return tags < 0;
+                }
+                return std::make_tuple(x.operation, x.rows, x.width, x.cols) <
+                       std::make_tuple(y.operation, y.rows, y.width, y.cols);
+              });
+
+    auto take = [reset](std::atomic<uint64_t> &counter) {
+      return reset ? counter.exchange(0, std::memory_order_relaxed)
+                   : counter.load(std::memory_order_relaxed);
+    };
+    for (size_t i = 0; i < std::min(capacity, sorted.size()); ++i) {
+      const Key &key = sorted[i].first;
+      StatsEntry &entry = *sorted[i].second;
+      Int8CallStats &out = stats[i];
+      out.tag = key.tag;
+      out.operation = key.operation;
+      out.rows_A = key.rows;
+      out.width = key.width;
+      out.cols_B = key.cols;
+      out.calls = take(entry.calls);
+      out.nanoseconds = take(entry.nanoseconds);
+      for (size_t phase = 0; phase < kPhases; ++phase) {
+        out.phases[phase].runs = take(entry.phases[phase].runs);
+        out.phases[phase].nanoseconds = take(entry.phases[phase].nanoseconds);
+        out.phases[phase].bytes = take(entry.phases[phase].bytes);
+      }
+    }
+    return sorted.size();
+  }
+
+  void reset() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (auto &entry : entries_) {
+      StatsEntry &stats = entry.second;
+      stats.calls.store(0, std::memory_order_relaxed);
+      stats.nanoseconds.store(0, std::memory_order_relaxed);
+      for (PhaseCounters &phase : stats.phases) {
+        phase.runs.store(0, std::memory_order_relaxed);
+        phase.nanoseconds.store(0, std::memory_order_relaxed);
+        phase.bytes.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      size_t seed = std::hash<const char *>()(key.tag);
+      hashCombine(seed, static_cast<size_t>(key.operation));
+      hashCombine(seed, key.rows);
+      hashCombine(seed, key.width);
+      hashCombine(seed, key.cols);
+      return seed;
+    }
+  };
+
+  // Nodes of an unordered_map never move, entries stay where they are.
+  std::shared_mutex mutex_;
+  std::unordered_map<Key, StatsEntry, KeyHash> entries_;
+
+  std::mutex tags_mutex_;
+  std::list<std::string> storage_;
+  std::unordered_set<std::string_view> tags_;
+};
+
+// Never destroyed, pool threads may still be recording at exit.
+inline CallStats &callStats() {
+  static CallStats *stats = new CallStats();
+  return *stats;
+}
+
+// The empty tag. Literals are not guaranteed to be the same object across
+// translation units, interned tags are compared by pointer.
+inline const char *emptyTag() {
+  static const char empty[] = "";
+  return empty;
+}
+
+// Recording state of a thread: its tag, and the entry of the interface call
+// it is in, if any. Without MOZINTGEMM_STATS there are no entries, and
+// in_call tells whether the thread is in a call while shapes or a trace are
+// recorded.
+struct StatsContext {
+  const char *tag = emptyTag();
+  StatsEntry *entry = nullptr;
+  bool in_call = false;
+  CallStats::Key last{nullptr, Int8Operation::PrepareA, 0, 0, 0};
+  StatsEntry *last_entry = nullptr;
+};
+
+inline StatsContext &statsContext() {
+  static thread_local StatsContext context;
+  return context;
+}
+
+inline void setStatsTag(const char *tag) {
+  statsContext().tag = tag && *tag ? callStats().intern(tag) : emptyTag();
+}
+
+// Defined in shape_trace.inl.
+inline bool shapeRecording();
+inline void recordShape(Int8Operation operation, Index rows, Index width,
+                        Index cols);
+
+using StatsClock = std::chrono::steady_clock;
+
+inline uint64_t elapsedNanoseconds(StatsClock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             StatsClock::now() - start)
+      .count();
+}
+
+// Defined in trace.inl.
+inline bool tracing();
+inline void traceCall(const CallStats::Key &key, StatsClock::time_point start,
+                      uint64_t nanoseconds);
+inline void tracePhase(size_t phase, uint64_t bytes,
+                       StatsClock::time_point start, uint64_t nanoseconds);
+
+#ifdef MOZINTGEMM_STATS
+
+// Entry of the interface call the calling thread is in. Work the call runs on
+// other threads records into this entry, so it is read before fanning out.
+inline StatsEntry *callStatsEntry() { return statsContext().entry; }
+
+// Records an interface call for as long as it is in scope. Calls the library
+// makes to its own interface are part of the outer call.
+class CallScope {
+public:
+  CallScope(Int8Operation operation, Index rows, Index width, Index cols) {
+    StatsContext &context = statsContext();
+    if (context.entry) {
+      return;
+    }
+    if (shapeRecording()) {
+      recordShape(operation, rows, width, cols);
+    }
+    key_ = CallStats::Key{context.tag, operation, rows, width, cols};
+    if (!(context.last_entry && key_ == context.last)) {
+      context.last = key_;
+      context.last_entry = callStats().entry(key_);
+    }
+    entry_ = context.entry = context.last_entry;
+    start_ = StatsClock::now();
+  }
+
+  CallScope(const CallScope &) = delete;
+  CallScope &operator=(const CallScope &) = delete;
+
+  ~CallScope() {
+    if (!entry_) {
+      return;
+    }
+    const uint64_t nanoseconds = elapsedNanoseconds(start_);
+    entry_->calls.fetch_add(1, std::memory_order_relaxed);
+    entry_->nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    statsContext().entry = nullptr;
+    if (tracing()) {
+      traceCall(key_, start_, nanoseconds);
+    }
+  }
+
+private:
+  StatsEntry *entry_ = nullptr;
+  CallStats::Key key_;
+  StatsClock::time_point start_;
+};
+
+// Records a run of a phase of the call of entry for as long as it is in scope.
+class PhaseTimer {
+public:
+  PhaseTimer(StatsEntry *entry, Int8Phase phase, uint64_t bytes)
+      : entry_(entry), phase_(static_cast<size_t>(phase)), bytes_(bytes) {
+    if (entry_) {
+      start_ = StatsClock::now();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  ~PhaseTimer() {
+    if (!entry_) {
+      return;
+    }
+    const uint64_t nanoseconds = elapsedNanoseconds(start_);
+    PhaseCounters &counters = entry_->phases[phase_];
+    counters.runs.fetch_add(1, std::memory_order_relaxed);
+    counters.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    counters.bytes.fetch_add(bytes_, std::memory_order_relaxed);
+    if (tracing()) {
+      tracePhase(phase_, bytes_, start_, nanoseconds);
+    }
+  }
+
+private:
+  StatsEntry *entry_;
+  size_t phase_;
+  uint64_t bytes_;
+  StatsClock::time_point start_;
+};
+
+#else
+
+inline StatsEntry *callStatsEntry() { return nullptr; }
+
+// Only records shapes and traces calls, and only reaches for the thread's
+// context while a shape trace or a trace runs.
+class CallScope {
+public:
+  CallScope(Int8Operation operation, Index rows, Index width, Index cols) {
+    const bool shapes = shapeRecording();
+    traced_ = tracing();
+    if (!shapes && !traced_) {
+      return;
+    }
+    StatsContext &context = statsContext();
+    if (context.in_call) {
+      traced_ = false;
+      return;
+    }
+    if (shapes) {
+      recordShape(operation, rows, width, cols);
+    }
+    outer_ = context.in_call = true;
+    if (traced_) {
+      key_ = CallStats::Key{context.tag, operation, rows, width, cols};
+      start_ = StatsClock::now();
+    }
+  }
+
+  CallScope(const CallScope &) = delete;
+  CallScope &operator=(const CallScope &) = delete;
+
+  ~CallScope() {
+    if (!outer_) {
+      return;
+    }
+    statsContext().in_call = false;
+    if (traced_ && tracing()) {
+      traceCall(key_, start_, elapsedNanoseconds(start_));
+    }
+  }
+
+private:
+  bool outer_ = false;
+  bool traced_;
+  CallStats::Key key_;
+  StatsClock::time_point start_;
+};
+
+// Only traces the phase, and only reads the clock while a trace runs.
+class PhaseTimer {
+public:
+  PhaseTimer(StatsEntry *, Int8Phase phase, uint64_t bytes)
+      : traced_(tracing()), phase_(static_cast<size_t>(phase)), bytes_(bytes) {
+    if (traced_) {
+      start_ = StatsClock::now();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  ~PhaseTimer() {
+    if (traced_ && tracing()) {
+      tracePhase(phase_, bytes_, start_, elapsedNanoseconds(start_));
+    }
+  }
+
+private:
+  bool traced_;
+  size_t phase_;
+  uint64_t bytes_;
+  StatsClock::time_point start_;
+};
+
+#endif
+
+// Runs a call on behalf of another thread (an asynchronous multiply) as if
+// that thread had made it: under its tag, and outside of any call the running
+// thread is in.
+class StatsTagScope {
+public:
+  explicit StatsTagScope(const char *tag) : saved_(statsContext()) {
+    StatsContext &context = statsContext();
+    context.tag = tag;
+    context.entry = nullptr;
+    context.in_call = false;
+  }
+
+  StatsTagScope(const StatsTagScope &) = delete;
+  StatsTagScope &operator=(const StatsTagScope &) = delete;
+
+  ~StatsTagScope() {
+    StatsContext &context = statsContext();
+    context.tag = saved_.tag;
+    context.entry = saved_.entry;
+    context.in_call = saved_.in_call;
+  }
+
+private:
+  StatsContext saved_;
+};
+
+// Appends value to out as the contents of a JSON string.
+inline void appendEscaped(std::string &out, const char *value) {
+  for (const char *c = value; *c; ++c) {
+    switch (*c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      if (static_cast<unsigned char>(*c) < 0x20) {
+        char escaped[8];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+        out += escaped;
+      } else {
+        out += *c;
+      }
+    }
+  }
+}
+
+// Appends value to out as a Prometheus label value, which only has escapes
+// for backslash, double quote and line feed and takes anything else as is.
+inline void appendLabelEscaped(std::string &out, const char *value) {
+  for (const char *c = value; *c; ++c) {
+    switch (*c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      out += *c;
+    }
+  }
+}
+
+inline std::string formatSeconds(uint64_t nanoseconds) {
+  char seconds[32];
+  std::snprintf(seconds, sizeof(seconds), "%.9f", nanoseconds * 1e-9);
+  return seconds;
+}
+
+inline std::string prometheusLabels(const Int8CallStats &stats) {
+  std::string labels = "tag=\"";
+  appendLabelEscaped(labels, stats.tag);
+  return labels + "\",operation=\"" + operationName(stats.operation) +
+         "\",rows_A=\"" + std::to_string(stats.rows_A) + "\",width=\"" +
+         std::to_string(stats.width) + "\",cols_B=\"" +
+         std::to_string(stats.cols_B) + "\"";
+}
+
+inline std::string formatPrometheus(const Int8CallStats *stats, size_t count) {
+  std::string out;
+  auto header = [&out](const char *name, const char *help) {
+    out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name +
+           " counter\n";
+  };
+  auto sample = [&out](const char *name, const std::string &labels,
+                       const std::string &value) {
+    out += std::string(name) + "{" + labels + "} " + value + "\n";
+  };
+
+  header("mozintgemm_calls_total", "Interface calls.");
+  for (size_t i = 0; i < count; ++i) {
+    sample("mozintgemm_calls_total", prometheusLabels(stats[i]),
+           std::to_string(stats[i].calls));
+  }
+  header("mozintgemm_call_seconds_total", "Wall time of interface calls.");
+  for (size_t i = 0; i < count; ++i) {
+    sample("mozintgemm_call_seconds_total", prometheusLabels(stats[i]),
+           formatSeconds(stats[i].nanoseconds));
+  }
+
+  // A sample per phase that ran.
+  auto phases = [&](const char *name, const char *help,
+                    std::string (*value)(const Int8PhaseStats &)) {
+    header(name, help);
+    for (size_t i = 0; i < count; ++i) {
+      const std::string labels = prometheusLabels(stats[i]);
+      for (size_t phase = 0; phase < kPhases; ++phase) {
+        if (stats[i].phases[phase].runs != 0) {
+          sample(name, labels + ",phase=\"" + phaseName(phase) + "\"",
+                 value(stats[i].phases[phase]));
+        }
+      }
+    }
+  };
+  phases("mozintgemm_phase_runs_total", "Runs of phases of calls.",
+         [](const Int8PhaseStats &p) { return std::to_string(p.runs); });
+  phases("mozintgemm_phase_seconds_total",
+         "Time spent in phases of calls, summed over threads.",
+         [](const Int8PhaseStats &p) { return formatSeconds(p.nanoseconds); });
+  phases("mozintgemm_phase_bytes_total",
+         "Estimated bytes read and written by phases of calls.",
+         [](const Int8PhaseStats &p) { return std::to_string(p.bytes); });
+  return out;
+}
+
+inline std::string formatJson(const Int8CallStats *stats, size_t count) {
+  std::string out = "[";
+  for (size_t i = 0; i < count; ++i) {
+    const Int8CallStats &s = stats[i];
+    out += i == 0 ? "\n" : ",\n";
+    out += "{\"tag\":\"";
+    appendEscaped(out, s.tag);
+    out += std::string("\",\"operation\":\"") + operationName(s.operation) +
+           "\",\"rows_A\":" + std::to_string(s.rows_A) +
+           ",\"width\":" + std::to_string(s.width) +
+           ",\"cols_B\":" + std::to_string(s.cols_B) +
+           ",\"calls\":" + std::to_string(s.calls) +
+           ",\"nanoseconds\":" + std::to_string(s.nanoseconds) +
+           ",\"phases\":{";
+    bool first = true;
+    for (size_t phase = 0; phase < kPhases; ++phase) {
+      const Int8PhaseStats &p = s.phases[phase];
+      if (p.runs == 0) {
+        continue;
+      }
+      out += first ? "\"" : ",\"";
+      out += std::string(phaseName(phase)) +
+             "\":{\"runs\":" + std::to_string(p.runs) +
+             ",\"nanoseconds\":" + std::to_string(p.nanoseconds) +
+             ",\"bytes\":" + std::to_string(p.bytes) + "}";
+      first = false;
+    }
+    out += "}}";
+  }
+  out += count == 0 ? "]\n" : "\n]\n";
+  return out;
+}
+
+} // namespace runtime
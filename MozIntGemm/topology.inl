@@ -0,0 +1,281 @@
+// CPUs available to the process and how they are laid out.
+//
+// hardware_concurrency() counts every CPU of the host, even in a container
+// confined to a few of them by its affinity mask or CPU quota. A worker per
+// host CPU soon exceeds the quota, and the CFS bandwidth controller then
+// stalls every thread of the process for the rest of its period. The default
+// thread count therefore follows the affinity mask and the cgroup (v1 or v2)
+// quota. Workers can also be pinned to distinct physical cores, fastest cores
+// first on hybrid (big.LITTLE) parts. Like numa.inl this reads procfs and
+// sysfs directly; elsewhere there is nothing but hardware_concurrency().
+
+namespace runtime {
+
+// Parses a sysfs list such as "0-1,3".
+inline std::vector<unsigned> parseList(const std::string &list) {
+  std::vector<unsigned> values;
+  std::istringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    unsigned first = 0, last = 0;
+    int fields = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+    if (fields < 1) {
+      continue;
+    }
+    for (unsigned value = first; value <= (fields == 2 ? last : first);
+         ++value) {
+      values.push_back(value);
+    }
+  }
+  return values;
+}
+
+// CPUs granted by a CFS quota of quota per period, 0 if unlimited.
+inline size_t quotaCpus(long long quota, long long period) {
+  if (quota <= 0 || period <= 0) {
+    return 0;
+  }
+  return static_cast<size_t>((quota + period - 1) / period);
+}
+
+// CPUs granted by the contents of a cgroup v2 cpu.max, "$MAX $PERIOD" where
+// $MAX may be "max".
+inline size_t parseCpuMax(const std::string &cpu_max) {
+  long long quota = 0, period = 0;
+  if (std::sscanf(cpu_max.c_str(), "%lld %lld", &quota, &period) != 2) {
+    return 0;
+  }
+  return quotaCpus(quota, period);
+}
+
+inline std::string readLine(const std::string &path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+inline long long readNumber(const std::string &path) {
+  std::ifstream file(path);
+  long long value = 0;
+  return file >> value ? value : 0;
+}
+
+inline bool hasController(const std::string &controllers,
+                          const std::string &controller) {
+  std::istringstream stream(controllers);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    if (name == controller) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A mounted cgroup hierarchy with the cpu controller: the cgroup mounted
+// (root, a path within the hierarchy) and where.
+struct CgroupMount {
+  bool v2;
+  std::string root;
+  std::string point;
+};
+
+// Mounts of cgroup hierarchies with the cpu controller, from the lines of
+// /proc/self/mountinfo: "$ID $PARENT $DEVICE $ROOT $POINT $OPTIONS [$TAG...]
+// - $TYPE $SOURCE $SUPER_OPTIONS".
+inline std::vector<CgroupMount> cpuCgroupMounts(std::istream &mountinfo) {
+  std::vector<CgroupMount> mounts;
+  std::string line;
+  while (std::getline(mountinfo, line)) {
+    std::istringstream fields(line);
+    std::string id, parent, device, root, point, field;
+    fields >> id >> parent >> device >> root >> point;
+    while (fields >> field && field != "-") {
+    }
+    std::string type, source, options;
+    if (!(fields >> type >> source >> options)) {
+      continue;
+    }
+    if (type == "cgroup2" ||
+        (type == "cgroup" && hasController(options, "cpu"))) {
+      mounts.push_back(CgroupMount{type == "cgroup2", root, point});
+    }
+  }
+  return mounts;
+}
+
+// Tightest CPU quota of the cgroups of the process, as listed by cgroups (the
+// format of /proc/self/cgroup), and of their ancestors up to the cgroup
+// mounted, 0 if there is none. A cgroup is looked up under each mount of its
+// hierarchy in mountinfo (the format of /proc/self/mountinfo), at its path
+// relative to the mounted cgroup. Containers often mount just their own
+// cgroup, while the path names it from the root of the hierarchy or, outside
+// of the cgroup namespace the path is relative to, starts with "/..". A
+// cgroup outside of the mounted one is then taken to be limited by the
+// mounted cgroup's quota, the closest the process can see.
+inline size_t cgroupCpuLimit(std::istream &cgroups, std::istream &mountinfo) {
+  const std::vector<CgroupMount> mounts = cpuCgroupMounts(mountinfo);
+  size_t limit = 0;
+  auto tighten = [&limit](size_t cpus) {
+    if (cpus != 0 && (limit == 0 || cpus < limit)) {
+      limit = cpus;
+    }
+  };
+
+  // Lines are "$ID:$CONTROLLERS:$PATH", with no controllers for cgroup v2.
+  std::string line;
+  while (std::getline(cgroups, line)) {
+    size_t first = line.find(':');
+    size_t second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      continue;
+    }
+    std::string controllers = line.substr(first + 1, second - first - 1);
+    bool v2 = controllers.empty();
+    if (!v2 && !hasController(controllers, "cpu")) {
+      continue;
+    }
+    const std::string path = line.substr(second + 1);
+
+    for (const CgroupMount &mount : mounts) {
+      if (mount.v2 != v2) {
+        continue;
+      }
+      const std::string root = mount.root == "/" ? "" : mount.root;
+      const bool below = path.compare(0, 3, "/..") != 0 &&
+                         path.compare(0, root.size(), root) == 0 &&
+                         (path.size() == root.size() ||
+                          path[root.size()] == '/');
+      std::string relative = below ? path.substr(root.size()) : "";
+      for (;;) {
+        std::string dir = mount.point + relative;
+        if (v2) {
+          tighten(parseCpuMax(readLine(dir + "/cpu.max")));
+        } else {
+          tighten(quotaCpus(readNumber(dir + "/cpu.cfs_quota_us"),
+                            readNumber(dir + "/cpu.cfs_period_us")));
+        }
+        if (relative.empty()) {
+          break;
+        }
+        relative.erase(relative.rfind('/'));
+      }
+    }
+  }
+  return limit;
+}
+
+#ifdef __linux__
+
+// CPUs in the affinity mask of the calling thread.
+inline std::vector<unsigned> allowedCpus() {
+  std::vector<unsigned> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Tightest CPU quota of the cgroups of the process, 0 if there is none.
+inline size_t cgroupCpuLimit() {
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::ifstream mountinfo("/proc/self/mountinfo");
+  return cgroupCpuLimit(cgroups, mountinfo);
+}
+
+inline std::string cpuPath(unsigned cpu) {
+  return "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+}
+
+// First hardware thread of the physical core cpu belongs to.
+inline unsigned coreOf(unsigned cpu) {
+  std::string siblings = readLine(cpuPath(cpu) + "/topology/core_cpus_list");
+  if (siblings.empty()) {
+    siblings = readLine(cpuPath(cpu) + "/topology/thread_siblings_list");
+  }
+  std::vector<unsigned> threads = parseList(siblings);
+  return threads.empty() ? cpu : threads.front();
+}
+
+// Relative speed of cpu. Arm kernels scale cpu_capacity so that the biggest
+// cores are at 1024; elsewhere performance cores boost higher than efficient
+// ones. Equal for every CPU of a homogeneous part.
+inline long long cpuCapacity(unsigned cpu) {
+  long long capacity = readNumber(cpuPath(cpu) + "/cpu_capacity");
+  if (capacity > 0) {
+    return capacity;
+  }
+  return readNumber(cpuPath(cpu) + "/cpufreq/cpuinfo_max_freq");
+}
+
+// One CPU of each physical core the process may run on, fastest first.
+inline std::vector<unsigned> physicalCores() {
+  std::vector<unsigned> cpus, cores;
+  for (unsigned cpu : allowedCpus()) {
+    unsigned core = coreOf(cpu);
+    if (std::find(cores.begin(), cores.end(), core) == cores.end()) {
+      cores.push_back(core);
+      cpus.push_back(cpu);
+    }
+  }
+
+  std::vector<std::pair<long long, unsigned>> ranked;
+  for (unsigned cpu : cpus) {
+    ranked.emplace_back(-cpuCapacity(cpu), cpu);
+  }
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [](const std::pair<long long, unsigned> &a,
+                      const std::pair<long long, unsigned> &b) {
+                     return a.first < b.first;
+                   });
+  for (size_t i = 0; i < ranked.size(); ++i) {
+    cpus[i] = ranked[i].second;
+  }
+  return cpus;
+}
+
+inline void pinCurrentThread(unsigned cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+#else
+
+inline std::vector<unsigned> allowedCpus() { return {}; }
+inline size_t cgroupCpuLimit() { return 0; }
+inline std::vector<unsigned> physicalCores() { return {}; }
+inline void pinCurrentThread(unsigned) {}
+
+#endif
+
+// Threads to use for cpus CPUs (0 if unknown) under a quota of quota CPUs (0
+// if unlimited).
+inline size_t defaultThreadCount(size_t cpus, size_t quota) {
+  size_t threads = cpus;
+  if (quota != 0 && (threads == 0 || quota < threads)) {
+    threads = quota;
+  }
+  return std::max<size_t>(1, threads);
+}
+
+// Threads to use when none were asked for: the CPUs the process may run on,
+// capped by its CPU quota.
+inline size_t defaultThreadCount() {
+  size_t cpus = allowedCpus().size();
+  if (cpus == 0) {
+    cpus = std::thread::hardware_concurrency();
+  }
+  return defaultThreadCount(cpus, cgroupCpuLimit());
+}
+
+} // namespace runtime
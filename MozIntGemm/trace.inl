@@ -0,0 +1,95 @@
+// Chrome trace-event export of calls and their phases, see int8StartTrace.
+//
+// The scopes of stats.inl hand each call and phase that ends to the tracer as
+// a complete event, on the thread that ran it, to be written out by the
+// flusher of event_log.inl. This does not need MOZINTGEMM_STATS: while no
+// trace runs a scope only checks whether one does.
+
+namespace runtime {
+
+struct TraceEvent {
+  // A call if phase is kPhases, else a phase of one.
+  size_t phase;
+  CallStats::Key key;
+  uint64_t bytes;
+  StatsClock::time_point start;
+  uint64_t nanoseconds;
+};
+
+class Tracer : public EventLog<Tracer, TraceEvent> {
+  friend class EventLog<Tracer, TraceEvent>;
+
+  void begin() {
+    std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file_);
+    first_ = true;
+    epoch_ = StatsClock::now();
+  }
+
+  void introduce(uint32_t thread) {
+    std::fprintf(file_,
+                 "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                 first_ ? "" : ",\n", thread, thread);
+    first_ = false;
+  }
+
+  void write(uint32_t thread, const TraceEvent &event) {
+    if (event.start < epoch_) {
+      return;
+    }
+    const double begin = std::chrono::duration<double, std::micro>(
+                             event.start - epoch_)
+                             .count();
+    const CallStats::Key &key = event.key;
+    std::string args;
+    if (event.phase == kPhases) {
+      args = "\"tag\":\"";
+      appendEscaped(args, key.tag);
+      args += "\",\"rows_A\":" + std::to_string(key.rows) +
+              ",\"width\":" + std::to_string(key.width) +
+              ",\"cols_B\":" + std::to_string(key.cols);
+    } else {
+      args = "\"bytes\":" + std::to_string(event.bytes);
+    }
+    std::fprintf(file_,
+                 "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                 "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{%s}}",
+                 first_ ? "" : ",\n",
+                 event.phase == kPhases ? operationName(key.operation)
+                                        : phaseName(event.phase),
+                 event.phase == kPhases ? "call" : "phase", thread, begin,
+                 event.nanoseconds / 1000.0, args.c_str());
+    first_ = false;
+  }
+
+  void end() { std::fputs("\n]}\n", file_); }
+
+  bool first_ = true;
+  StatsClock::time_point epoch_;
+};
+
+// Never destroyed, pool threads may still be recording at exit.
+inline Tracer &tracer() {
+  static Tracer *instance = new Tracer();
+  return *instance;
+}
+
+inline bool tracing() { return tracer().enabled(); }
+
+inline void traceCall(const CallStats::Key &key, StatsClock::time_point start,
+                      uint64_t nanoseconds) {
+  tracer().record(TraceEvent{kPhases, key, 0, start, nanoseconds});
+}
+
+// Phases are shown within their call, without repeating its shape.
+inline void tracePhase(size_t phase, uint64_t bytes,
+                       StatsClock::time_point start, uint64_t nanoseconds) {
+  CallStats::Key key{emptyTag(), Int8Operation::PrepareA, 0, 0, 0};
+  tracer().record(TraceEvent{phase, key, bytes, start, nanoseconds});
+}
+
+inline bool startTrace(const char *path) { return tracer().open(path, "w"); }
+
+inline uint64_t stopTrace() { return tracer().close(); }
+
+} // namespace runtime
@@ -0,0 +1,81 @@
+// Caller-provided scratch memory, see int8SetWorkspace.
+//
+// Buffers a call needs while it runs (int32 accumulators, partial sums,
+// gathered columns) come from the workspace set by the calling thread, taken
+// and released stack fashion, and only come from the buffer pool if the
+// thread has no workspace or it is too small. Tiles running on other threads
+// never need scratch of their own, so a workspace of int8WorkspaceSize bytes
+// is enough for multiplies to stay off the heap.
+
+namespace runtime {
+
+struct Workspace {
+  char *data = nullptr;
+  size_t bytes = 0;
+  size_t used = 0;
+};
+
+inline Workspace &threadWorkspace() {
+  static thread_local Workspace workspace;
+  return workspace;
+}
+
+// Makes data the workspace of the calling thread, nullptr for none.
+inline void setWorkspace(void *data, size_t bytes) {
+  Workspace &workspace = threadWorkspace();
+  workspace = Workspace{};
+  if (!data) {
+    return;
+  }
+
+  // Buffers are handed out aligned, skip to the first aligned byte.
+  uintptr_t address = reinterpret_cast<uintptr_t>(data);
+  size_t skip = roundUpToAlignment(address) - address;
+  if (skip < bytes) {
+    workspace.data = static_cast<char *>(data) + skip;
+    workspace.bytes = bytes - skip;
+  }
+}
+
+// Buffer of count elements from the workspace of the calling thread, or the
+// buffer pool if it does not fit. Buffers must be destroyed in reverse order of
+// construction, which holds for locals of the same thread.
+template <class T> class Scratch {
+public:
+  explicit Scratch(size_t count)
+      : bytes_(roundUpToAlignment(sizeof(T) * count)) {
+    if (bytes_ == 0) {
+      return;
+    }
+    Workspace &workspace = threadWorkspace();
+    if (workspace.data && workspace.used + bytes_ <= workspace.bytes) {
+      data_ = reinterpret_cast<T *>(workspace.data + workspace.used);
+      workspace.used += bytes_;
+      workspace_ = &workspace;
+    } else {
+      data_ = static_cast<T *>(bufferPool().allocate(bytes_));
+    }
+  }
+
+  Scratch(const Scratch &) = delete;
+  Scratch &operator=(const Scratch &) = delete;
+
+  ~Scratch() {
+    if (workspace_) {
+      workspace_->used -= bytes_;
+    } else if (data_) {
+      bufferPool().free(data_, bytes_);
+    }
+  }
+
+  T *data() { return data_; }
+  T *begin() { return data_; }
+  T &operator[](size_t i) { return data_[i]; }
+
+private:
+  size_t bytes_;
+  T *data_ = nullptr;
+  Workspace *workspace_ = nullptr;
+};
+
+} // namespace runtime
@@ -1,5 +1,7 @@
 #include "generated.h"
 #include "matrix.h"
+#include "shape_trace.h"
+#include <iostream>
 #include <random>
 #include <ruy/ruy.h>
 #include <utility>
@@ -22,10 +24,21 @@ std::vector<std::tuple<Order, Order, Order>> Orderings() {
   return result;
 }
 
-int main() {
+int main(int argc, char **argv) {
   std::mt19937_64 gen64;
   gen64.seed(42);
 
+  // Shapes of a trace recorded with int8StartShapeTrace, if given.
+  std::vector<ProblemSize> sizes = PROBLEM_SIZES;
+  if (argc > 1) {
+    std::vector<ShapeTraceRecord> records;
+    if (!loadShapeTrace(argv[1], records)) {
+      std::cerr << "Cannot read shape trace " << argv[1] << "\n";
+      return 1;
+    }
+    sizes = multiplyProblemSizes(records);
+  }
+
   // Flag to quickly prototype and inspect without full data.
   bool prototyping = false;
 
@@ -36,7 +49,7 @@ int main() {
 
   std::vector<double> durations;
 
-  for (auto &dimensions : PROBLEM_SIZES) {
+  for (auto &dimensions : sizes) {
     for (auto &ordering : orderings) {
       auto [a_order, b_order, c_order] = ordering;
       auto [M, N, P] = unroll(dimensions);
@@ -53,12 +66,13 @@ int main() {
       Layout productLayout(A.layout().rows(), B.layout().cols(), c_order);
       Matrix<DestScalar> C(productLayout);
 
+      // Created once, as a caller keeps it across multiplies, so that its
+      // thread pool and allocations are not part of the timing.
+      ruy::Context context;
+
       // Begin measuring now.
       auto start = std::chrono::steady_clock::now();
       for (size_t i = 0; i < MONTE_CARLO_RUNS; i++) {
-
-        ruy::Context context;
-
         auto convertToRuy = [](const Order &order) {
           if (order == Order::RowMajor) {
             return ruy::Order::kRowMajor;
@@ -109,7 +123,7 @@ int main() {
   // Revisit durations vector in th the same order, print this time, outside the
   // benchmarking code.
   auto pDuration = durations.begin();
-  for (auto &dimensions : PROBLEM_SIZES) {
+  for (auto &dimensions : sizes) {
     for (auto &ordering : orderings) {
       auto [a_order, b_order, c_order] = ordering;
       auto [M, N, P] = unroll(dimensions);
@@ -4,7 +4,9 @@
 #include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <numeric>
 #include <random>
+#include <vector>
 
 #define DEBUG_PRINTABLE(x)                                                     \
   do {                                                                         \
@@ -98,6 +100,155 @@ TEST(PreprocOnARM, UnquantizeAddBiasNeonVsStandard) {
   DEBUG_PRINTABLE(mse);
 }
 
+template <class Path>
+void UnQuantizeAddBiasAccumulate(Matrix<int32_t> &intermediate,
+                                 Matrix<float> &bias, Matrix<float> &output) {
+  float unquant_multiplier = 1 / 127.0f;
+  Preprocess<Path>::unquantizeAddBiasAccumulate(
+      intermediate.data(), bias.data(), unquant_multiplier,
+      intermediate.nrows(), intermediate.ncols(), output.data());
+}
+
+TEST(PreprocOnARM, UnquantizeAddBiasAccumulateNeonVsStandard) {
+  std::mt19937_64 gen64;
+  const size_t M = 8, N = 64, P = 64;
+  auto [A, B, bias] = generateInput(gen64, M, N, P);
+  Layout productLayout(A.nrows(), B.ncols(), Order::RowMajor);
+  auto intermediate =
+      make_random_matrix<int32_t>(gen64, productLayout, -127, 127);
+  auto residual = make_random_matrix<float>(gen64, productLayout, -1.0f, 1.0f);
+
+  Matrix<float> outputStd(productLayout, residual.data()),
+      outputNeon(productLayout, residual.data());
+
+  UnQuantizeAddBiasAccumulate<kStandardCpp>(intermediate, bias, outputStd);
+  UnQuantizeAddBiasAccumulate<kNeon>(intermediate, bias, outputNeon);
+
+  DEBUG_PRINTABLE(outputStd);
+  DEBUG_PRINTABLE(outputNeon);
+
+  const float MSE_TOLERANCE = 1e-9;
+  auto mse = MeanSquaredError(outputStd, outputNeon);
+  ASSERT_LT(mse, MSE_TOLERANCE);
+  DEBUG_PRINTABLE(mse);
+}
+
+template <class Path>
+void UnQuantizeAddBiasLayerNorm(Matrix<int32_t> &intermediate,
+                                Matrix<float> &bias, Matrix<float> &residual,
+                                Matrix<float> &gamma, Matrix<float> &beta,
+                                Matrix<float> &output) {
+  float unquant_multiplier = 1 / 127.0f;
+  Preprocess<Path>::unquantizeAddBiasLayerNorm(
+      intermediate.data(), bias.data(), unquant_multiplier, residual.data(),
+      gamma.data(), beta.data(), 1e-6f, intermediate.nrows(),
+      intermediate.ncols(), output.data());
+}
+
+TEST(PreprocOnARM, UnquantizeAddBiasLayerNormNeonVsStandard) {
+  std::mt19937_64 gen64;
+  const size_t M = 8, N = 64, P = 64;
+  auto [A, B, bias] = generateInput(gen64, M, N, P);
+  Layout productLayout(A.nrows(), B.ncols(), Order::RowMajor);
+  auto intermediate =
+      make_random_matrix<int32_t>(gen64, productLayout, -127, 127);
+  auto residual = make_random_matrix<float>(gen64, productLayout, -1.0f, 1.0f);
+  auto gamma = make_random_matrix<float>(gen64, bias.layout(), 0.5f, 1.5f);
+  auto beta = make_random_matrix<float>(gen64, bias.layout(), -1.0f, 1.0f);
+
+  Matrix<float> outputStd(productLayout), outputNeon(productLayout);
+
+  UnQuantizeAddBiasLayerNorm<kStandardCpp>(intermediate, bias, residual, gamma,
+                                           beta, outputStd);
+  UnQuantizeAddBiasLayerNorm<kNeon>(intermediate, bias, residual, gamma, beta,
+                                    outputNeon);
+
+  DEBUG_PRINTABLE(outputStd);
+  DEBUG_PRINTABLE(outputNeon);
+
+  // Summation order differs between the two, so this is not bit-exact.
+  const float MSE_TOLERANCE = 1e-6;
+  auto mse = MeanSquaredError(outputStd, outputNeon);
+  ASSERT_LT(mse, MSE_TOLERANCE);
+  DEBUG_PRINTABLE(mse);
+}
+
+template <class Path>
+void SelectColumns(Matrix<int8_t> &input, std::vector<Index> &cols,
+                   Matrix<int8_t> &output) {
+  // input holds B col-major, so each of its rows is a column of B.
+  Preprocess<Path>::selectColumns(input.data(), input.ncols(), cols.data(),
+                                  cols.size(), output.data());
+}
+
+TEST(PreprocOnARM, SelectColumnsNeonVsStandard) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  const size_t cols_B = 256;
+  for (size_t width : {64, 256, 320, 1536}) {
+    Layout layout(cols_B, width, Order::RowMajor);
+    auto B = make_random_matrix<int8_t>(gen64, layout, -127, 127);
+
+    // Shuffled indices with a run of consecutive columns in the middle.
+    std::vector<Index> cols(cols_B);
+    std::iota(cols.begin(), cols.end(), 0);
+    std::shuffle(cols.begin(), cols.end(), gen64);
+    cols.resize(96);
+    std::iota(cols.begin() + 32, cols.begin() + 64, 100);
+
+    Layout selectedLayout(cols.size(), width, Order::RowMajor);
+    Matrix<int8_t> expected(selectedLayout), selectedStd(selectedLayout),
+        selectedNeon(selectedLayout);
+    for (size_t c = 0; c < cols.size(); c++) {
+      std::copy(B.data() + cols[c] * width, B.data() + (cols[c] + 1) * width,
+                expected.data() + c * width);
+    }
+
+    SelectColumns<kStandardCpp>(B, cols, selectedStd);
+    SelectColumns<kNeon>(B, cols, selectedNeon);
+    DEBUG_PRINTABLE(selectedStd);
+    DEBUG_PRINTABLE(selectedNeon);
+
+    ASSERT_TRUE(std::equal(expected.data(),
+                           expected.data() + cols.size() * width,
+                           selectedStd.data()));
+    ASSERT_TRUE(std::equal(expected.data(),
+                           expected.data() + cols.size() * width,
+                           selectedNeon.data()));
+  }
+}
+
+TEST(AlignedVector, MoveAndResize) {
+  AlignedVector<int32_t> vector(100);
+  std::iota(vector.begin(), vector.end(), 0);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(vector.data()) % 64, 0);
+
+  // Growing keeps the contents, moving hands over the storage.
+  int32_t *storage = vector.data();
+  vector.reserve(50);
+  ASSERT_EQ(vector.data(), storage);
+  vector.resize(1000);
+  ASSERT_EQ(vector.size(), 1000);
+  ASSERT_GE(vector.capacity(), 1000);
+  for (int32_t i = 0; i < 100; i++) {
+    ASSERT_EQ(vector.data()[i], i);
+  }
+
+  storage = vector.data();
+  AlignedVector<int32_t> moved(std::move(vector));
+  ASSERT_EQ(moved.data(), storage);
+  ASSERT_EQ(vector.data(), nullptr);
+  ASSERT_EQ(vector.size(), 0);
+
+  std::vector<AlignedVector<int32_t>> vectors;
+  vectors.push_back(std::move(moved));
+  vectors.emplace_back(16);
+  ASSERT_EQ(vectors.front().data(), storage);
+  vector = std::move(vectors.back());
+  ASSERT_EQ(vector.size(), 16);
+}
+
 TEST(PreprocOnARM, TransposeDriver) {
   constexpr size_t tile = 16;
   constexpr size_t block = tile * tile;
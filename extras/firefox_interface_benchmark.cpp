@@ -1,5 +1,6 @@
 #include "generated.h"
 #include "matrix.h"
+#include "shape_trace.h"
 #include "wrapped.h"
 #include <chrono>
 #include <cstdint>
@@ -83,16 +84,31 @@ int main(int argc, char **argv) {
   std::mt19937_64 gen64;
   gen64.seed(42);
 
+  // Shapes of a trace recorded with int8StartShapeTrace, if given.
+  std::vector<ProblemSize> sizes = PROBLEM_SIZES;
+  if (argc > 1) {
+    std::vector<ShapeTraceRecord> records;
+    if (!loadShapeTrace(argv[1], records)) {
+      std::cerr << "Cannot read shape trace " << argv[1] << "\n";
+      return 1;
+    }
+    sizes = multiplyProblemSizes(records);
+    if (sizes.empty()) {
+      std::cerr << "No multiplies in shape trace " << argv[1] << "\n";
+      return 1;
+    }
+  }
+
   // Find the most occuring problem-size. If tie, find the largest.
   std::unordered_map<ProblemSize, size_t, Hasher, Equals> counter;
-  for (auto &psize : PROBLEM_SIZES) {
+  for (auto &psize : sizes) {
     if (counter.find(psize) == counter.end()) {
       counter[psize] = 0;
     }
     ++counter[psize];
   }
 
-  ProblemSize argmaxP;
+  ProblemSize argmaxP{0, 0, 0};
   size_t maxP = 0;
   for (auto &p : counter) {
     auto num_elem = [](const ProblemSize &p) { return p.M * p.N * p.P; };
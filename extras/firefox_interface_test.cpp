@@ -1,10 +1,87 @@
 #include "matrix.h"
+#include "shape_trace.h"
 #include "wrapped.h"
 #include "gtest/gtest.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Counts heap allocations by interposing glibc's allocator, unless a
+// sanitizer already does.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#define MOZINTGEMM_SANITIZED
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define MOZINTGEMM_SANITIZED
+#endif
+
+#if defined(__GLIBC__) && !defined(MOZINTGEMM_SANITIZED)
+#define MOZINTGEMM_COUNT_ALLOCATIONS
+
+static std::atomic<bool> countingAllocations{false};
+static std::atomic<size_t> allocations{0};
+
+static void countAllocation() {
+  if (countingAllocations.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) noexcept {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+  countAllocation();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  countAllocation();
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept {
+  countAllocation();
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr || size == 0 ? 0 : ENOMEM;
+}
+}
+#endif
 
 namespace {
 
@@ -21,9 +98,9 @@ const float MSE_TOLERANCE = 1e-1;
 // ODR.
 
 #define forwardCallToNamespace(ns, fn)                                         \
-  template <class... Args> static void fn(Args... args) {                      \
+  template <class... Args> static auto fn(Args... args) {                      \
     /*std::cerr << "Calling " << #ns << "::" << #fn << std::endl;*/            \
-    ns::fn(args...);                                                           \
+    return ns::fn(args...);                                                    \
   }
 
 #define namespaceToStructForTemplating(ns)                                     \
@@ -32,9 +109,45 @@ const float MSE_TOLERANCE = 1e-1;
     forwardCallToNamespace(ns, int8PrepareB);                                  \
     forwardCallToNamespace(ns, int8PrepareBias);                               \
     forwardCallToNamespace(ns, int8MultiplyAndAddBias);                        \
+    forwardCallToNamespace(ns, int8MultiplyAddBiasAndLayerNorm);               \
+    forwardCallToNamespace(ns, int8MultiplyAndAddBiasSelected);                \
     forwardCallToNamespace(ns, int8SelectColumnsOfB);                          \
+    forwardCallToNamespace(ns, int8SelectColumnsOfBCached);                    \
+    forwardCallToNamespace(ns, int8SelectionB);                                \
+    forwardCallToNamespace(ns, int8SelectionBias);                             \
+    forwardCallToNamespace(ns, int8ReleaseSelection);                          \
+    forwardCallToNamespace(ns, int8ClearSelectionCache);                       \
+    forwardCallToNamespace(ns, int8GetSelectionCacheStats);                    \
     forwardCallToNamespace(ns, int8PrepareBFromQuantizedTransposed);           \
     forwardCallToNamespace(ns, int8PrepareBFromTransposed);                    \
+    forwardCallToNamespace(ns, int8SetThreadCount);                            \
+    forwardCallToNamespace(ns, int8SetThreadPinning);                          \
+    forwardCallToNamespace(ns, int8BeginSession);                              \
+    forwardCallToNamespace(ns, int8EndSession);                                \
+    forwardCallToNamespace(ns, int8WorkspaceSize);                             \
+    forwardCallToNamespace(ns, int8SetWorkspace);                              \
+    forwardCallToNamespace(ns, int8SetBufferPooling);                          \
+    forwardCallToNamespace(ns, int8AllocatePrepared);                          \
+    forwardCallToNamespace(ns, int8FreePrepared);                              \
+    forwardCallToNamespace(ns, int8AdvisePrepared);                            \
+    forwardCallToNamespace(ns, int8SetExecutor);                               \
+    forwardCallToNamespace(ns, int8SetThreadPriority);                         \
+    forwardCallToNamespace(ns, int8SetCoalescing);                             \
+    forwardCallToNamespace(ns, int8MultiplyAndAddBiasAsync);                   \
+    forwardCallToNamespace(ns, int8PollMultiply);                              \
+    forwardCallToNamespace(ns, int8WaitMultiply);                              \
+    forwardCallToNamespace(ns, int8ReplicateB);                                \
+    forwardCallToNamespace(ns, int8ReleaseReplicas);                           \
+    forwardCallToNamespace(ns, int8GetCoalescingStats);                        \
+    forwardCallToNamespace(ns, int8ResetCoalescingStats);                      \
+    forwardCallToNamespace(ns, int8SetCallStatsTag);                           \
+    forwardCallToNamespace(ns, int8GetCallStats);                              \
+    forwardCallToNamespace(ns, int8ResetCallStats);                            \
+    forwardCallToNamespace(ns, int8FormatCallStats);                           \
+    forwardCallToNamespace(ns, int8StartTrace);                                \
+    forwardCallToNamespace(ns, int8StopTrace);                                 \
+    forwardCallToNamespace(ns, int8StartShapeTrace);                           \
+    forwardCallToNamespace(ns, int8StopShapeTrace);                            \
   }
 
 namespaceToStructForTemplating(Intgemm);
@@ -79,7 +192,8 @@ void run(std::mt19937_64 &gen64,
 // output, applied with an optional scale.
 template <class Lib>
 void MultiplyABAddBias(Matrix<float> &A, Matrix<float> &B, Matrix<float> &bias,
-                       float *output, float output_scale) {
+                       float *output, float output_scale,
+                       bool accumulate = false) {
   Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
   Matrix<float> mBias_prepared(bias.layout());
 
@@ -105,7 +219,7 @@ void MultiplyABAddBias(Matrix<float> &A, Matrix<float> &B, Matrix<float> &bias,
   Lib::int8MultiplyAndAddBias(A_prepared, A.scale(), A.zero_point(), B_prepared,
                               B.scale(), B.zero_point(), bias_prepared,
                               output_scale, A.nrows(), A.ncols(), B.ncols(),
-                              output);
+                              output, accumulate);
 }
 
 TEST(IntgemmVsRuy, NaiveMultiply) {
@@ -144,6 +258,1196 @@ TEST(IntgemmVsRuy, NaiveMultiply) {
   run(gen64, f);
 }
 
+TEST(IntgemmVsRuy, AccumulateMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto f = [&gen64](size_t M, size_t N, size_t P) {
+    auto [A, B, bias] = generateInput(gen64, M, N, P);
+
+    float output_scale = 1.0f;
+    Layout productLayout(M, P, Order::RowMajor);
+
+    // Output already holds a residual, onto which A * B + bias is added.
+    auto residual =
+        make_random_matrix<float>(gen64, productLayout, -1.0f, 1.0f);
+    DEBUG_PRINTABLE(residual);
+
+    Matrix<float> refMul = ReferenceMultiply<float, float>(A, B, bias);
+    std::transform(refMul.begin(), refMul.end(), residual.begin(),
+                   refMul.begin(), std::plus<float>());
+    DEBUG_PRINTABLE(refMul);
+
+    Matrix<float> intgemmProduct(productLayout, residual.data());
+    MultiplyABAddBias<_Intgemm>(A, B, bias, intgemmProduct.data(),
+                                output_scale, /*accumulate=*/true);
+    DEBUG_PRINTABLE(intgemmProduct);
+
+    Matrix<float> ruyProduct(productLayout, residual.data());
+    MultiplyABAddBias<_Ruy>(A, B, bias, ruyProduct.data(), output_scale,
+                            /*accumulate=*/true);
+    DEBUG_PRINTABLE(ruyProduct);
+
+    ASSERT_LT(MeanSquaredError(intgemmProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, intgemmProduct), MSE_TOLERANCE);
+  };
+  run(gen64, f);
+}
+
+// Multiplies every input on lib, with the given number of threads in the pool
+// and one calling thread per input.
+template <class Lib>
+std::vector<Matrix<float>> ConcurrentMultiplies(
+    std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>>
+        &inputs,
+    size_t threads) {
+  Lib::int8SetThreadCount(threads);
+  std::vector<Matrix<float>> outputs;
+  for (auto &[A, B, bias] : inputs) {
+    outputs.emplace_back(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  }
+
+  std::vector<std::thread> callers;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    callers.emplace_back([&inputs, &outputs, i]() {
+      auto &[A, B, bias] = inputs[i];
+      MultiplyABAddBias<Lib>(A, B, bias, outputs[i].data(), 1.0f);
+    });
+  }
+  for (auto &caller : callers) {
+    caller.join();
+  }
+  Lib::int8SetThreadCount(0);
+  return outputs;
+}
+
+TEST(IntgemmVsRuy, ThreadedMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  // Large enough to be split into tiles, which concurrent callers then share
+  // the pool with. Tiling must not change the result.
+  const size_t M = 256, N = 256, P = 512, CALLERS = 4;
+  std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>> inputs;
+  for (size_t i = 0; i < CALLERS; i++) {
+    inputs.push_back(generateInput(gen64, M, N, P));
+  }
+
+  auto ruySerial = ConcurrentMultiplies<_Ruy>(inputs, 1);
+  auto ruyThreaded = ConcurrentMultiplies<_Ruy>(inputs, 4);
+  auto intgemmSerial = ConcurrentMultiplies<_Intgemm>(inputs, 1);
+  auto intgemmThreaded = ConcurrentMultiplies<_Intgemm>(inputs, 4);
+
+  for (size_t i = 0; i < CALLERS; i++) {
+    auto &[A, B, bias] = inputs[i];
+    Matrix<float> refMul = ReferenceMultiply<float, float>(A, B, bias);
+    ASSERT_TRUE(std::equal(ruySerial[i].begin(), ruySerial[i].end(),
+                           ruyThreaded[i].begin()));
+    ASSERT_TRUE(std::equal(intgemmSerial[i].begin(), intgemmSerial[i].end(),
+                           intgemmThreaded[i].begin()));
+    ASSERT_LT(MeanSquaredError(ruyThreaded[i], refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(intgemmThreaded[i], refMul), MSE_TOLERANCE);
+  }
+}
+
+// Multiplies A and B on lib with the given number of threads in the pool.
+template <class Lib>
+Matrix<float> PooledMultiply(Matrix<float> &A, Matrix<float> &B,
+                             Matrix<float> &bias, size_t threads) {
+  Lib::int8SetThreadCount(threads);
+  Matrix<float> output(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  MultiplyABAddBias<Lib>(A, B, bias, output.data(), 1.0f);
+  Lib::int8SetThreadCount(0);
+  return output;
+}
+
+TEST(IntgemmVsRuy, PartitionedMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  // Decoder step shapes: too few rows to split, so the pool splits a wide
+  // output by columns and a narrow one along the shared dimension as well.
+  _Ruy::int8SetThreadCount(8);
+  auto narrow = Ruy::runtime::partition(4, 1536, 256, 8, 8, 64);
+  ASSERT_EQ(narrow.col_tiles, 4);
+  ASSERT_EQ(narrow.depth_tiles, 2);
+  auto wide = Ruy::runtime::partition(2, 256, 7200, 8, 8, 64);
+  ASSERT_EQ(wide.col_tiles, 8);
+  ASSERT_EQ(wide.depth_tiles, 1);
+  auto single = Ruy::runtime::partition(1, 256, 256, 8, 8, 64);
+  ASSERT_EQ(single.size(), 1);
+  _Ruy::int8SetThreadCount(0);
+
+  // Summing the slices of the shared dimension must give the same result as
+  // multiplying it whole.
+  for (auto [M, N, P] : {std::tuple{4, 1536, 256}, std::tuple{2, 256, 7200}}) {
+    auto [A, B, bias] = generateInput(gen64, M, N, P);
+    auto ruySerial = PooledMultiply<_Ruy>(A, B, bias, 1);
+    auto ruyTiled = PooledMultiply<_Ruy>(A, B, bias, 8);
+    auto intgemmSerial = PooledMultiply<_Intgemm>(A, B, bias, 1);
+    auto intgemmTiled = PooledMultiply<_Intgemm>(A, B, bias, 8);
+    ASSERT_TRUE(
+        std::equal(ruySerial.begin(), ruySerial.end(), ruyTiled.begin()));
+    ASSERT_TRUE(std::equal(intgemmSerial.begin(), intgemmSerial.end(),
+                           intgemmTiled.begin()));
+  }
+}
+
+TEST(IntgemmVsRuy, InteractiveBeforeBulk) {
+  using namespace Ruy::runtime;
+  using Ruy::Int8Priority;
+
+  // A single worker, held inside the first bulk tile it picks up until an
+  // interactive multiply has been queued behind the rest of the bulk tiles.
+  // Once let go, it must run an interactive tile before any bulk tile left.
+  // The callers help with their own tiles, so they hold on to the first one
+  // they take until the worker has made its choice.
+  Scheduler pool(2);
+  static thread_local bool caller = false;
+  struct Log {
+    std::atomic<bool> started{false};
+    std::atomic<bool> queued{false};
+    std::atomic<bool> chosen{false};
+    std::mutex mutex;
+    std::vector<Int8Priority> order;
+  } log;
+  auto hold = [](std::atomic<bool> &flag) {
+    while (!flag.load()) {
+      std::this_thread::yield();
+    }
+  };
+  auto record = [&log](Int8Priority priority) {
+    std::lock_guard<std::mutex> lock(log.mutex);
+    log.order.push_back(priority);
+    if (log.order.size() == 2) {
+      log.chosen.store(true);
+    }
+  };
+  auto bulk = [&](size_t) {
+    if (caller) {
+      hold(log.chosen);
+    } else {
+      if (!log.started.exchange(true)) {
+        hold(log.queued);
+      }
+      record(Int8Priority::Bulk);
+    }
+  };
+  auto interactive = [&](size_t) {
+    if (caller) {
+      log.queued.store(true);
+      hold(log.chosen);
+    } else {
+      record(Int8Priority::Interactive);
+    }
+  };
+
+  const size_t BULK = 8;
+  std::thread bulkCaller([&] {
+    caller = true;
+    Ruy::int8SetThreadPriority(Int8Priority::Bulk);
+    pool.run(BULK, bulk);
+  });
+  hold(log.started);
+  std::thread interactiveCaller([&] {
+    caller = true;
+    Ruy::int8SetThreadPriority(Int8Priority::Interactive);
+    pool.run(2, interactive);
+  });
+  bulkCaller.join();
+  interactiveCaller.join();
+
+  std::lock_guard<std::mutex> lock(log.mutex);
+  ASSERT_EQ(log.order[0], Int8Priority::Bulk);
+  ASSERT_EQ(log.order[1], Int8Priority::Interactive);
+}
+
+TEST(IntgemmVsRuy, Sessions) {
+  // Idle workers spin through a session and park once it ends, which shows
+  // in the CPU time of a process that otherwise sleeps.
+  auto idleCpuTime = [] {
+    std::clock_t begin = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return static_cast<double>(std::clock() - begin) / CLOCKS_PER_SEC;
+  };
+  _Ruy::int8BeginSession();
+  {
+    Ruy::runtime::Scheduler pool(2);
+    double spinning = idleCpuTime();
+    _Ruy::int8EndSession();
+    double parked = idleCpuTime();
+    ASSERT_GT(spinning, 0.05);
+    ASSERT_LT(parked, 0.05);
+  }
+
+  // Spinning pays off for back to back multiplies, not after an idle gap.
+  Ruy::runtime::SpinPolicy policy;
+  ASSERT_EQ(policy.budget().count(), 0);
+  for (int64_t now = 1; now <= 64 * 10000; now += 10000) {
+    policy.recordSubmit(now);
+  }
+  ASSERT_GT(policy.budget().count(), 0);
+  policy.recordSubmit(64 * 10000 + 1000000000);
+  policy.recordSubmit(64 * 10000 + 2000000000);
+  ASSERT_EQ(policy.budget().count(), 0);
+
+  // An unmatched end must not leave a session open.
+  policy.endSession();
+  ASSERT_FALSE(policy.inSession());
+  policy.beginSession();
+  ASSERT_TRUE(policy.inSession());
+  policy.endSession();
+  ASSERT_FALSE(policy.inSession());
+}
+
+TEST(IntgemmVsRuy, CpuQuota) {
+  using namespace Ruy::runtime;
+  ASSERT_EQ(parseCpuMax("max 100000"), 0);
+  ASSERT_EQ(parseCpuMax("150000 100000"), 2);
+  ASSERT_EQ(parseCpuMax("50000 100000"), 1);
+
+  // A container with only its own cgroup mounted, /docker/c in the hierarchy,
+  // and a quota of 3 CPUs on it and of 2 on its child cgroup app.
+  const std::string mount = testing::TempDir() + "moz_intgemm_cgroup";
+  ASSERT_EQ(mkdir(mount.c_str(), 0700), 0);
+  ASSERT_EQ(mkdir((mount + "/app").c_str(), 0700), 0);
+  std::ofstream(mount + "/cpu.max") << "300000 100000\n";
+  std::ofstream(mount + "/app/cpu.max") << "200000 100000\n";
+  std::ofstream(mount + "/cpu.cfs_quota_us") << "50000\n";
+  std::ofstream(mount + "/cpu.cfs_period_us") << "100000\n";
+  auto limit = [&mount](const std::string &cgroup, const std::string &type) {
+    std::istringstream cgroups(cgroup + "\n");
+    std::istringstream mountinfo("30 24 0:26 /docker/c " + mount +
+                                 " rw,nosuid - " + type + " cgroup rw,cpu\n");
+    return cgroupCpuLimit(cgroups, mountinfo);
+  };
+  // The cgroup is found relative to the mounted one, and its ancestors up to
+  // that count too. A cgroup that is not below the mounted one, as named
+  // from the root of the hierarchy or from outside of the cgroup namespace,
+  // gets the mounted cgroup's quota.
+  ASSERT_EQ(limit("0::/docker/c/app", "cgroup2"), 2);
+  ASSERT_EQ(limit("0::/docker/c", "cgroup2"), 3);
+  ASSERT_EQ(limit("0::/docker/cc", "cgroup2"), 3);
+  ASSERT_EQ(limit("0::/../../app", "cgroup2"), 3);
+  ASSERT_EQ(limit("4:cpu,cpuacct:/docker/c", "cgroup"), 1);
+  ASSERT_EQ(limit("4:memory:/docker/c", "cgroup"), 0);
+  ASSERT_EQ(limit("0::/docker/c", "cgroup"), 0);
+  for (const char *file : {"/app/cpu.max", "/cpu.max", "/cpu.cfs_quota_us",
+                           "/cpu.cfs_period_us", "/app", ""}) {
+    std::remove((mount + file).c_str());
+  }
+
+  // The quota caps the thread count.
+  ASSERT_EQ(defaultThreadCount(8, 2), 2);
+  ASSERT_EQ(defaultThreadCount(8, 0), 8);
+  ASSERT_EQ(defaultThreadCount(2, 4), 2);
+  ASSERT_EQ(defaultThreadCount(0, 3), 3);
+  ASSERT_GE(defaultThreadCount(), 1);
+}
+
+TEST(IntgemmVsRuy, PinnedWorkers) {
+  using namespace Ruy::runtime;
+  using Ruy::Int8Priority;
+  std::vector<unsigned> cpus = allowedCpus();
+  ASSERT_FALSE(cpus.empty());
+  ASSERT_FALSE(physicalCores().empty());
+
+  // A single worker pinned to the last CPU, which runs a job reporting the
+  // CPUs it may run on. The job is left to the worker rather than waited on,
+  // which would run it on this thread.
+  Scheduler pool(2, {cpus.back()});
+  struct Affinity {
+    std::atomic<bool> done{false};
+    cpu_set_t set;
+  } affinity;
+  Job job(
+      [](const void *closure, size_t) {
+        Affinity &affinity =
+            *static_cast<Affinity *>(const_cast<void *>(closure));
+        CPU_ZERO(&affinity.set);
+        sched_getaffinity(0, sizeof(affinity.set), &affinity.set);
+        affinity.done.store(true);
+      },
+      &affinity, 1, Int8Priority::Interactive);
+  pool.spawn(job);
+  while (!affinity.done.load()) {
+    std::this_thread::yield();
+  }
+  pool.wait(job);
+  ASSERT_EQ(CPU_COUNT(&affinity.set), 1);
+  ASSERT_TRUE(CPU_ISSET(cpus.back(), &affinity.set));
+}
+
+// Multiplies on lib with a workspace set, checking that the results match
+// those without one and, when allocations are counted, that warmed up
+// multiplies allocate nothing.
+template <class Lib> void WorkspaceMultiply() {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  // A decoder step split along the shared dimension (ruy) or by columns
+  // (intgemm), and a larger multiply, with and without accumulating.
+  std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>> inputs;
+  inputs.push_back(generateInput(gen64, 4, 1536, 256));
+  inputs.push_back(generateInput(gen64, 64, 256, 512));
+
+  struct Prepared {
+    Matrix<int8_t> A, B;
+    Matrix<float> bias, output, expected;
+  };
+  std::vector<Prepared> prepared;
+  for (auto &[A, B, bias] : inputs) {
+    Layout productLayout(A.nrows(), B.ncols(), Order::RowMajor);
+    prepared.push_back(Prepared{Matrix<int8_t>(A.layout()),
+                                Matrix<int8_t>(B.layout().transpose()),
+                                Matrix<float>(bias.layout()),
+                                Matrix<float>(productLayout),
+                                Matrix<float>(productLayout)});
+    Prepared &p = prepared.back();
+    Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(),
+                      A.ncols(), p.A.begin());
+    Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(),
+                      B.ncols(), p.B.begin());
+    Lib::int8PrepareBias(p.B.begin(), A.scale(), A.zero_point(), B.scale(),
+                         B.zero_point(), B.nrows(), B.ncols(), bias.data(),
+                         p.bias.begin());
+  }
+
+  auto multiply = [&inputs, &prepared](size_t i, float *output,
+                                       bool accumulate) {
+    auto &[A, B, bias] = inputs[i];
+    Prepared &p = prepared[i];
+    Lib::int8MultiplyAndAddBias(p.A.begin(), A.scale(), A.zero_point(),
+                                p.B.begin(), B.scale(), B.zero_point(),
+                                p.bias.begin(), 1.0f, A.nrows(), A.ncols(),
+                                B.ncols(), output, accumulate);
+  };
+
+  Lib::int8SetThreadCount(8);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    multiply(i, prepared[i].expected.data(), false);
+    multiply(i, prepared[i].expected.data(), true);
+  }
+
+  size_t bytes = Lib::int8WorkspaceSize(64, 1536, 512);
+  std::vector<char> workspace(bytes);
+  Lib::int8SetWorkspace(workspace.data(), bytes);
+
+  // The first round warms up the pool, which keeps its buffers.
+  for (int round = 0; round < 2; round++) {
+#ifdef MOZINTGEMM_COUNT_ALLOCATIONS
+    allocations = 0;
+    countingAllocations = round == 1;
+#endif
+    for (size_t i = 0; i < inputs.size(); i++) {
+      multiply(i, prepared[i].output.data(), false);
+      multiply(i, prepared[i].output.data(), true);
+    }
+#ifdef MOZINTGEMM_COUNT_ALLOCATIONS
+    countingAllocations = false;
+#endif
+  }
+#ifdef MOZINTGEMM_COUNT_ALLOCATIONS
+  ASSERT_EQ(allocations.load(), 0);
+#endif
+
+  Lib::int8SetWorkspace(nullptr, 0);
+  Lib::int8SetThreadCount(0);
+  for (Prepared &p : prepared) {
+    ASSERT_TRUE(
+        std::equal(p.expected.begin(), p.expected.end(), p.output.begin()));
+  }
+}
+
+TEST(IntgemmVsRuy, WorkspaceMultiply) {
+  WorkspaceMultiply<_Ruy>();
+  WorkspaceMultiply<_Intgemm>();
+
+  // Warming up reaches every worker once, whichever tiles they pick up.
+  Ruy::runtime::Scheduler pool(3);
+  std::mutex mutex;
+  std::vector<std::thread::id> threads;
+  pool.broadcast([&mutex, &threads] {
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(std::this_thread::get_id());
+  });
+  ASSERT_EQ(threads.size(), 2);
+  ASSERT_NE(threads[0], threads[1]);
+  ASSERT_NE(threads[0], std::this_thread::get_id());
+  ASSERT_NE(threads[1], std::this_thread::get_id());
+}
+
+TEST(IntgemmVsRuy, BufferPool) {
+  using Pool = Ruy::runtime::BufferPool;
+  ASSERT_EQ(Pool::classBytes(Pool::sizeClass(256)), 256);
+  ASSERT_EQ(Pool::classBytes(Pool::sizeClass(257)), 320);
+  ASSERT_EQ(Pool::classBytes(Pool::sizeClass(256 * 1536)), 256 * 1536);
+  ASSERT_EQ(Pool::sizeClass(size_t{1} << 28), Ruy::runtime::kPoolClasses);
+  const size_t shared = Ruy::runtime::kSharedCacheBytes;
+  ASSERT_EQ(Pool::classBytes(Pool::sizeClass(shared)), shared);
+  ASSERT_EQ(Pool::sizeClass(shared + 1), Ruy::runtime::kPoolClasses);
+
+  // A buffer freed by this thread comes back for the next of its class.
+  Pool &pool = Ruy::runtime::bufferPool();
+  void *buffer = pool.allocate(4 * 7128);
+  pool.free(buffer, 4 * 7128);
+  void *reused = pool.allocate(4 * 7100);
+  ASSERT_EQ(buffer, reused);
+  pool.free(reused, 4 * 7100);
+
+  // Also once handed over by an exiting thread, through the shared cache.
+  // Turning pooling off and on first empties the shared cache and that of
+  // this thread, which earlier tests may have left buffers of the size in.
+  _Ruy::int8SetBufferPooling(false);
+  _Ruy::int8SetBufferPooling(true);
+  const size_t bytes = 11 << 20;
+  std::thread([&pool, &buffer] { buffer = pool.allocate(bytes); }).join();
+  std::thread([&pool, buffer] { pool.free(buffer, bytes); }).join();
+  reused = pool.allocate(bytes);
+  ASSERT_EQ(buffer, reused);
+  pool.free(reused, bytes);
+
+  _Ruy::int8SetBufferPooling(false);
+  buffer = pool.allocate(4096);
+  pool.free(buffer, 4096);
+  _Ruy::int8SetBufferPooling(true);
+}
+
+// Multiplies every A in As with the same B and bias on lib, one calling thread
+// per A, returning the products.
+template <class Lib>
+std::vector<Matrix<float>> SharedBMultiplies(std::vector<Matrix<float>> &As,
+                                             Matrix<float> &B,
+                                             Matrix<float> &bias) {
+  Matrix<int8_t> mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  int8_t *B_prepared = mB_prepared.begin();
+  float *bias_prepared = mBias_prepared.begin();
+
+  // Every A gets the same scale, which the prepared bias depends on.
+  const float scale_A = As.front().scale();
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    B_prepared);
+  Lib::int8PrepareBias(B_prepared, scale_A, 0.0f, B.scale(), B.zero_point(),
+                       B.nrows(), B.ncols(), bias.data(), bias_prepared);
+
+  std::vector<Matrix<float>> outputs;
+  for (auto &A : As) {
+    outputs.emplace_back(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  }
+
+  std::vector<std::thread> callers;
+  for (size_t i = 0; i < As.size(); i++) {
+    callers.emplace_back([&, i]() {
+      Matrix<int8_t> mA_prepared(As[i].layout());
+      Lib::int8PrepareA(As[i].data(), scale_A, 0.0f, As[i].nrows(),
+                        As[i].ncols(), mA_prepared.begin());
+      Lib::int8MultiplyAndAddBias(mA_prepared.begin(), scale_A, 0.0f,
+                                  B_prepared, B.scale(), B.zero_point(),
+                                  bias_prepared, 1.0f, As[i].nrows(),
+                                  As[i].ncols(), B.ncols(), outputs[i].data());
+    });
+  }
+  for (auto &caller : callers) {
+    caller.join();
+  }
+  return outputs;
+}
+
+template <class Lib> void CoalescedMultiplies() {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  const size_t M = 8, N = 256, P = 256, CALLERS = 4;
+  auto [A, B, bias] = generateInput(gen64, M, N, P);
+  std::vector<Matrix<float>> As;
+  for (size_t i = 0; i < CALLERS; i++) {
+    As.push_back(make_random_matrix<float>(gen64, A.layout(), -1.0f, 1.0f));
+  }
+
+  auto separate = SharedBMultiplies<Lib>(As, B, bias);
+
+  // A caller alone with its B does not wait out the window.
+  std::vector<Matrix<float>> lone;
+  lone.push_back(make_random_matrix<float>(gen64, A.layout(), -1.0f, 1.0f));
+  Lib::int8SetCoalescing(/*window_us=*/5000000, /*max_rows=*/CALLERS * M);
+  auto start = std::chrono::steady_clock::now();
+  SharedBMultiplies<Lib>(lone, B, bias);
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+  // The first caller has no one to wait for either, as coalescing was just
+  // configured. The rest arrive within the window of it, so the next one
+  // waits, and the batch starts as soon as the last one joins.
+  Lib::int8SetCoalescing(/*window_us=*/5000000,
+                         /*max_rows=*/(CALLERS - 1) * M);
+  Lib::int8ResetCoalescingStats();
+  auto coalesced = SharedBMultiplies<Lib>(As, B, bias);
+  auto stats = Lib::int8GetCoalescingStats();
+  Lib::int8SetCoalescing(0, 0);
+
+  ASSERT_EQ(stats.calls, CALLERS);
+  ASSERT_EQ(stats.batches, 2);
+  for (size_t i = 0; i < CALLERS; i++) {
+    ASSERT_TRUE(std::equal(separate[i].begin(), separate[i].end(),
+                           coalesced[i].begin()));
+  }
+}
+
+TEST(IntgemmVsRuy, CoalescedMultiply) {
+  CoalescedMultiplies<_Ruy>();
+  CoalescedMultiplies<_Intgemm>();
+}
+
+// Runs the multiplies of every input asynchronously on lib, with the given
+// number of threads in the pool, and checks them against synchronous ones.
+template <class Lib, class Handle>
+void AsyncMultiplies(
+    std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>>
+        &inputs,
+    size_t threads) {
+  std::vector<Matrix<int8_t>> As, Bs;
+  std::vector<Matrix<float>> biases, sync, async;
+  for (auto &[A, B, bias] : inputs) {
+    As.emplace_back(A.layout());
+    Bs.emplace_back(B.layout().transpose());
+    biases.emplace_back(bias.layout());
+    sync.emplace_back(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+    async.emplace_back(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+    Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(),
+                      A.ncols(), As.back().begin());
+    Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(),
+                      B.ncols(), Bs.back().begin());
+    Lib::int8PrepareBias(Bs.back().begin(), A.scale(), A.zero_point(),
+                         B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                         bias.data(), biases.back().begin());
+  }
+
+  Lib::int8SetThreadCount(threads);
+  std::atomic<size_t> completed{0};
+  auto callback = [](void *user_data) {
+    static_cast<std::atomic<size_t> *>(user_data)->fetch_add(1);
+  };
+
+  std::vector<Handle *> handles;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    auto &[A, B, bias] = inputs[i];
+    handles.push_back(Lib::int8MultiplyAndAddBiasAsync(
+        As[i].begin(), A.scale(), A.zero_point(), Bs[i].begin(), B.scale(),
+        B.zero_point(), biases[i].begin(), 1.0f, A.nrows(), A.ncols(),
+        B.ncols(), async[i].data(), false, +callback, &completed));
+  }
+
+  // Meanwhile, the same multiplies synchronously.
+  for (size_t i = 0; i < inputs.size(); i++) {
+    auto &[A, B, bias] = inputs[i];
+    Lib::int8MultiplyAndAddBias(As[i].begin(), A.scale(), A.zero_point(),
+                                Bs[i].begin(), B.scale(), B.zero_point(),
+                                biases[i].begin(), 1.0f, A.nrows(), A.ncols(),
+                                B.ncols(), sync[i].data(), false);
+  }
+
+  for (Handle *handle : handles) {
+    Lib::int8WaitMultiply(handle);
+  }
+  Lib::int8SetThreadCount(0);
+
+  ASSERT_EQ(completed.load(), inputs.size());
+  for (size_t i = 0; i < inputs.size(); i++) {
+    ASSERT_TRUE(
+        std::equal(sync[i].begin(), sync[i].end(), async[i].begin()));
+  }
+}
+
+TEST(IntgemmVsRuy, AsyncMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>> inputs;
+  inputs.push_back(generateInput(gen64, 1, 256, 256));
+  inputs.push_back(generateInput(gen64, 64, 256, 512));
+  inputs.push_back(generateInput(gen64, 256, 512, 256));
+
+  // Without workers the multiplies run inline.
+  for (size_t threads : {1, 3}) {
+    AsyncMultiplies<_Ruy, Ruy::Int8Multiply>(inputs, threads);
+    AsyncMultiplies<_Intgemm, Intgemm::Int8Multiply>(inputs, threads);
+  }
+}
+
+// A host thread pool stand-in, running every parallel_for on fresh threads
+// and every post on a thread joined at destruction.
+struct HostPool {
+  std::atomic<size_t> parallel_fors{0};
+  std::atomic<size_t> posts{0};
+  std::mutex mutex;
+  std::vector<std::thread> posted;
+
+  ~HostPool() {
+    for (auto &thread : posted) {
+      thread.join();
+    }
+  }
+
+  template <class Priority>
+  static void parallelFor(void *user_data, size_t count,
+                          void (*run)(void *context, size_t index),
+                          void *context, Priority) {
+    static_cast<HostPool *>(user_data)->parallel_fors++;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 3; t++) {
+      threads.emplace_back([=]() {
+        for (size_t i = t; i < count; i += 3) {
+          run(context, i);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  template <class Priority>
+  static void post(void *user_data, void (*run)(void *context), void *context,
+                   Priority) {
+    HostPool *pool = static_cast<HostPool *>(user_data);
+    pool->posts++;
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->posted.emplace_back(run, context);
+  }
+};
+
+template <class Lib, class Executor, class Priority, class Handle>
+void HostExecutor() {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  std::vector<std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>> inputs;
+  inputs.push_back(generateInput(gen64, 256, 256, 512));
+
+  // Split into tiles, but with a single thread in the internal pool.
+  auto internal = ConcurrentMultiplies<Lib>(inputs, 1);
+
+  HostPool pool;
+  Executor executor{HostPool::parallelFor<Priority>, HostPool::post<Priority>,
+                    3, &pool};
+  Lib::int8SetExecutor(&executor);
+  auto host = ConcurrentMultiplies<Lib>(inputs, 0);
+  AsyncMultiplies<Lib, Handle>(inputs, 0);
+  Lib::int8SetExecutor(nullptr);
+
+  ASSERT_GT(pool.parallel_fors.load(), 0);
+  ASSERT_GT(pool.posts.load(), 0);
+  ASSERT_TRUE(std::equal(internal[0].begin(), internal[0].end(),
+                         host[0].begin()));
+}
+
+TEST(IntgemmVsRuy, HostExecutorMultiply) {
+  HostExecutor<_Ruy, Ruy::Int8Executor, Ruy::Int8Priority,
+               Ruy::Int8Multiply>();
+  HostExecutor<_Intgemm, Intgemm::Int8Executor, Intgemm::Int8Priority,
+               Intgemm::Int8Multiply>();
+}
+
+template <class Lib> void ReplicatedMultiply() {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto [A, B, bias] = generateInput(gen64, 64, 256, 512);
+
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    mA_prepared.begin());
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    mB_prepared.begin());
+  Lib::int8PrepareBias(mB_prepared.begin(), A.scale(), A.zero_point(),
+                       B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                       bias.data(), mBias_prepared.begin());
+
+  Layout productLayout(A.nrows(), B.ncols(), Order::RowMajor);
+  Matrix<float> direct(productLayout), replicated(productLayout);
+  Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                              mB_prepared.begin(), B.scale(), B.zero_point(),
+                              mBias_prepared.begin(), 1.0f, A.nrows(),
+                              A.ncols(), B.ncols(), direct.data(), false);
+
+  // Single node machines have nothing to replicate, either way the result
+  // must be the same.
+  bool replicas =
+      Lib::int8ReplicateB(mB_prepared.begin(), B.nrows(), B.ncols());
+  DEBUG_PRINTABLE(replicas);
+  Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                              mB_prepared.begin(), B.scale(), B.zero_point(),
+                              mBias_prepared.begin(), 1.0f, A.nrows(),
+                              A.ncols(), B.ncols(), replicated.data(), false);
+  Lib::int8ReleaseReplicas(mB_prepared.begin());
+
+  ASSERT_TRUE(std::equal(direct.begin(), direct.end(), replicated.begin()));
+}
+
+TEST(IntgemmVsRuy, ReplicatedMultiply) {
+  ReplicatedMultiply<_Ruy>();
+  ReplicatedMultiply<_Intgemm>();
+
+#ifdef __linux__
+  std::vector<unsigned> nodes = Ruy::runtime::parseList("0-1,3");
+  ASSERT_EQ(nodes, std::vector<unsigned>({0, 1, 3}));
+#endif
+}
+
+template <class Lib> void PreparedMemoryMultiply(uint32_t options) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto [A, B, bias] = generateInput(gen64, 64, 256, 512);
+
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    mA_prepared.begin());
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    mB_prepared.begin());
+
+  uint32_t applied = ~0u;
+  size_t bytes = B.nrows() * B.ncols();
+  auto *B_prepared = static_cast<int8_t *>(
+      Lib::int8AllocatePrepared(bytes, options, &applied));
+  ASSERT_NE(B_prepared, nullptr);
+  DEBUG_PRINTABLE(applied);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(B_prepared) % 64, 0);
+  ASSERT_EQ(applied & ~options, 0);
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    B_prepared);
+  ASSERT_TRUE(std::equal(mB_prepared.begin(), mB_prepared.end(), B_prepared));
+  Lib::int8PrepareBias(B_prepared, A.scale(), A.zero_point(), B.scale(),
+                       B.zero_point(), B.nrows(), B.ncols(), bias.data(),
+                       mBias_prepared.begin());
+
+  Layout productLayout(A.nrows(), B.ncols(), Order::RowMajor);
+  Matrix<float> direct(productLayout), prepared(productLayout);
+  Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                              mB_prepared.begin(), B.scale(), B.zero_point(),
+                              mBias_prepared.begin(), 1.0f, A.nrows(),
+                              A.ncols(), B.ncols(), direct.data(), false);
+  Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                              B_prepared, B.scale(), B.zero_point(),
+                              mBias_prepared.begin(), 1.0f, A.nrows(),
+                              A.ncols(), B.ncols(), prepared.data(), false);
+  Lib::int8FreePrepared(B_prepared);
+
+  ASSERT_TRUE(std::equal(direct.begin(), direct.end(), prepared.begin()));
+}
+
+TEST(IntgemmVsRuy, PreparedMemoryMultiply) {
+  using RuyOptions = Ruy::Int8MemoryOptions;
+  uint32_t all = RuyOptions::Int8HugePages | RuyOptions::Int8ReservedHugePages |
+                 RuyOptions::Int8LockedPages;
+  for (uint32_t options : {0u, uint32_t{RuyOptions::Int8HugePages}, all}) {
+    PreparedMemoryMultiply<_Ruy>(options);
+    PreparedMemoryMultiply<_Intgemm>(options);
+  }
+
+  // Memory the caller mapped, only huge and locked pages can apply.
+  Matrix<int8_t> weights(Layout(256, 512, Order::RowMajor));
+  size_t bytes = weights.end() - weights.begin();
+  uint32_t applied = _Ruy::int8AdvisePrepared(weights.begin(), bytes, all);
+  uint32_t advisable = RuyOptions::Int8HugePages | RuyOptions::Int8LockedPages;
+  ASSERT_EQ(applied & ~advisable, 0);
+#ifdef __linux__
+  if (applied & RuyOptions::Int8LockedPages) {
+    munlock(weights.begin(), bytes);
+  }
+#endif
+  // Nothing to free for pointers that were not allocated here.
+  _Ruy::int8FreePrepared(weights.begin());
+}
+
+template <class Lib, class CallStats, class Phase> void RecordedMultiply() {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto [A, B, bias] = generateInput(gen64, 16, 256, 512);
+
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  Matrix<float> output(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    mB_prepared.begin());
+  Lib::int8PrepareBias(mB_prepared.begin(), A.scale(), A.zero_point(),
+                       B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                       bias.data(), mBias_prepared.begin());
+
+  Lib::int8ResetCallStats();
+  Lib::int8SetCallStatsTag("decoder.ffn");
+  for (int i = 0; i < 3; ++i) {
+    Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(),
+                      A.ncols(), mA_prepared.begin());
+    Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(),
+                                A.zero_point(), mB_prepared.begin(), B.scale(),
+                                B.zero_point(), mBias_prepared.begin(), 1.0f,
+                                A.nrows(), A.ncols(), B.ncols(), output.data(),
+                                false);
+  }
+  Lib::int8SetCallStatsTag(nullptr);
+
+  std::vector<CallStats> stats(Lib::int8GetCallStats(nullptr, 0));
+  Lib::int8GetCallStats(stats.data(), stats.size(), /*reset=*/true);
+#ifndef MOZINTGEMM_STATS
+  // Compiled out, nothing is recorded.
+  ASSERT_TRUE(stats.empty());
+#else
+  using Operation = decltype(CallStats::operation);
+  auto find = [&](Operation operation) -> const CallStats * {
+    for (const CallStats &entry : stats) {
+      if (entry.operation == operation && entry.calls != 0 &&
+          std::string(entry.tag) == "decoder.ffn") {
+        return &entry;
+      }
+    }
+    return nullptr;
+  };
+  auto phase = [](const CallStats *entry, Phase phase) {
+    return entry->phases[static_cast<size_t>(phase)];
+  };
+
+  const CallStats *prepare = find(Operation::PrepareA);
+  ASSERT_NE(prepare, nullptr);
+  ASSERT_EQ(prepare->calls, 3);
+  ASSERT_EQ(prepare->rows_A, A.nrows());
+  ASSERT_EQ(prepare->cols_B, 0);
+  ASSERT_EQ(phase(prepare, Phase::Quantize).runs, 3);
+  ASSERT_EQ(phase(prepare, Phase::Quantize).bytes, 3 * 5 * A.nrows() * 256);
+
+  const CallStats *multiply = find(Operation::MultiplyAndAddBias);
+  ASSERT_NE(multiply, nullptr);
+  ASSERT_EQ(multiply->calls, 3);
+  ASSERT_EQ(multiply->width, 256);
+  ASSERT_EQ(multiply->cols_B, 512);
+  ASSERT_GT(multiply->nanoseconds, 0);
+  ASSERT_GE(phase(multiply, Phase::Kernel).runs, 3);
+  ASSERT_GT(phase(multiply, Phase::Kernel).bytes, 0);
+  ASSERT_LE(phase(multiply, Phase::Kernel).nanoseconds,
+            multiply->nanoseconds * 64);
+
+  // Read with reset, so there is nothing left.
+  CallStats again;
+  Lib::int8GetCallStats(&again, 1);
+  ASSERT_EQ(again.calls, 0);
+  ASSERT_EQ(phase(&again, Phase::Quantize).runs, 0);
+#endif
+}
+
+TEST(IntgemmVsRuy, CallStats) {
+  RecordedMultiply<_Ruy, Ruy::Int8CallStats, Ruy::Int8Phase>();
+  RecordedMultiply<_Intgemm, Intgemm::Int8CallStats, Intgemm::Int8Phase>();
+
+  using Ruy::Int8CallStats;
+  using Ruy::Int8Operation;
+  using Ruy::Int8StatsFormat;
+  Int8CallStats entry{};
+  entry.tag = "layer \"0\"\t";
+  entry.operation = Int8Operation::MultiplyAndAddBias;
+  entry.rows_A = 4;
+  entry.width = 256;
+  entry.cols_B = 512;
+  entry.calls = 2;
+  entry.nanoseconds = 1500;
+  entry.phases[static_cast<size_t>(Ruy::Int8Phase::Kernel)] = {2, 1000, 4096};
+
+  auto format = [&](Int8StatsFormat stats_format) {
+    size_t length = _Ruy::int8FormatCallStats(&entry, 1, stats_format, nullptr,
+                                              0);
+    std::string text(length, '\0');
+    _Ruy::int8FormatCallStats(&entry, 1, stats_format, &text[0], length + 1);
+    return text;
+  };
+  std::string prometheus = format(Int8StatsFormat::Prometheus);
+  DEBUG_PRINTABLE(prometheus);
+  const std::string labels =
+      "{tag=\"layer \\\"0\\\"\t\",operation=\"multiply_and_add_bias\","
+      "rows_A=\"4\",width=\"256\",cols_B=\"512\"";
+  ASSERT_NE(prometheus.find("# TYPE mozintgemm_calls_total counter\n"
+                            "mozintgemm_calls_total" +
+                            labels + "} 2\n"),
+            std::string::npos);
+  ASSERT_NE(prometheus.find("mozintgemm_call_seconds_total" + labels +
+                            "} 0.000001500\n"),
+            std::string::npos);
+  ASSERT_NE(prometheus.find("mozintgemm_phase_bytes_total" + labels +
+                            ",phase=\"kernel\"} 4096\n"),
+            std::string::npos);
+  ASSERT_EQ(prometheus.find("phase=\"quantize\""), std::string::npos);
+
+  std::string json = format(Int8StatsFormat::Json);
+  DEBUG_PRINTABLE(json);
+  ASSERT_EQ(json, "[\n{\"tag\":\"layer \\\"0\\\"\\u0009\","
+                  "\"operation\":\"multiply_and_add_bias\",\"rows_A\":4,"
+                  "\"width\":256,\"cols_B\":512,\"calls\":2,"
+                  "\"nanoseconds\":1500,\"phases\":{\"kernel\":{\"runs\":2,"
+                  "\"nanoseconds\":1000,\"bytes\":4096}}}\n]\n");
+
+  // Truncated like snprintf.
+  char buffer[8];
+  ASSERT_EQ(_Ruy::int8FormatCallStats(&entry, 1, Int8StatsFormat::Json,
+                                      buffer, sizeof(buffer)),
+            json.size());
+  ASSERT_EQ(std::string(buffer), json.substr(0, 7));
+  ASSERT_EQ(_Ruy::int8FormatCallStats(nullptr, 0, Int8StatsFormat::Json,
+                                      buffer, sizeof(buffer)),
+            3);
+  ASSERT_EQ(std::string(buffer), "[]\n");
+}
+
+template <class Lib> void TracedMultiply(const std::string &path) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto [A, B, bias] = generateInput(gen64, 8, 256, 512);
+
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  Matrix<float> output(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    mB_prepared.begin());
+  Lib::int8PrepareBias(mB_prepared.begin(), A.scale(), A.zero_point(),
+                       B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                       bias.data(), mBias_prepared.begin());
+
+  ASSERT_TRUE(Lib::int8StartTrace(path.c_str()));
+  ASSERT_FALSE(Lib::int8StartTrace(path.c_str()));
+
+  Lib::int8SetThreadCount(4);
+  Lib::int8SetCallStatsTag("encoder.0");
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    mA_prepared.begin());
+  Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                              mB_prepared.begin(), B.scale(), B.zero_point(),
+                              mBias_prepared.begin(), 1.0f, A.nrows(),
+                              A.ncols(), B.ncols(), output.data(), false);
+  Lib::int8SetCallStatsTag(nullptr);
+  ASSERT_EQ(Lib::int8StopTrace(), 0);
+  Lib::int8SetThreadCount(0);
+
+  std::ifstream file(path);
+  std::string trace((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  DEBUG_PRINTABLE(trace);
+  ASSERT_EQ(trace.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", 0),
+            0);
+  ASSERT_EQ(trace.substr(trace.size() - 4), "\n]}\n");
+  ASSERT_NE(trace.find("{\"name\":\"prepare_a\",\"cat\":\"call\""),
+            std::string::npos);
+  ASSERT_NE(trace.find("{\"name\":\"multiply_and_add_bias\",\"cat\":\"call\""),
+            std::string::npos);
+  ASSERT_NE(trace.find("\"args\":{\"tag\":\"encoder.0\",\"rows_A\":8,"
+                       "\"width\":256,\"cols_B\":512}}"),
+            std::string::npos);
+  ASSERT_NE(trace.find("{\"name\":\"kernel\",\"cat\":\"phase\""),
+            std::string::npos);
+  ASSERT_NE(trace.find("{\"name\":\"thread_name\",\"ph\":\"M\""),
+            std::string::npos);
+
+  // An event per line, separated by commas.
+  std::istringstream lines(trace);
+  std::string line;
+  std::getline(lines, line);
+  size_t events = 0;
+  while (std::getline(lines, line) && line != "]}") {
+    ASSERT_EQ(line.front(), '{');
+    ASSERT_EQ(line.back(), lines.peek() == ']' ? '}' : ',');
+    ++events;
+  }
+  ASSERT_GE(events, 4);
+}
+
+TEST(IntgemmVsRuy, TracedMultiply) {
+  const std::string path = testing::TempDir() + "moz_intgemm_trace.json";
+  TracedMultiply<_Ruy>(path);
+  TracedMultiply<_Intgemm>(path);
+  std::remove(path.c_str());
+}
+
+template <class Lib, class Format>
+void RecordedShapes(const std::string &path, Format format) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto [A, B, bias] = generateInput(gen64, 8, 256, 512);
+
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+  Matrix<float> output(Layout(A.nrows(), B.ncols(), Order::RowMajor));
+  auto multiply = [&] {
+    Lib::int8MultiplyAndAddBias(mA_prepared.begin(), A.scale(), A.zero_point(),
+                                mB_prepared.begin(), B.scale(), B.zero_point(),
+                                mBias_prepared.begin(), 1.0f, A.nrows(),
+                                A.ncols(), B.ncols(), output.data(), false);
+  };
+
+  ASSERT_TRUE(Lib::int8StartShapeTrace(path.c_str(), format));
+  ASSERT_FALSE(Lib::int8StartShapeTrace(path.c_str(), format));
+  Lib::int8SetThreadCount(4);
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    mB_prepared.begin());
+  Lib::int8PrepareBias(mB_prepared.begin(), A.scale(), A.zero_point(),
+                       B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                       bias.data(), mBias_prepared.begin());
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    mA_prepared.begin());
+  multiply();
+  std::thread(multiply).join();
+  ASSERT_EQ(Lib::int8StopShapeTrace(), 0);
+  Lib::int8SetThreadCount(0);
+
+  // Calls after the trace stopped are not recorded.
+  multiply();
+
+  std::vector<ShapeTraceRecord> records;
+  ASSERT_TRUE(loadShapeTrace(path, records));
+  ASSERT_EQ(records.size(), 5);
+  const uint32_t operations[] = {1, 2, 0, 4, 4};
+  const uint32_t shapes[][3] = {
+      {0, 256, 512}, {0, 256, 512}, {8, 256, 0}, {8, 256, 512}, {8, 256, 512}};
+  for (size_t i = 0; i < records.size(); ++i) {
+    ASSERT_EQ(records[i].operation, operations[i]);
+    ASSERT_EQ(records[i].rows_A, shapes[i][0]);
+    ASSERT_EQ(records[i].width, shapes[i][1]);
+    ASSERT_EQ(records[i].cols_B, shapes[i][2]);
+  }
+  ASSERT_EQ(records[3].thread, records[0].thread);
+  ASSERT_NE(records[4].thread, records[0].thread);
+  ASSERT_LE(records[3].timestamp_ns, records[4].timestamp_ns);
+
+  std::vector<ProblemSize> sizes = multiplyProblemSizes(records);
+  ASSERT_EQ(sizes.size(), 2);
+  ASSERT_EQ(sizes[0].M, 8);
+  ASSERT_EQ(sizes[0].N, 256);
+  ASSERT_EQ(sizes[0].P, 512);
+}
+
+TEST(IntgemmVsRuy, ShapeTrace) {
+  const std::string path = testing::TempDir() + "moz_intgemm_shapes";
+  RecordedShapes<_Ruy>(path, Ruy::Int8ShapeTraceFormat::Csv);
+  RecordedShapes<_Ruy>(path, Ruy::Int8ShapeTraceFormat::Binary);
+  RecordedShapes<_Intgemm>(path, Intgemm::Int8ShapeTraceFormat::Csv);
+  RecordedShapes<_Intgemm>(path, Intgemm::Int8ShapeTraceFormat::Binary);
+
+  // Neither format, or cut short.
+  std::ofstream(path) << "rows,cols\n1,2\n";
+  std::vector<ShapeTraceRecord> records;
+  ASSERT_FALSE(loadShapeTrace(path, records));
+  std::ofstream(path) << "MOZSHA";
+  ASSERT_FALSE(loadShapeTrace(path, records));
+  std::remove(path.c_str());
+
+  // Multiplies with layer normalization or of selected columns are replayed
+  // as multiplies too, column selections are not.
+  records = {{0, 0, 5, 8, 256, 512},
+             {1, 0, 6, 8, 256, 16},
+             {2, 0, 3, 0, 256, 16}};
+  std::vector<ProblemSize> sizes = multiplyProblemSizes(records);
+  ASSERT_EQ(sizes.size(), 2);
+  ASSERT_EQ(sizes[1].P, 16);
+}
+
+template <class Lib>
+void MultiplyABAddBiasAndLayerNorm(Matrix<float> &A, Matrix<float> &B,
+                                   Matrix<float> &bias, Matrix<float> &residual,
+                                   Matrix<float> &gamma, Matrix<float> &beta,
+                                   float epsilon, float *output,
+                                   float output_scale) {
+  Matrix<int8_t> mA_prepared(A.layout()), mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+
+  int8_t *A_prepared = mA_prepared.begin();
+  int8_t *B_prepared = mB_prepared.begin();
+  float *bias_prepared = mBias_prepared.begin();
+
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    B_prepared);
+
+  Lib::int8PrepareBias(B_prepared, A.scale(), A.zero_point(), B.scale(),
+                       B.zero_point(), B.nrows(), B.ncols(), bias.data(),
+                       bias_prepared);
+
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    A_prepared);
+
+  Lib::int8MultiplyAddBiasAndLayerNorm(
+      A_prepared, A.scale(), A.zero_point(), B_prepared, B.scale(),
+      B.zero_point(), bias_prepared, output_scale, residual.data(),
+      gamma.data(), beta.data(), epsilon, A.nrows(), A.ncols(), B.ncols(),
+      output);
+}
+
+// Layer-normalizes each row of input + residual, in place on input.
+void ReferenceResidualLayerNorm(Matrix<float> &input,
+                                const Matrix<float> &residual,
+                                const Matrix<float> &gamma,
+                                const Matrix<float> &beta, float epsilon) {
+  for (size_t i = 0; i < input.nrows(); i++) {
+    float mean = 0.0f;
+    for (size_t j = 0; j < input.ncols(); j++) {
+      input.at(i, j) += residual.at(i, j);
+      mean += input.at(i, j);
+    }
+    mean /= input.ncols();
+
+    float variance = 0.0f;
+    for (size_t j = 0; j < input.ncols(); j++) {
+      float diff = input.at(i, j) - mean;
+      variance += diff * diff;
+    }
+    variance /= input.ncols();
+
+    for (size_t j = 0; j < input.ncols(); j++) {
+      input.at(i, j) = (input.at(i, j) - mean) / std::sqrt(variance + epsilon) *
+                           gamma.at(0, j) +
+                       beta.at(0, j);
+    }
+  }
+}
+
+TEST(IntgemmVsRuy, LayerNormMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto f = [&gen64](size_t M, size_t N, size_t P) {
+    auto [A, B, bias] = generateInput(gen64, M, N, P);
+
+    float output_scale = 1.0f;
+    const float epsilon = 1e-6f;
+    Layout productLayout(M, P, Order::RowMajor);
+    Layout vectorLayout(1, P, Order::RowMajor);
+
+    auto residual =
+        make_random_matrix<float>(gen64, productLayout, -1.0f, 1.0f);
+    auto gamma = make_random_matrix<float>(gen64, vectorLayout, 0.5f, 1.5f);
+    auto beta = make_random_matrix<float>(gen64, vectorLayout, -1.0f, 1.0f);
+
+    Matrix<float> refMul = ReferenceMultiply<float, float>(A, B, bias);
+    ReferenceResidualLayerNorm(refMul, residual, gamma, beta, epsilon);
+    DEBUG_PRINTABLE(refMul);
+
+    Matrix<float> intgemmProduct(productLayout);
+    MultiplyABAddBiasAndLayerNorm<_Intgemm>(A, B, bias, residual, gamma, beta,
+                                            epsilon, intgemmProduct.data(),
+                                            output_scale);
+    DEBUG_PRINTABLE(intgemmProduct);
+
+    Matrix<float> ruyProduct(productLayout);
+    MultiplyABAddBiasAndLayerNorm<_Ruy>(A, B, bias, residual, gamma, beta,
+                                        epsilon, ruyProduct.data(),
+                                        output_scale);
+    DEBUG_PRINTABLE(ruyProduct);
+
+    // The residual is also allowed to live in output.
+    Matrix<float> inPlaceProduct(productLayout, residual.data());
+    MultiplyABAddBiasAndLayerNorm<_Ruy>(A, B, bias, inPlaceProduct, gamma, beta,
+                                        epsilon, inPlaceProduct.data(),
+                                        output_scale);
+
+    ASSERT_LT(MeanSquaredError(intgemmProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, intgemmProduct), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(inPlaceProduct, ruyProduct), MSE_TOLERANCE);
+  };
+  run(gen64, f);
+}
+
 template <class Lib>
 void MulABAddBiasWithSelect(Matrix<float> &A, Matrix<float> &B,
                             Matrix<float> &bias, Index *cols_begin,
@@ -253,6 +1557,172 @@ TEST(IntgemmVsRuy, SelectedMultiply) {
   run(gen64, f);
 }
 
+template <class Lib>
+void MulABAddBiasWithCachedSelect(Matrix<float> &A, Matrix<float> &B,
+                                  Matrix<float> &bias, Index *cols_begin,
+                                  Index num_cols, float *output,
+                                  float output_scale) {
+  Matrix<int8_t> mA_prepared(A.layout());
+  Matrix<int8_t> mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+
+  int8_t *A_prepared = mA_prepared.begin();
+  int8_t *B_prepared = mB_prepared.begin();
+  float *bias_prepared = mBias_prepared.begin();
+
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    B_prepared);
+
+  Lib::int8PrepareBias(B_prepared, A.scale(), A.zero_point(), B.scale(),
+                       B.zero_point(), B.nrows(), B.ncols(), bias.data(),
+                       bias_prepared);
+
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    A_prepared);
+
+  // The first select misses, the second (same columns) hits.
+  auto before = Lib::int8GetSelectionCacheStats();
+  auto selection =
+      Lib::int8SelectColumnsOfBCached(B_prepared, bias_prepared, B.nrows(),
+                                      B.ncols(), cols_begin, num_cols);
+  auto reselection =
+      Lib::int8SelectColumnsOfBCached(B_prepared, bias_prepared, B.nrows(),
+                                      B.ncols(), cols_begin, num_cols);
+  auto after = Lib::int8GetSelectionCacheStats();
+  ASSERT_EQ(after.misses - before.misses, 1);
+  ASSERT_EQ(after.hits - before.hits, 1);
+  ASSERT_EQ(Lib::int8SelectionB(selection), Lib::int8SelectionB(reselection));
+
+  Lib::int8MultiplyAndAddBias(
+      A_prepared, A.scale(), A.zero_point(), Lib::int8SelectionB(reselection),
+      B.scale(), B.zero_point(), Lib::int8SelectionBias(reselection),
+      output_scale, A.nrows(), A.ncols(), num_cols, output);
+
+  Lib::int8ReleaseSelection(selection);
+  Lib::int8ReleaseSelection(reselection);
+
+  // B_prepared is about to be freed, selections from it must not outlive it.
+  Lib::int8ClearSelectionCache();
+}
+
+TEST(IntgemmVsRuy, SelectedCachedMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto f = [&gen64](size_t M, size_t N, size_t P) -> void {
+    auto [A, B, bias] = generateInput(gen64, M, N, P);
+
+    std::vector<Index> cols(B.ncols());
+    std::iota(cols.begin(), cols.end(), 0);
+    std::shuffle(cols.begin(), cols.end(), gen64);
+    const int width = 8;
+    std::uniform_int_distribution<> dist(width, cols.size());
+    Index cutoff = dist(gen64);
+    if (cutoff % width != 0) {
+      cutoff = static_cast<Index>(cutoff / width) * width;
+    }
+
+    float output_scale = 1.0f;
+    Layout productLayout(M, cutoff, Order::RowMajor);
+
+    Matrix<float> selectedB = index_select(B, cols.data(), cutoff);
+    Matrix<float> selectedBias = index_select(bias, cols.data(), cutoff);
+    auto refMul = ReferenceMultiply<float, float>(A, selectedB, selectedBias);
+
+    Matrix<float> ruyProduct(productLayout);
+    MulABAddBiasWithCachedSelect<_Ruy>(A, B, bias, cols.data(), cutoff,
+                                       ruyProduct.data(), output_scale);
+    DEBUG_PRINTABLE(ruyProduct);
+
+    Matrix<float> intgemmProduct(productLayout);
+    MulABAddBiasWithCachedSelect<_Intgemm>(A, B, bias, cols.data(), cutoff,
+                                           intgemmProduct.data(),
+                                           output_scale);
+    DEBUG_PRINTABLE(intgemmProduct);
+
+    ASSERT_LT(MeanSquaredError(ruyProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(intgemmProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, intgemmProduct), MSE_TOLERANCE);
+  };
+  run(gen64, f);
+}
+
+template <class Lib>
+void MulABAddBiasSelected(Matrix<float> &A, Matrix<float> &B,
+                          Matrix<float> &bias, Index *cols_begin,
+                          Index num_cols, float *output, float output_scale) {
+  Matrix<int8_t> mA_prepared(A.layout());
+  Matrix<int8_t> mB_prepared(B.layout().transpose());
+  Matrix<float> mBias_prepared(bias.layout());
+
+  int8_t *A_prepared = mA_prepared.begin();
+  int8_t *B_prepared = mB_prepared.begin();
+  float *bias_prepared = mBias_prepared.begin();
+
+  Lib::int8PrepareB(B.data(), B.scale(), B.zero_point(), B.nrows(), B.ncols(),
+                    B_prepared);
+
+  Lib::int8PrepareBias(B_prepared, A.scale(), A.zero_point(), B.scale(),
+                       B.zero_point(), B.nrows(), B.ncols(), bias.data(),
+                       bias_prepared);
+
+  Lib::int8PrepareA(A.data(), A.scale(), A.zero_point(), A.nrows(), A.ncols(),
+                    A_prepared);
+
+  // Select happens inside the multiply, no selected B or bias is prepared.
+  Lib::int8MultiplyAndAddBiasSelected(
+      A_prepared, A.scale(), A.zero_point(), B_prepared, B.scale(),
+      B.zero_point(), bias_prepared, output_scale, A.nrows(), A.ncols(),
+      B.ncols(), cols_begin, num_cols, output);
+}
+
+TEST(IntgemmVsRuy, SelectedFusedMultiply) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  auto f = [&gen64](size_t M, size_t N, size_t P) -> void {
+    auto [A, B, bias] = generateInput(gen64, M, N, P);
+
+    // Choose columns, in arbitrary order.
+    std::vector<Index> cols(B.ncols());
+    std::iota(cols.begin(), cols.end(), 0);
+    std::shuffle(cols.begin(), cols.end(), gen64);
+    const int width = 8;
+    std::uniform_int_distribution<> dist(width, cols.size());
+    Index cutoff = dist(gen64);
+    if (cutoff % width != 0) {
+      cutoff = static_cast<Index>(cutoff / width) * width;
+    }
+
+    float output_scale = 1.0f;
+    Layout productLayout(M, cutoff, Order::RowMajor);
+
+    Matrix<float> selectedB = index_select(B, cols.data(), cutoff);
+    Matrix<float> selectedBias = index_select(bias, cols.data(), cutoff);
+    auto refMul = ReferenceMultiply<float, float>(A, selectedB, selectedBias);
+    DEBUG_PRINTABLE(refMul);
+
+    Matrix<float> ruyProduct(productLayout);
+    MulABAddBiasSelected<_Ruy>(A, B, bias, cols.data(), cutoff,
+                               ruyProduct.data(), output_scale);
+    DEBUG_PRINTABLE(ruyProduct);
+
+    Matrix<float> intgemmProduct(productLayout);
+    MulABAddBiasSelected<_Intgemm>(A, B, bias, cols.data(), cutoff,
+                                   intgemmProduct.data(), output_scale);
+    DEBUG_PRINTABLE(intgemmProduct);
+
+    // Same as selecting first, then multiplying.
+    Matrix<float> ruySelectThenMultiply(productLayout);
+    MulABAddBiasWithSelect<_Ruy>(A, B, bias, cols.data(), cutoff,
+                                 ruySelectThenMultiply.data(), output_scale);
+
+    ASSERT_LT(MeanSquaredError(ruyProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(intgemmProduct, refMul), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, intgemmProduct), MSE_TOLERANCE);
+    ASSERT_LT(MeanSquaredError(ruyProduct, ruySelectThenMultiply), 1e-9);
+  };
+  run(gen64, f);
+}
+
 template <class Lib>
 void MultiplyAPreparedBQuantizedTransposedAddBias(
     Matrix<float> &A, Matrix<int8_t> &B_prepared_quantized_transposed,
@@ -0,0 +1,439 @@
+#include "benchmark/benchmark.h"
+#include "generated.h"
+#include "matrix.h"
+#include "perf_counters.h"
+#include "wrapped.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Google Benchmark suite of the interface. Every interface function runs for
+// every distinct shape of generated.h it takes, through each backend and with
+// each library thread count, and the Preprocess routines the ruy backend is
+// built from run for each path at the same shapes. Benchmarks are named
+//   <function>/<backend>/<rows_A>x<width>x<cols_B>/threads:<threads>
+//   Preprocess<path>::<routine>/<shape>
+// so that --benchmark_filter can pick a slice, and report GOPS and GB/s as ops
+// and bytes per second counters. Use --benchmark_format=json or
+// --benchmark_out=<file> for machine-readable results, and --perf_counters for
+// the hardware events of perf_counters.h next to the times.
+
+namespace {
+
+using namespace pg;
+
+// See firefox_interface_benchmark.cpp.
+#define forwardCallToNamespace(ns, fn)                                         \
+  template <class... Args> static void fn(Args... args) { ns::fn(args...); }
+
+#define namespaceToStructForTemplating(ns)                                     \
+  struct _##ns {                                                               \
+    forwardCallToNamespace(ns, int8PrepareA);                                  \
+    forwardCallToNamespace(ns, int8PrepareB);                                  \
+    forwardCallToNamespace(ns, int8PrepareBFromTransposed);                    \
+    forwardCallToNamespace(ns, int8PrepareBFromQuantizedTransposed);           \
+    forwardCallToNamespace(ns, int8PrepareBias);                               \
+    forwardCallToNamespace(ns, int8SelectColumnsOfB);                          \
+    forwardCallToNamespace(ns, int8MultiplyAndAddBias);                        \
+    forwardCallToNamespace(ns, int8MultiplyAddBiasAndLayerNorm);               \
+    forwardCallToNamespace(ns, int8MultiplyAndAddBiasSelected);                \
+    forwardCallToNamespace(ns, int8SetThreadCount);                            \
+  }
+
+#if RUY_PLATFORM_X86
+namespaceToStructForTemplating(Intgemm);
+#endif
+
+namespaceToStructForTemplating(Ruy);
+
+using Ruy::detail::kStandardCpp;
+using Ruy::detail::Preprocess;
+#if RUY_PLATFORM_NEON
+using Ruy::detail::kNeon;
+#endif
+
+template <class Path> const char *pathName();
+template <> const char *pathName<kStandardCpp>() { return "kStandardCpp"; }
+#if RUY_PLATFORM_NEON
+template <> const char *pathName<kNeon>() { return "kNeon"; }
+#endif
+
+// Shapes of generated.h without repeats, in order of first appearance. A
+// projection of a shape keeps only the dimensions a function takes, e.g. rows
+// and width for int8PrepareA.
+template <class Projection>
+std::vector<ProblemSize> distinctShapes(Projection project) {
+  std::unordered_set<ProblemSize, Hasher, Equals> seen;
+  std::vector<ProblemSize> shapes;
+  for (const ProblemSize &size : PROBLEM_SIZES) {
+    const ProblemSize shape = project(size);
+    if (seen.insert(shape).second) {
+      shapes.push_back(shape);
+    }
+  }
+  return shapes;
+}
+
+ProblemSize wholeShape(const ProblemSize &size) { return size; }
+ProblemSize shapeOfA(const ProblemSize &size) { return {size.M, size.N, 0}; }
+ProblemSize shapeOfB(const ProblemSize &size) { return {0, size.N, size.P}; }
+ProblemSize shapeOfOutput(const ProblemSize &size) {
+  return {size.M, 0, size.P};
+}
+
+std::string shapeName(const ProblemSize &shape) {
+  std::string name;
+  for (size_t dimension : {shape.M, shape.N, shape.P}) {
+    if (dimension != 0) {
+      name += (name.empty() ? "" : "x") + std::to_string(dimension);
+    }
+  }
+  return name;
+}
+
+// Library thread counts: powers of two up to the hardware threads, and the
+// hardware threads themselves.
+std::vector<size_t> threadCounts() {
+  const size_t hardware =
+      std::max<size_t>(1, std::thread::hardware_concurrency());
+  std::vector<size_t> counts;
+  for (size_t threads = 1; threads < hardware; threads *= 2) {
+    counts.push_back(threads);
+  }
+  counts.push_back(hardware);
+  return counts;
+}
+
+// Half the columns of B, every other one, as a vocabulary shortlist selects
+// a scattered subset.
+std::vector<Index> selectedColumns(size_t cols_B) {
+  std::vector<Index> cols;
+  for (Index c = 0; c + 1 < cols_B && cols.size() < cols_B / 2 / 8 * 8;
+       c += 2) {
+    cols.push_back(c);
+  }
+  return cols;
+}
+
+// Operations and bytes per second, shown as e.g. ops=6.5G/s for 6.5 GOPS, and
+// the event counts of perf when counting.
+void setCounters(benchmark::State &state, const PerfRegion &perf,
+                 double operations, double bytes) {
+  perf.report(state, bytes);
+  using benchmark::Counter;
+  if (operations != 0) {
+    state.counters["ops"] = Counter(
+        operations, Counter::kIsIterationInvariantRate, Counter::kIs1000);
+  }
+  state.counters["bytes"] =
+      Counter(bytes, Counter::kIsIterationInvariantRate, Counter::kIs1000);
+}
+
+// Inputs of a shape, and buffers for the outputs of every function. Dimensions
+// a projection left out are filled in with small ones.
+struct Inputs {
+  explicit Inputs(const ProblemSize &shape)
+      : Inputs(generate(shape)) {}
+
+  Matrix<float> A, B, bias;
+  Matrix<float> B_transposed;
+  Matrix<int8_t> B_quantized_transposed;
+  Matrix<int8_t> A_prepared, B_prepared, B_selected;
+  Matrix<float> bias_prepared, gamma, output;
+  std::vector<Index> cols;
+
+private:
+  using Generated = std::tuple<Matrix<float>, Matrix<float>, Matrix<float>>;
+
+  static Generated generate(const ProblemSize &shape) {
+    std::mt19937_64 gen64;
+    gen64.seed(42);
+    return generateInput(gen64, shape.M ? shape.M : 1,
+                         shape.N ? shape.N : 64, shape.P ? shape.P : 8);
+  }
+
+  explicit Inputs(Generated generated)
+      : A(std::move(std::get<0>(generated))),
+        B(std::move(std::get<1>(generated))),
+        bias(std::move(std::get<2>(generated))), B_transposed(B.transpose()),
+        B_quantized_transposed(B_transposed.layout()),
+        A_prepared(A.layout()), B_prepared(B.layout().transpose()),
+        B_selected(B.layout().transpose()), bias_prepared(bias.layout()),
+        gamma(bias.layout()),
+        output(Layout(A.nrows(), B.ncols(), Order::RowMajor)),
+        cols(selectedColumns(B.ncols())) {
+    Preprocess<kStandardCpp>::quantize(B_transposed.data(), B.scale(),
+                                       B.zero_point(), B.ncols(), B.nrows(),
+                                       B_quantized_transposed.data());
+    std::fill(gamma.begin(), gamma.end(), 1.0f);
+  }
+};
+
+// Runs body with the library set to threads threads.
+template <class Lib, class Body> void withThreads(size_t threads, Body body) {
+  Lib::int8SetThreadCount(threads);
+  body();
+  Lib::int8SetThreadCount(0);
+}
+
+template <class Lib>
+void registerInterface(const std::string &backend, const char *path) {
+  const std::vector<size_t> thread_counts = threadCounts();
+  auto add = [&](const std::string &function, const ProblemSize &shape,
+                 auto bench) {
+    for (size_t threads : thread_counts) {
+      const std::string name = function + "/" + backend + "/" +
+                               shapeName(shape) +
+                               "/threads:" + std::to_string(threads);
+      benchmark::RegisterBenchmark(
+          name.c_str(),
+          [shape, threads, path, bench](benchmark::State &state) {
+            state.SetLabel(path);
+            Inputs in(shape);
+            withThreads<Lib>(threads, [&] { bench(state, in); });
+          })
+          ->UseRealTime();
+    }
+  };
+
+  for (const ProblemSize &shape : distinctShapes(shapeOfA)) {
+    add("int8PrepareA", shape, [](benchmark::State &state, Inputs &in) {
+      PerfRegion perf;
+      for (auto _ : state) {
+        Lib::int8PrepareA(in.A.data(), in.A.scale(), in.A.zero_point(),
+                          in.A.nrows(), in.A.ncols(), in.A_prepared.data());
+      }
+      setCounters(state, perf, 0, 5.0 * in.A.nrows() * in.A.ncols());
+    });
+  }
+
+  for (const ProblemSize &shape : distinctShapes(shapeOfB)) {
+    const double elements = double(shape.N) * shape.P;
+    add("int8PrepareB", shape, [=](benchmark::State &state, Inputs &in) {
+      PerfRegion perf;
+      for (auto _ : state) {
+        Lib::int8PrepareB(in.B.data(), in.B.scale(), in.B.zero_point(),
+                          in.B.nrows(), in.B.ncols(), in.B_prepared.data());
+      }
+      setCounters(state, perf, 0, 5 * elements);
+    });
+    add("int8PrepareBFromTransposed", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          PerfRegion perf;
+          for (auto _ : state) {
+            Lib::int8PrepareBFromTransposed(
+                in.B_transposed.data(), in.B.scale(), in.B.zero_point(),
+                in.B.nrows(), in.B.ncols(), in.B_prepared.data());
+          }
+          setCounters(state, perf, 0, 5 * elements);
+        });
+    add("int8PrepareBFromQuantizedTransposed", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          PerfRegion perf;
+          for (auto _ : state) {
+            Lib::int8PrepareBFromQuantizedTransposed(
+                in.B_quantized_transposed.data(), in.B.nrows(), in.B.ncols(),
+                in.B_prepared.data());
+          }
+          setCounters(state, perf, 0, 2 * elements);
+        });
+    add("int8PrepareBias", shape, [=](benchmark::State &state, Inputs &in) {
+      Lib::int8PrepareB(in.B.data(), in.B.scale(), in.B.zero_point(),
+                        in.B.nrows(), in.B.ncols(), in.B_prepared.data());
+      PerfRegion perf;
+      for (auto _ : state) {
+        Lib::int8PrepareBias(in.B_prepared.data(), in.A.scale(),
+                             in.A.zero_point(), in.B.scale(),
+                             in.B.zero_point(), in.B.nrows(), in.B.ncols(),
+                             in.bias.data(), in.bias_prepared.data());
+      }
+      setCounters(state, perf, 0, elements + 8.0 * shape.P);
+    });
+    add("int8SelectColumnsOfB", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          Lib::int8PrepareB(in.B.data(), in.B.scale(), in.B.zero_point(),
+                            in.B.nrows(), in.B.ncols(), in.B_prepared.data());
+          PerfRegion perf;
+          for (auto _ : state) {
+            Lib::int8SelectColumnsOfB(in.B_prepared.data(), in.B.nrows(),
+                                      in.B.ncols(), in.cols.data(),
+                                      in.cols.size(), in.B_selected.data());
+          }
+          setCounters(state, perf, 0, 2.0 * shape.N * in.cols.size());
+        });
+  }
+
+  for (const ProblemSize &shape : distinctShapes(wholeShape)) {
+    const auto [M, N, P] = unroll(shape);
+    // Prepares the inputs of the multiplies, outside of the timing.
+    auto prepare = [](Inputs &in) {
+      Lib::int8PrepareA(in.A.data(), in.A.scale(), in.A.zero_point(),
+                        in.A.nrows(), in.A.ncols(), in.A_prepared.data());
+      Lib::int8PrepareB(in.B.data(), in.B.scale(), in.B.zero_point(),
+                        in.B.nrows(), in.B.ncols(), in.B_prepared.data());
+      Lib::int8PrepareBias(in.B_prepared.data(), in.A.scale(),
+                           in.A.zero_point(), in.B.scale(), in.B.zero_point(),
+                           in.B.nrows(), in.B.ncols(), in.bias.data(),
+                           in.bias_prepared.data());
+    };
+    const double operations = 2.0 * M * N * P;
+    const double bytes = double(N) * (M + P) + 4.0 * M * P + 4.0 * P;
+
+    add("int8MultiplyAndAddBias", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          prepare(in);
+          PerfRegion perf;
+          for (auto _ : state) {
+            Lib::int8MultiplyAndAddBias(
+                in.A_prepared.data(), in.A.scale(), in.A.zero_point(),
+                in.B_prepared.data(), in.B.scale(), in.B.zero_point(),
+                in.bias_prepared.data(), 1.0f, M, N, P, in.output.data(),
+                false);
+          }
+          setCounters(state, perf, operations, bytes);
+        });
+    add("int8MultiplyAddBiasAndLayerNorm", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          prepare(in);
+          PerfRegion perf;
+          for (auto _ : state) {
+            // The output is its own residual, as in a residual block.
+            Lib::int8MultiplyAddBiasAndLayerNorm(
+                in.A_prepared.data(), in.A.scale(), in.A.zero_point(),
+                in.B_prepared.data(), in.B.scale(), in.B.zero_point(),
+                in.bias_prepared.data(), 1.0f, in.output.data(),
+                in.gamma.data(), in.bias.data(), 1e-6f, M, N, P,
+                in.output.data());
+          }
+          setCounters(state, perf, operations, bytes + 4.0 * M * P + 8.0 * P);
+        });
+    add("int8MultiplyAndAddBiasSelected", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          prepare(in);
+          const double selected = in.cols.size();
+          PerfRegion perf;
+          for (auto _ : state) {
+            Lib::int8MultiplyAndAddBiasSelected(
+                in.A_prepared.data(), in.A.scale(), in.A.zero_point(),
+                in.B_prepared.data(), in.B.scale(), in.B.zero_point(),
+                in.bias_prepared.data(), 1.0f, M, N, P, in.cols.data(),
+                in.cols.size(), in.output.data());
+          }
+          setCounters(state, perf, 2.0 * M * N * selected,
+                      N * (M + selected) + 4.0 * M * selected);
+        });
+  }
+}
+
+// Preprocess routines of path, at the shapes the ruy backend runs them on.
+template <class Path> void registerPreprocess() {
+  const std::string prefix = std::string("Preprocess<") + pathName<Path>() +
+                             ">::";
+  auto add = [&](const std::string &routine, const ProblemSize &shape,
+                 auto bench) {
+    const std::string name = prefix + routine + "/" + shapeName(shape);
+    benchmark::RegisterBenchmark(name.c_str(),
+                                 [shape, bench](benchmark::State &state) {
+                                   Inputs in(shape);
+                                   bench(state, in);
+                                 });
+  };
+
+  for (const ProblemSize &shape : distinctShapes(shapeOfA)) {
+    add("quantize", shape, [](benchmark::State &state, Inputs &in) {
+      PerfRegion perf;
+      for (auto _ : state) {
+        Preprocess<Path>::quantize(in.A.data(), in.A.scale(),
+                                   in.A.zero_point(), in.A.nrows(),
+                                   in.A.ncols(), in.A_prepared.data());
+      }
+      setCounters(state, perf, 0, 5.0 * in.A.nrows() * in.A.ncols());
+    });
+  }
+
+  for (const ProblemSize &shape : distinctShapes(shapeOfB)) {
+    add("transpose", shape, [](benchmark::State &state, Inputs &in) {
+      PerfRegion perf;
+      for (auto _ : state) {
+        Preprocess<Path>::transpose(in.B_quantized_transposed.data(),
+                                    in.B.ncols(), in.B.nrows(),
+                                    in.B_prepared.data());
+      }
+      setCounters(state, perf, 0, 2.0 * in.B.nrows() * in.B.ncols());
+    });
+    add("selectColumns", shape, [](benchmark::State &state, Inputs &in) {
+      PerfRegion perf;
+      for (auto _ : state) {
+        Preprocess<Path>::selectColumns(in.B_quantized_transposed.data(),
+                                        in.B.nrows(), in.cols.data(),
+                                        in.cols.size(), in.B_selected.data());
+      }
+      setCounters(state, perf, 0, 2.0 * in.B.nrows() * in.cols.size());
+    });
+  }
+
+  // Epilogues of multiplies with the shape of their output.
+  for (const ProblemSize &shape : distinctShapes(shapeOfOutput)) {
+    const auto [M, N, P] = unroll(shape);
+    add("unquantizeAddBias", shape, [=](benchmark::State &state, Inputs &in) {
+      std::vector<int32_t> accumulators(M * P, 1);
+      PerfRegion perf;
+      for (auto _ : state) {
+        Preprocess<Path>::unquantizeAddBias(accumulators.data(),
+                                            in.bias.data(), 1e-3f, M, P,
+                                            in.output.data());
+      }
+      setCounters(state, perf, 0, 8.0 * M * P + 4.0 * P);
+    });
+    add("unquantizeAddBiasAccumulate", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          std::vector<int32_t> accumulators(M * P, 1);
+          PerfRegion perf;
+          for (auto _ : state) {
+            Preprocess<Path>::unquantizeAddBiasAccumulate(
+                accumulators.data(), in.bias.data(), 1e-3f, M, P,
+                in.output.data());
+          }
+          setCounters(state, perf, 0, 12.0 * M * P + 4.0 * P);
+        });
+    add("unquantizeAddBiasLayerNorm", shape,
+        [=](benchmark::State &state, Inputs &in) {
+          std::vector<int32_t> accumulators(M * P, 1);
+          PerfRegion perf;
+          for (auto _ : state) {
+            Preprocess<Path>::unquantizeAddBiasLayerNorm(
+                accumulators.data(), in.bias.data(), 1e-3f, in.output.data(),
+                in.gamma.data(), in.bias.data(), 1e-6f, M, P,
+                in.output.data());
+          }
+          setCounters(state, perf, 0, 12.0 * M * P + 12.0 * P);
+        });
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  initializePerfCounters(&argc, argv);
+  registerInterface<_Ruy>("ruy", pathName<Ruy::detail::kHighestPath>());
+#if RUY_PLATFORM_X86
+  registerInterface<_Intgemm>("intgemm", "intgemm");
+#endif
+  registerPreprocess<kStandardCpp>();
+#if RUY_PLATFORM_NEON
+  registerPreprocess<kNeon>();
+#endif
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,219 @@
+#pragma once
+#include "benchmark/benchmark.h"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware event counts for the Google Benchmark suites, from Linux
+// perf_event_open, to tell why the time of a benchmark is what it is. A suite
+// opens the counters once in main, before the libraries start their threads,
+// so that the counts of a region include those of the threads as well as the
+// calling thread. Counters that cannot be opened, in containers, VMs without
+// a PMU or with perf_event_paranoid too high, are left out; without any the
+// benchmarks run as they would without counters.
+
+namespace pg {
+
+class PerfCounters {
+public:
+  enum Event {
+    kCycles,
+    kInstructions,
+    kL1dMisses,
+    kLlcMisses,
+    kDtlbMisses,
+    kBranchMisses,
+    kNumEvents
+  };
+
+  static constexpr const char *kNames[kNumEvents] = {
+      "cycles",     "instructions", "L1d_misses",
+      "LLC_misses", "dTLB_misses",  "branch_misses"};
+
+  // Counts since the counters were opened, scaled up for the time a counter
+  // was not scheduled when there are more events than hardware counters. -1
+  // for events that could not be opened.
+  using Counts = std::array<double, kNumEvents>;
+
+  static PerfCounters &get() {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  // Opens the counters that can be, and tells on stderr which cannot. Returns
+  // whether any could.
+  bool open() {
+    std::string unavailable;
+    int error = 0;
+    for (int event = 0; event < kNumEvents; ++event) {
+      fds_[event] = openEvent(static_cast<Event>(event));
+      if (fds_[event] < 0) {
+        unavailable += std::string(unavailable.empty() ? "" : ", ") +
+                       kNames[event];
+        error = errno;
+      }
+    }
+    if (!unavailable.empty()) {
+      std::cerr << "Performance counters unavailable (" << std::strerror(error)
+                << "): " << unavailable << "\n";
+    }
+    return enabled();
+  }
+
+  bool enabled() const {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Counts read() const {
+    Counts counts;
+    counts.fill(-1);
+#if defined(__linux__)
+    for (int event = 0; event < kNumEvents; ++event) {
+      // value, time enabled, time running.
+      uint64_t values[3];
+      if (fds_[event] >= 0 &&
+          ::read(fds_[event], values, sizeof(values)) == sizeof(values)) {
+        counts[event] = values[2] == 0 ? 0
+                                       : static_cast<double>(values[0]) *
+                                             values[1] / values[2];
+      }
+    }
+#endif
+    return counts;
+  }
+
+private:
+  PerfCounters() { fds_.fill(-1); }
+
+  static int openEvent(Event event) {
+#if defined(__linux__)
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    // Read misses of a cache, encoded as perf_event_open(2) describes.
+    auto cache = [](uint64_t cache, uint64_t result) {
+      const uint64_t op = PERF_COUNT_HW_CACHE_OP_READ;
+      return cache | op << 8 | result << 16;
+    };
+    switch (event) {
+    case kCycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case kInstructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case kL1dMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config =
+          cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    case kLlcMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config =
+          cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    case kDtlbMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config =
+          cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    case kBranchMisses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    default:
+      return -1;
+    }
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Threads started later count into the same counter.
+    attr.inherit = 1;
+    // User space only, which perf_event_paranoid 2 still allows.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
+  std::array<int, kNumEvents> fds_;
+};
+
+// Counts of the events over a benchmark's loop, from its construction, just
+// before the loop, to report(), just after. Does nothing unless the counters
+// are open.
+class PerfRegion {
+public:
+  PerfRegion() : start_(counters().read()) {}
+
+  // Adds the counts per iteration to the counters of state, with instructions
+  // per cycle and, for bytes moved per iteration, bytes per cycle.
+  void report(benchmark::State &state, double bytes) const {
+    if (!counters().enabled() || state.iterations() == 0) {
+      return;
+    }
+    using benchmark::Counter;
+    const PerfCounters::Counts end = counters().read();
+    PerfCounters::Counts counts;
+    for (int event = 0; event < PerfCounters::kNumEvents; ++event) {
+      counts[event] = start_[event] < 0 ? -1 : end[event] - start_[event];
+      if (counts[event] >= 0) {
+        state.counters[PerfCounters::kNames[event]] =
+            Counter(counts[event], Counter::kAvgIterations);
+      }
+    }
+    const double cycles = counts[PerfCounters::kCycles];
+    const double instructions = counts[PerfCounters::kInstructions];
+    if (cycles > 0 && instructions >= 0) {
+      state.counters["IPC"] = instructions / cycles;
+    }
+    if (cycles > 0 && bytes > 0) {
+      state.counters["bytes_per_cycle"] = bytes * state.iterations() / cycles;
+    }
+  }
+
+private:
+  static const PerfCounters &counters() { return PerfCounters::get(); }
+
+  PerfCounters::Counts start_;
+};
+
+// Takes --perf_counters out of the arguments of a suite's main, before
+// benchmark::Initialize sees them, and opens the counters if it was there.
+inline void initializePerfCounters(int *argc, char **argv) {
+  int kept = 1;
+  bool requested = false;
+  for (int i = 1; i < *argc; ++i) {
+    if (std::string(argv[i]) == "--perf_counters") {
+      requested = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  *argc = kept;
+  argv[kept] = nullptr;
+  if (requested && !PerfCounters::get().open()) {
+    std::cerr << "No performance counters, running without\n";
+  }
+}
+
+} // namespace pg
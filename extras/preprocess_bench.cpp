@@ -0,0 +1,321 @@
+#include "benchmark/benchmark.h"
+#include "matrix.h"
+#include "perf_counters.h"
+#include "wrapped.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Google Benchmark suite of the Preprocess routines on their own, at working
+// sets from L1-resident to DRAM-resident, to see which of them are bound by
+// memory bandwidth and what each path buys over kStandardCpp. Every routine
+// runs on buffers adding up to each footprint of kFootprints, and so does a
+// memcpy of half the footprint into the other half, the most a routine moving
+// the same bytes can hope for. Benchmarks are named
+//   memcpy/<footprint>
+//   Preprocess<path>::<routine>/<footprint>
+// with the paths of a routine next to each other, and labelled with the
+// smallest cache the footprint fits in. They report the bytes read and written
+// per second as the bytes counter and, as vs_memcpy, that rate as a fraction of
+// the rate of memcpy at the same footprint. With --perf_counters, the hardware
+// events of perf_counters.h are reported as well.
+
+namespace {
+
+using namespace pg;
+
+// Buffers of the ruy backend, which exists on every platform, aligned as its
+// own are.
+using Ruy::detail::AlignedVector;
+using Ruy::detail::kStandardCpp;
+using Ruy::detail::Preprocess;
+#if RUY_PLATFORM_NEON
+using Ruy::detail::kNeon;
+#endif
+
+template <class Path> const char *pathName();
+template <> const char *pathName<kStandardCpp>() { return "kStandardCpp"; }
+#if RUY_PLATFORM_NEON
+template <> const char *pathName<kNeon>() { return "kNeon"; }
+#endif
+
+// Bytes of all buffers a benchmark touches, 16 KiB to 256 MiB by fours.
+const std::vector<size_t> kFootprints = {
+    size_t{16} << 10,  size_t{64} << 10, size_t{256} << 10,
+    size_t{1} << 20,   size_t{4} << 20,  size_t{16} << 20,
+    size_t{64} << 20,  size_t{256} << 20};
+
+// Columns of the outputs of multiplies the epilogues run on, and rows of the
+// activations quantize runs on.
+constexpr Index kEpilogueCols = 512;
+constexpr Index kQuantizeWidth = 256;
+
+std::string footprintName(size_t bytes) {
+  return bytes >= (size_t{1} << 20) ? std::to_string(bytes >> 20) + "MiB"
+                                    : std::to_string(bytes >> 10) + "KiB";
+}
+
+// The smallest data cache bytes fit in, as Google Benchmark found the caches.
+std::string cacheLevel(size_t bytes) {
+  std::vector<benchmark::CPUInfo::CacheInfo> caches =
+      benchmark::CPUInfo::Get().caches;
+  std::sort(caches.begin(), caches.end(),
+            [](const auto &a, const auto &b) { return a.level < b.level; });
+  for (const auto &cache : caches) {
+    if (cache.type != "Instruction" && bytes <= size_t(cache.size)) {
+      return "L" + std::to_string(cache.level);
+    }
+  }
+  return "DRAM";
+}
+
+// Written once, so that pages are faulted in before the timing.
+template <class T> AlignedVector<T> zeroVector(size_t size) {
+  AlignedVector<T> v(size);
+  std::fill(v.begin(), v.end(), T(0));
+  return v;
+}
+
+template <class T> AlignedVector<T> randomVector(size_t size) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+  AlignedVector<T> v(size);
+  if constexpr (std::is_floating_point_v<T>) {
+    std::uniform_real_distribution<T> distribution(-1, 1);
+    std::generate(v.begin(), v.end(), [&] { return distribution(gen64); });
+  } else {
+    std::uniform_int_distribution<int> distribution(-127, 127);
+    std::generate(v.begin(), v.end(),
+                  [&] { return static_cast<T>(distribution(gen64)); });
+  }
+  return v;
+}
+
+// Bytes read and written per second by memcpy of footprint / 2 bytes, measured
+// once per footprint outside of any benchmark's timing. The rate is the median
+// of batches of copies, each long enough for the clock not to matter.
+double memcpyBytesPerSecond(size_t footprint) {
+  static std::map<size_t, double> measured;
+  auto found = measured.find(footprint);
+  if (found != measured.end()) {
+    return found->second;
+  }
+  const size_t half = footprint / 2;
+  AlignedVector<char> src = zeroVector<char>(half);
+  AlignedVector<char> dst = zeroVector<char>(half);
+
+  using Clock = std::chrono::steady_clock;
+  const size_t batch = std::max<size_t>(1, (size_t{16} << 20) / half);
+  const auto start = Clock::now();
+  std::vector<double> rates;
+  do {
+    const auto batch_start = Clock::now();
+    for (size_t i = 0; i < batch; ++i) {
+      std::memcpy(dst.begin(), src.begin(), half);
+      benchmark::ClobberMemory();
+    }
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - batch_start).count();
+    rates.push_back(2.0 * half * batch / seconds);
+  } while (Clock::now() - start < std::chrono::milliseconds(200));
+  std::nth_element(rates.begin(), rates.begin() + rates.size() / 2,
+                   rates.end());
+  return measured[footprint] = rates[rates.size() / 2];
+}
+
+// Runs body for the iterations of state, and reports the bytes it reads and
+// writes per second, how that compares to memcpy and the events it counts.
+template <class Body>
+void run(benchmark::State &state, size_t footprint, double bytes, Body body) {
+  using Clock = std::chrono::steady_clock;
+  PerfRegion perf;
+  const auto start = Clock::now();
+  for (auto _ : state) {
+    body();
+    benchmark::ClobberMemory();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  perf.report(state, bytes);
+
+  using benchmark::Counter;
+  state.counters["bytes"] =
+      Counter(bytes, Counter::kIsIterationInvariantRate, Counter::kIs1000);
+  state.counters["vs_memcpy"] = bytes * state.iterations() / seconds /
+                                memcpyBytesPerSecond(footprint);
+}
+
+// Rows of row_bytes that fit in footprint next to vectors of vector_bytes.
+Index epilogueRows(size_t footprint, size_t row_bytes, size_t vector_bytes) {
+  return std::max<Index>(1, (footprint - vector_bytes) / row_bytes);
+}
+
+void registerMemcpy() {
+  for (size_t footprint : kFootprints) {
+    const std::string name = "memcpy/" + footprintName(footprint);
+    benchmark::RegisterBenchmark(
+        name.c_str(), [footprint](benchmark::State &state) {
+          state.SetLabel(cacheLevel(footprint));
+          const size_t half = footprint / 2;
+          AlignedVector<char> src = randomVector<char>(half);
+          AlignedVector<char> dst = zeroVector<char>(half);
+          run(state, footprint, 2.0 * half,
+              [&] { std::memcpy(dst.begin(), src.begin(), half); });
+        });
+  }
+}
+
+// Registers bench(Path(), state, footprint) running routine with each path at
+// each footprint.
+template <class Bench>
+void registerPaths(const std::string &routine, Bench bench) {
+  auto add = [&](auto path, size_t footprint) {
+    using Path = decltype(path);
+    const std::string name = std::string("Preprocess<") + pathName<Path>() +
+                             ">::" + routine + "/" + footprintName(footprint);
+    benchmark::RegisterBenchmark(
+        name.c_str(), [footprint, bench](benchmark::State &state) {
+          state.SetLabel(cacheLevel(footprint));
+          bench(Path(), state, footprint);
+        });
+  };
+  for (size_t footprint : kFootprints) {
+    add(kStandardCpp(), footprint);
+#if RUY_PLATFORM_NEON
+    add(kNeon(), footprint);
+#endif
+  }
+}
+
+void registerPreprocess() {
+  registerPaths("quantize", [](auto path, benchmark::State &state,
+                               size_t footprint) {
+    using Path = decltype(path);
+    const Index rows = std::max<size_t>(1, footprint / 5 / kQuantizeWidth);
+    const size_t size = size_t(rows) * kQuantizeWidth;
+    AlignedVector<float> input = randomVector<float>(size);
+    AlignedVector<int8_t> output = zeroVector<int8_t>(size);
+    run(state, footprint, 5.0 * size, [&] {
+      Preprocess<Path>::quantize(input.begin(), 64.0f, 0.0f, rows,
+                                 kQuantizeWidth, output.begin());
+    });
+  });
+
+  registerPaths("transpose", [](auto path, benchmark::State &state,
+                                size_t footprint) {
+    using Path = decltype(path);
+    // Square, in whole 16x16 tiles for the kNeon path.
+    const Index side = std::max<Index>(
+        16, static_cast<Index>(std::sqrt(footprint / 2.0)) / 16 * 16);
+    const size_t size = size_t(side) * side;
+    AlignedVector<int8_t> input = randomVector<int8_t>(size);
+    AlignedVector<int8_t> output = zeroVector<int8_t>(size);
+    run(state, footprint, 2.0 * size, [&] {
+      Preprocess<Path>::transpose(input.begin(), side, side, output.begin());
+    });
+  });
+
+  // At the two widths the paths copy in constant size columns, and at one
+  // they copy with the general loop.
+  for (Index width : {256, 1536, 512}) {
+    registerPaths(
+        "selectColumns/width:" + std::to_string(width),
+        [width](auto path, benchmark::State &state, size_t footprint) {
+          using Path = decltype(path);
+          // Every other column, as a shortlist selects a scattered subset, so
+          // input and output make 1.5 times the input.
+          const Index cols = std::max<Index>(
+              16, static_cast<Index>(footprint / (1.5 * width)) / 16 * 16);
+          std::vector<Index> selected;
+          for (Index c = 0; c < cols; c += 2) {
+            selected.push_back(c);
+          }
+          AlignedVector<int8_t> input =
+              randomVector<int8_t>(size_t(width) * cols);
+          AlignedVector<int8_t> output =
+              zeroVector<int8_t>(size_t(width) * selected.size());
+          run(state, footprint, 2.0 * width * selected.size(), [&] {
+            Preprocess<Path>::selectColumns(input.begin(), width,
+                                            selected.data(), selected.size(),
+                                            output.begin());
+          });
+        });
+  }
+
+  // The epilogues read int32 accumulators and write floats, and read the
+  // output or a residual of the same size where they take one.
+  registerPaths("unquantizeAddBias", [](auto path, benchmark::State &state,
+                                        size_t footprint) {
+    using Path = decltype(path);
+    const Index rows =
+        epilogueRows(footprint, 8 * kEpilogueCols, 4 * kEpilogueCols);
+    const size_t size = size_t(rows) * kEpilogueCols;
+    AlignedVector<int32_t> input = randomVector<int32_t>(size);
+    AlignedVector<float> bias = randomVector<float>(kEpilogueCols);
+    AlignedVector<float> output = zeroVector<float>(size);
+    run(state, footprint, 8.0 * size + 4.0 * kEpilogueCols, [&] {
+      Preprocess<Path>::unquantizeAddBias(input.begin(), bias.begin(), 1e-3f,
+                                          rows, kEpilogueCols, output.begin());
+    });
+  });
+
+  registerPaths("unquantizeAddBiasAccumulate", [](auto path,
+                                                  benchmark::State &state,
+                                                  size_t footprint) {
+    using Path = decltype(path);
+    const Index rows =
+        epilogueRows(footprint, 8 * kEpilogueCols, 4 * kEpilogueCols);
+    const size_t size = size_t(rows) * kEpilogueCols;
+    AlignedVector<int32_t> input = randomVector<int32_t>(size);
+    AlignedVector<float> bias = randomVector<float>(kEpilogueCols);
+    AlignedVector<float> output = zeroVector<float>(size);
+    run(state, footprint, 12.0 * size + 4.0 * kEpilogueCols, [&] {
+      Preprocess<Path>::unquantizeAddBiasAccumulate(
+          input.begin(), bias.begin(), 1e-3f, rows, kEpilogueCols,
+          output.begin());
+    });
+  });
+
+  registerPaths("unquantizeAddBiasLayerNorm", [](auto path,
+                                                 benchmark::State &state,
+                                                 size_t footprint) {
+    using Path = decltype(path);
+    const Index rows =
+        epilogueRows(footprint, 12 * kEpilogueCols, 12 * kEpilogueCols);
+    const size_t size = size_t(rows) * kEpilogueCols;
+    AlignedVector<int32_t> input = randomVector<int32_t>(size);
+    AlignedVector<float> residual = randomVector<float>(size);
+    AlignedVector<float> bias = randomVector<float>(kEpilogueCols);
+    AlignedVector<float> gamma = randomVector<float>(kEpilogueCols);
+    AlignedVector<float> beta = randomVector<float>(kEpilogueCols);
+    AlignedVector<float> output = zeroVector<float>(size);
+    run(state, footprint, 12.0 * size + 12.0 * kEpilogueCols, [&] {
+      Preprocess<Path>::unquantizeAddBiasLayerNorm(
+          input.begin(), bias.begin(), 1e-3f, residual.begin(), gamma.begin(),
+          beta.begin(), 1e-6f, rows, kEpilogueCols, output.begin());
+    });
+  });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  initializePerfCounters(&argc, argv);
+  registerMemcpy();
+  registerPreprocess();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
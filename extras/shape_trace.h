@@ -0,0 +1,159 @@
+#pragma once
+#include "generated.h"
+#include "wrapped.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Reads the shape traces int8StartShapeTrace writes, in either format, so that
+// benchmarks can run the shapes of a recorded workload instead of
+// PROBLEM_SIZES.
+
+namespace pg {
+
+// Both backends record the same Int8Operation values, under the names the
+// runtime gives them.
+using ShapeTraceOperation = Ruy::Int8Operation;
+
+// The value of the operation a CSV trace names, as the runtime names it.
+// Returns false for names of no operation.
+inline bool shapeTraceOperation(const std::string &name, uint32_t &operation) {
+  // Values run from 0, operationName has no name for the first past the end.
+  for (uint32_t value = 0;; ++value) {
+    const char *known =
+        Ruy::runtime::operationName(static_cast<ShapeTraceOperation>(value));
+    if (std::strcmp(known, "unknown") == 0) {
+      return false;
+    }
+    if (name == known) {
+      operation = value;
+      return true;
+    }
+  }
+}
+
+struct ShapeTraceRecord {
+  uint64_t timestamp_ns;
+  uint32_t thread;
+  // Value of Int8Operation.
+  uint32_t operation;
+  uint32_t rows_A;
+  uint32_t width;
+  uint32_t cols_B;
+};
+
+inline uint32_t shapeTraceGet32(const unsigned char *in) {
+  return uint32_t{in[0]} | uint32_t{in[1]} << 8 | uint32_t{in[2]} << 16 |
+         uint32_t{in[3]} << 24;
+}
+
+inline bool loadBinaryShapeTrace(std::ifstream &file,
+                                 std::vector<ShapeTraceRecord> &records) {
+  unsigned char header[8];
+  if (!file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+    return false;
+  }
+  const uint32_t version = shapeTraceGet32(header);
+  const uint32_t record_size = shapeTraceGet32(header + 4);
+  // Later versions may only add fields at the end of a record.
+  if (version < 1 || record_size < 28) {
+    return false;
+  }
+  std::vector<unsigned char> record(record_size);
+  while (file.read(reinterpret_cast<char *>(record.data()), record_size)) {
+    const unsigned char *in = record.data();
+    const uint64_t timestamp =
+        shapeTraceGet32(in) | uint64_t{shapeTraceGet32(in + 4)} << 32;
+    records.push_back(ShapeTraceRecord{
+        timestamp, shapeTraceGet32(in + 8), shapeTraceGet32(in + 12),
+        shapeTraceGet32(in + 16), shapeTraceGet32(in + 20),
+        shapeTraceGet32(in + 24)});
+  }
+  return file.eof();
+}
+
+inline bool loadCsvShapeTrace(std::ifstream &file,
+                              std::vector<ShapeTraceRecord> &records) {
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string operation;
+    ShapeTraceRecord record;
+    char comma;
+    fields >> record.timestamp_ns >> comma >> record.thread >> comma;
+    std::getline(fields, operation, ',');
+    fields >> record.rows_A >> comma >> record.width >> comma >> record.cols_B;
+    if (!fields) {
+      return false;
+    }
+    if (!shapeTraceOperation(operation, record.operation)) {
+      return false;
+    }
+    records.push_back(record);
+  }
+  return true;
+}
+
+// Reads the calls recorded in the trace at path into records, in the order
+// they were made. Returns false if the file cannot be read or is not a shape
+// trace.
+inline bool loadShapeTrace(const std::string &path,
+                           std::vector<ShapeTraceRecord> &records) {
+  records.clear();
+  std::ifstream file(path, std::ios::binary);
+  char magic[8];
+  if (!file.read(magic, sizeof(magic))) {
+    return false;
+  }
+  if (std::memcmp(magic, "MOZSHAPE", sizeof(magic)) == 0) {
+    if (!loadBinaryShapeTrace(file, records)) {
+      return false;
+    }
+  } else {
+    // Otherwise it must be CSV, starting with the header line.
+    file.seekg(0);
+    std::string header;
+    std::getline(file, header);
+    if (header.rfind("timestamp_ns,thread,operation,", 0) != 0 ||
+        !loadCsvShapeTrace(file, records)) {
+      return false;
+    }
+  }
+
+  // Threads' calls are written out a buffer at a time.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const ShapeTraceRecord &a, const ShapeTraceRecord &b) {
+                     return a.timestamp_ns < b.timestamp_ns;
+                   });
+  return true;
+}
+
+// The shapes of the multiplies of a trace, in the order they were made, as
+// PROBLEM_SIZES has them. Multiplies with layer normalization or of selected
+// columns are there too, as the plain multiply of their shape (of the
+// selected columns, for the latter) that most of their time goes to.
+inline std::vector<ProblemSize>
+multiplyProblemSizes(const std::vector<ShapeTraceRecord> &records) {
+  std::vector<ProblemSize> sizes;
+  for (const ShapeTraceRecord &record : records) {
+    switch (static_cast<ShapeTraceOperation>(record.operation)) {
+    case ShapeTraceOperation::MultiplyAndAddBias:
+    case ShapeTraceOperation::MultiplyAddBiasAndLayerNorm:
+    case ShapeTraceOperation::MultiplyAndAddBiasSelected:
+      sizes.push_back(ProblemSize{record.rows_A, record.width, record.cols_B});
+      break;
+    default:
+      break;
+    }
+  }
+  return sizes;
+}
+
+} // namespace pg
@@ -0,0 +1,254 @@
+#include "generated.h"
+#include "matrix.h"
+#include "shape_trace.h"
+#include "wrapped.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Replays a whole sequence of multiplies, PROBLEM_SIZES or the multiplies of a
+// trace recorded with int8StartShapeTrace (those with layer normalization or
+// of selected columns as plain multiplies of their shape), through each
+// backend in order. Each call prepares its activations and multiplies them
+// with prepared weights, as a translation does for every layer. Unlike
+// firefox_interface_benchmark, which times the most frequent large shape
+// alone, this weighs every shape by how often the workload calls it, so the
+// many small decoder multiplies count for what they cost.
+//
+// Usage: trace_replay_benchmark [--passes N] [--layers N] [--words N] [trace]
+
+namespace {
+
+using namespace pg;
+
+// See firefox_interface_benchmark.cpp.
+#define forwardCallToNamespace(ns, fn)                                         \
+  template <class... Args> static void fn(Args... args) { ns::fn(args...); }
+
+#define namespaceToStructForTemplating(ns)                                     \
+  struct _##ns {                                                               \
+    forwardCallToNamespace(ns, int8PrepareA);                                  \
+    forwardCallToNamespace(ns, int8PrepareB);                                  \
+    forwardCallToNamespace(ns, int8PrepareBias);                               \
+    forwardCallToNamespace(ns, int8MultiplyAndAddBias);                        \
+  }
+
+#if defined(__i386__) || defined(__x86_64__)
+namespaceToStructForTemplating(Intgemm);
+#endif
+
+namespaceToStructForTemplating(Ruy);
+
+struct Options {
+  size_t passes = 5;
+  // Distinct weights per shape of B. Calls with the same shape of B cycle
+  // through them, so a model of `layers` layers is streamed through the caches
+  // the way a translation streams its weights, instead of one matrix per shape
+  // staying in L1 or L2.
+  size_t layers = 6;
+  // Words the sequence translates, for the words per second equivalent. 0 to
+  // leave it out, the shapes alone do not tell how many words they are.
+  size_t words = 0;
+  std::string trace;
+};
+
+// Weights of a layer, prepared once before timing like a model at load.
+struct Weights {
+  Matrix<int8_t> B_prepared;
+  Matrix<float> bias_prepared;
+  float scale_B;
+};
+
+struct ShapeTimes {
+  size_t calls = 0;
+  double seconds = 0;
+};
+
+struct Less {
+  bool operator()(const ProblemSize &a, const ProblemSize &b) const {
+    return unroll(a) < unroll(b);
+  }
+};
+
+template <class Lib>
+void Replay(const std::string &name, const std::vector<ProblemSize> &sizes,
+            const Options &options) {
+  std::mt19937_64 gen64;
+  gen64.seed(42);
+
+  // Activations and output are shared, as the output of a layer is the input
+  // of the next and stays warm.
+  size_t max_A = 0, max_output = 0;
+  for (const ProblemSize &size : sizes) {
+    max_A = std::max(max_A, size.M * size.N);
+    max_output = std::max(max_output, size.M * size.P);
+  }
+  Matrix<float> A =
+      make_random_matrix<float>(gen64, Layout(1, max_A, Order::RowMajor), -1.0f,
+                                1.0f);
+  const float scale_A = A.scale();
+  Matrix<int8_t> A_prepared(A.layout());
+  Matrix<float> output(Layout(1, max_output, Order::RowMajor));
+
+  // Weights of each call, the next layer of its shape of B.
+  std::map<std::pair<size_t, size_t>, std::vector<Weights>> layers;
+  std::map<std::pair<size_t, size_t>, size_t> next_layer;
+  std::vector<const Weights *> weights;
+  for (const ProblemSize &size : sizes) {
+    std::vector<Weights> &shape_layers = layers[{size.N, size.P}];
+    if (shape_layers.empty()) {
+      shape_layers.reserve(options.layers);
+      for (size_t layer = 0; layer < options.layers; ++layer) {
+        auto [activations, B, bias] =
+            generateInput(gen64, 1, size.N, size.P);
+        Weights prepared{Matrix<int8_t>(B.layout().transpose()),
+                         Matrix<float>(bias.layout()), B.scale()};
+        Lib::int8PrepareB(B.data(), prepared.scale_B, B.zero_point(),
+                          B.nrows(), B.ncols(), prepared.B_prepared.begin());
+        Lib::int8PrepareBias(prepared.B_prepared.begin(), scale_A,
+                             A.zero_point(), prepared.scale_B, B.zero_point(),
+                             B.nrows(), B.ncols(), bias.data(),
+                             prepared.bias_prepared.begin());
+        shape_layers.push_back(std::move(prepared));
+      }
+    }
+    size_t &layer = next_layer[{size.N, size.P}];
+    weights.push_back(&shape_layers[layer]);
+    layer = (layer + 1) % options.layers;
+  }
+
+  // Call i runs from stamps[i] to stamps[i + 1], so a pass reads the clock
+  // once per call and leaves the bookkeeping until it is over.
+  using Clock = std::chrono::steady_clock;
+  std::vector<Clock::time_point> stamps(sizes.size() + 1);
+  auto run = [&] {
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      const auto [M, N, P] = unroll(sizes[i]);
+      const Weights &layer = *weights[i];
+      stamps[i] = Clock::now();
+      Lib::int8PrepareA(A.data(), scale_A, A.zero_point(), M, N,
+                        A_prepared.begin());
+      Lib::int8MultiplyAndAddBias(A_prepared.begin(), scale_A, A.zero_point(),
+                                  layer.B_prepared.cbegin(), layer.scale_B,
+                                  0.0f, layer.bias_prepared.cbegin(), 1.0f, M,
+                                  N, P, output.begin(), false);
+    }
+    stamps[sizes.size()] = Clock::now();
+  };
+
+  // A pass to fault in buffers and spin up threads.
+  run();
+  std::map<ProblemSize, ShapeTimes, Less> times;
+  std::vector<double> passes;
+  for (size_t pass = 0; pass < options.passes; ++pass) {
+    run();
+    passes.push_back(
+        std::chrono::duration<double>(stamps.back() - stamps.front()).count());
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      ShapeTimes &shape = times[sizes[i]];
+      ++shape.calls;
+      shape.seconds +=
+          std::chrono::duration<double>(stamps[i + 1] - stamps[i]).count();
+    }
+  }
+
+  std::sort(passes.begin(), passes.end());
+  const double median = passes[passes.size() / 2];
+  std::cout << "[" << name << "] " << std::fixed << std::setprecision(6)
+            << median << " s per pass (median of " << passes.size()
+            << ", min " << passes.front() << ", max " << passes.back() << ")";
+  if (options.words) {
+    std::cout << ", " << std::setprecision(1) << options.words / median
+              << " words/s equivalent";
+  }
+  std::cout << "\n";
+
+  // Shapes by the time they take, the most expensive first.
+  std::vector<std::pair<ProblemSize, ShapeTimes>> shapes(times.begin(),
+                                                         times.end());
+  std::sort(shapes.begin(), shapes.end(), [](const auto &a, const auto &b) {
+    return a.second.seconds > b.second.seconds;
+  });
+  double total = 0;
+  for (const auto &shape : shapes) {
+    total += shape.second.seconds;
+  }
+  std::cout << "  " << std::left << std::setw(18) << "shape" << std::right
+            << std::setw(8) << "calls" << std::setw(12) << "us/call"
+            << std::setw(9) << "share" << std::setw(9) << "GOPS" << "\n";
+  for (const auto &[size, shape] : shapes) {
+    const auto [M, N, P] = unroll(size);
+    const double per_call = shape.seconds / shape.calls;
+    std::cout << "  " << std::left << std::setw(18)
+              << (std::to_string(M) + "x" + std::to_string(N) + "x" +
+                  std::to_string(P))
+              << std::right << std::setw(8) << shape.calls / options.passes
+              << std::setw(12) << std::setprecision(2) << per_call * 1e6
+              << std::setw(8) << std::setprecision(1)
+              << 100 * shape.seconds / total << "%" << std::setw(9)
+              << 2.0 * M * N * P / per_call / 1e9 << "\n";
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && (arg == "--passes" || arg == "--layers" ||
+                         arg == "--words")) {
+      const size_t value = std::strtoull(argv[++i], nullptr, 10);
+      (arg == "--passes"   ? options.passes
+       : arg == "--layers" ? options.layers
+                           : options.words) = value;
+    } else if (arg.rfind("--", 0) != 0 && options.trace.empty()) {
+      options.trace = arg;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--passes N] [--layers N] [--words N] [trace]\n";
+      return 1;
+    }
+  }
+  if (options.passes == 0 || options.layers == 0) {
+    std::cerr << "--passes and --layers must be positive\n";
+    return 1;
+  }
+
+  std::vector<ProblemSize> sizes = PROBLEM_SIZES;
+  if (!options.trace.empty()) {
+    std::vector<ShapeTraceRecord> records;
+    if (!loadShapeTrace(options.trace, records)) {
+      std::cerr << "Cannot read shape trace " << options.trace << "\n";
+      return 1;
+    }
+    sizes = multiplyProblemSizes(records);
+  }
+  if (sizes.empty()) {
+    std::cerr << "No multiplies to replay\n";
+    return 1;
+  }
+
+  double operations = 0;
+  for (const ProblemSize &size : sizes) {
+    operations += 2.0 * size.M * size.N * size.P;
+  }
+  std::cout << "Replaying " << sizes.size() << " multiplies of "
+            << (options.trace.empty() ? "PROBLEM_SIZES" : options.trace)
+            << ", " << operations / 1e9 << " Gop per pass, "
+            << options.layers << " layers of weights per shape\n";
+
+#if defined(__i386__) || defined(__x86_64__)
+  Replay<_Intgemm>("intgemm", sizes, options);
+#endif
+  Replay<_Ruy>("ruy", sizes, options);
+  return 0;
+}
@@ -3,6 +3,7 @@
 namespace pg::Ruy {
 
 #include "MozIntGemm/moz_intgemm_ruy.inl"
+#include "MozIntGemm/moz_intgemm_common.inl"
 
 } // namespace pg::Ruy
 
@@ -10,6 +11,7 @@ namespace pg::Ruy {
 namespace pg::Intgemm {
 
 #include "MozIntGemm/moz_intgemm_intgemm.inl"
+#include "MozIntGemm/moz_intgemm_common.inl"
 
 } // namespace pg::Intgemm
 #endif
@@ -18,6 +18,7 @@
 #endif
 
 #if RUY_PLATFORM_X86
+#include "3rd-party/intgemm/intgemm/aligned.h"
 #include "3rd-party/intgemm/intgemm/intgemm.h"
 #include <cstdint>
 #include <iostream>
@@ -26,8 +27,36 @@
 #include "ruy/ruy.h"
 #include "ruy/system_aligned_alloc.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #if RUY_PLATFORM_NEON
 #include <arm_neon.h>
@@ -37,8 +66,9 @@ using Index = uint32_t;
 
 namespace pg::Ruy {
 
-#include "MozIntGemm/detail.inl"
 #include "MozIntGemm/moz_intgemm.inl"
+#include "MozIntGemm/runtime.inl"
+#include "MozIntGemm/detail.inl"
 
 namespace detail {
 
@@ -55,6 +85,7 @@ struct kNeon;
 namespace pg::Intgemm {
 
 #include "MozIntGemm/moz_intgemm.inl"
+#include "MozIntGemm/runtime.inl"
 } // namespace pg::Intgemm
 
 #endif
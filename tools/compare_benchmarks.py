@@ -0,0 +1,398 @@
+#!/usr/bin/env python3
+"""Runs Google Benchmark suites repeatedly and compares their results.
+
+  compare_benchmarks.py run BINARY -o RESULTS [--repetitions N] [--warmup N]
+                        [--filter REGEX] [-- BENCHMARK_ARGS...]
+  compare_benchmarks.py compare BASELINE CONTENDER [--alpha A] [--threshold T]
+
+`run` runs a benchmark binary such as moz_intgemm_bench with repetitions.
+For each benchmark it drops the first --warmup repetitions, which run on
+cold caches and clocks, and keeps the real time of the rest. RESULTS then
+holds each benchmark's samples, median and a distribution-free confidence
+interval of the median.
+
+`compare` pairs up the benchmarks of two such files, or of two raw
+--benchmark_out files that have repetitions. For each pair it tests whether
+the times differ with a two-sided Mann-Whitney U test, which assumes nothing
+about the shape of the timing noise. A benchmark is flagged when the test is
+significant at --alpha and its median moved by more than --threshold. With
+thousands of benchmarks some would pass the test by chance, so by default the
+p-values are adjusted with the Benjamini-Hochberg method, which keeps the
+expected fraction of flagged benchmarks that did not change below --alpha.
+--correction holm keeps the chance of flagging any of them below --alpha
+instead. Either way a benchmark that changed on its own needs a p-value
+below --alpha divided by the number of benchmarks, which takes enough
+repetitions: 12 for the whole suite at the default --alpha, and `run` keeps
+15. `compare` warns when the samples are too few for that, and with Holm
+fails rather than report that nothing changed.
+Benchmark names carry the function, backend, shape and thread count, so
+every flag points at one of each.
+
+Exit status: 0 if nothing regressed, 1 if anything did, 2 on errors. Only
+the Python standard library is used.
+"""
+
+import argparse
+import functools
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+TIME_UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def order_statistic_interval(samples, confidence):
+    """Confidence interval of the median from order statistics.
+
+    Returns (low, high, achieved), where achieved is the coverage of the
+    interval. It falls short of confidence when there are too few samples
+    for any narrower interval than [min, max].
+    """
+    xs = sorted(samples)
+    n = len(xs)
+    # P(X <= k) for X ~ Binomial(n, 1/2).
+    cdf = []
+    total = 0.0
+    for k in range(n + 1):
+        total += math.comb(n, k) / 2.0**n
+        cdf.append(total)
+    # [x_(k), x_(n-k-1)], 0-based, covers the median with probability
+    # 1 - 2 P(X <= k). Take the narrowest that still covers enough.
+    k = 0
+    while 2 * k + 3 <= n and cdf[k + 1] <= (1.0 - confidence) / 2:
+        k += 1
+    achieved = 1.0 - 2.0 * cdf[k]
+    return xs[k], xs[n - k - 1], achieved
+
+
+def median(samples):
+    xs = sorted(samples)
+    n = len(xs)
+    return xs[n // 2] if n % 2 else (xs[n // 2 - 1] + xs[n // 2]) / 2.0
+
+
+@functools.lru_cache(maxsize=None)
+def u_distribution(n1, n2):
+    """Number of orderings of n1 and n2 distinct values with each U."""
+    # counts[k][s] is the number of orderings with U = s, built up one
+    # element of a at a time.
+    counts = [[0] * (n1 * n2 + 1) for _ in range(n1 + 1)]
+    for k in range(n1 + 1):
+        counts[k][0] = 1
+    for m in range(1, n2 + 1):
+        previous = counts
+        counts = [[0] * (n1 * n2 + 1) for _ in range(n1 + 1)]
+        counts[0][0] = 1
+        for k in range(1, n1 + 1):
+            for s in range(n1 * n2 + 1):
+                # The largest value is from b (no contribution) or a
+                # (beats all m values of b).
+                total = previous[k][s]
+                if s >= m:
+                    total += counts[k - 1][s - m]
+                counts[k][s] = total
+    return counts[n1]
+
+
+def mann_whitney_u(a, b):
+    """Two-sided p-value of the Mann-Whitney U test of a against b.
+
+    Exact when there are no ties and the samples are small, otherwise from
+    the normal approximation with tie and continuity corrections.
+    """
+    n1, n2 = len(a), len(b)
+    pooled = sorted([(x, 0) for x in a] + [(x, 1) for x in b])
+    ranks = [0.0] * len(pooled)
+    ties = []
+    i = 0
+    while i < len(pooled):
+        j = i
+        while j + 1 < len(pooled) and pooled[j + 1][0] == pooled[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2.0 + 1
+        if j > i:
+            ties.append(j - i + 1)
+        i = j + 1
+    rank_sum = sum(r for r, (_, group) in zip(ranks, pooled) if group == 0)
+    u = rank_sum - n1 * (n1 + 1) / 2.0
+    u_min = min(u, n1 * n2 - u)
+
+    if not ties and n1 * n2 <= 400:
+        tail = sum(u_distribution(n1, n2)[: int(math.floor(u_min)) + 1])
+        return min(1.0, 2.0 * tail / math.comb(n1 + n2, n1))
+
+    n = n1 + n2
+    tie_term = sum(t**3 - t for t in ties) / (n * (n - 1)) if n > 1 else 0
+    variance = n1 * n2 / 12.0 * ((n + 1) - tie_term)
+    if variance <= 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2.0) - 0.5) / math.sqrt(variance)
+    return min(1.0, math.erfc(max(z, 0.0) / math.sqrt(2.0)))
+
+
+def samples_from_google_benchmark(report, warmup):
+    """Real times in ns of each benchmark of a --benchmark_out report."""
+    runs = {}
+    labels = {}
+    for entry in report.get("benchmarks", []):
+        if entry.get("run_type", "iteration") != "iteration":
+            continue
+        if entry.get("error_occurred"):
+            continue
+        name = entry.get("run_name", entry["name"])
+        scale = TIME_UNITS[entry.get("time_unit", "ns")]
+        runs.setdefault(name, []).append(entry["real_time"] * scale)
+        if entry.get("label"):
+            labels[name] = entry["label"]
+    return {
+        name: (times[warmup:] if len(times) > warmup else times,
+               labels.get(name))
+        for name, times in runs.items()
+    }
+
+
+def summarize(runs, confidence):
+    benchmarks = {}
+    for name, (samples, label) in sorted(runs.items()):
+        low, high, achieved = order_statistic_interval(samples, confidence)
+        benchmarks[name] = {
+            "label": label,
+            "samples_ns": samples,
+            "median_ns": median(samples),
+            "ci_low_ns": low,
+            "ci_high_ns": high,
+            "ci_confidence": achieved,
+        }
+    return benchmarks
+
+
+def load(path, warmup=0, confidence=0.95):
+    """Benchmarks of a results file of `run` or a raw Google Benchmark one."""
+    with open(path) as f:
+        report = json.load(f)
+    if report.get("format") == "compare_benchmarks":
+        return report["benchmarks"]
+    return summarize(samples_from_google_benchmark(report, warmup), confidence)
+
+
+def format_time(ns):
+    for unit in ("s", "ms", "us"):
+        if ns >= TIME_UNITS[unit]:
+            return "%.3f %s" % (ns / TIME_UNITS[unit], unit)
+    return "%.1f ns" % ns
+
+
+def run(args):
+    with tempfile.TemporaryDirectory() as directory:
+        out = os.path.join(directory, "report.json")
+        command = [
+            args.binary,
+            "--benchmark_repetitions=%d" % (args.repetitions + args.warmup),
+            "--benchmark_report_aggregates_only=false",
+            "--benchmark_out=" + out,
+            "--benchmark_out_format=json",
+        ]
+        if args.filter:
+            command.append("--benchmark_filter=" + args.filter)
+        command += args.benchmark_args
+        print("Running", " ".join(command), file=sys.stderr)
+        if subprocess.call(command, stdout=sys.stderr) != 0:
+            print("Benchmark failed", file=sys.stderr)
+            return 2
+        with open(out) as f:
+            report = json.load(f)
+
+    benchmarks = summarize(
+        samples_from_google_benchmark(report, args.warmup), args.confidence
+    )
+    with open(args.output, "w") as f:
+        json.dump(
+            {
+                "format": "compare_benchmarks",
+                "context": report.get("context", {}),
+                "repetitions": args.repetitions,
+                "warmup": args.warmup,
+                "benchmarks": benchmarks,
+            },
+            f,
+            indent=1,
+        )
+    for name, result in benchmarks.items():
+        print(
+            "%-70s %12s  [%s, %s] %.0f%%"
+            % (
+                name,
+                format_time(result["median_ns"]),
+                format_time(result["ci_low_ns"]),
+                format_time(result["ci_high_ns"]),
+                100 * result["ci_confidence"],
+            )
+        )
+    return 0
+
+
+def holm(p_values):
+    """Holm-Bonferroni adjusted p-values, in the order given."""
+    order = sorted(range(len(p_values)), key=lambda i: p_values[i])
+    adjusted = [1.0] * len(p_values)
+    running = 0.0
+    for rank, i in enumerate(order):
+        running = max(running, (len(p_values) - rank) * p_values[i])
+        adjusted[i] = min(1.0, running)
+    return adjusted
+
+
+def benjamini_hochberg(p_values):
+    """Benjamini-Hochberg adjusted p-values, in the order given."""
+    order = sorted(range(len(p_values)), key=lambda i: p_values[i])
+    adjusted = [1.0] * len(p_values)
+    running = 1.0
+    for rank in reversed(range(len(order))):
+        i = order[rank]
+        running = min(running, len(p_values) * p_values[i] / (rank + 1))
+        adjusted[i] = running
+    return adjusted
+
+
+@functools.lru_cache(maxsize=None)
+def smallest_p(n1, n2):
+    """Smallest p-value the test can give for samples of n1 and n2 times."""
+    return mann_whitney_u(range(n1), range(n1, n1 + n2))
+
+
+def compare(args):
+    baseline = load(args.baseline, args.warmup)
+    contender = load(args.contender, args.warmup)
+    rows = []
+    for name in sorted(set(baseline) & set(contender)):
+        a = baseline[name]["samples_ns"]
+        b = contender[name]["samples_ns"]
+        change = contender[name]["median_ns"] / baseline[name]["median_ns"] - 1
+        p = mann_whitney_u(a, b) if len(a) >= 2 and len(b) >= 2 else None
+        rows.append([name, baseline[name], contender[name], change, p])
+
+    tested = [row for row in rows if row[4] is not None]
+    # A benchmark that changed on its own is significant only if its
+    # smallest possible p-value, had its samples not overlapped at all,
+    # survives the correction. Both corrections multiply that p-value by the
+    # number of benchmarks; Benjamini-Hochberg divides it again by the number
+    # of smaller p-values, so it can still flag changes that many share.
+    scale = 1 if args.correction == "none" else len(tested)
+    powerless = [
+        row[0]
+        for row in tested
+        if scale * smallest_p(len(row[1]["samples_ns"]),
+                              len(row[2]["samples_ns"])) > args.alpha
+    ]
+    if powerless:
+        print(
+            "warning: %d of %d benchmarks have too few samples for a change "
+            "of theirs alone to be significant at alpha %.3g over %d tests; "
+            "run more --repetitions or compare fewer benchmarks"
+            % (len(powerless), len(tested), args.alpha, scale),
+            file=sys.stderr,
+        )
+        if len(powerless) == len(tested) and args.correction != "bh":
+            print("error: no benchmark can be flagged", file=sys.stderr)
+            return 2
+    adjust = {"holm": holm, "bh": benjamini_hochberg}.get(args.correction)
+    if adjust:
+        for row, p in zip(tested, adjust([row[4] for row in tested])):
+            row[4] = p
+
+    regressions = improvements = 0
+    for name, old, new, change, p in rows:
+        if p is None:
+            verdict = "too few samples"
+        elif p >= args.alpha or abs(change) <= args.threshold:
+            verdict = ""
+        elif change > 0:
+            verdict = "REGRESSION"
+            regressions += 1
+        else:
+            verdict = "improvement"
+            improvements += 1
+        if args.only_significant and verdict not in ("REGRESSION",
+                                                     "improvement"):
+            continue
+        print(
+            "%-70s %12s -> %12s %+7.1f%%  p=%s  %s"
+            % (
+                name,
+                format_time(old["median_ns"]),
+                format_time(new["median_ns"]),
+                100 * change,
+                "-" if p is None else "%.4f" % p,
+                verdict,
+            )
+        )
+    for name in sorted(set(baseline) ^ set(contender)):
+        print("%-70s only in %s" % (
+            name, args.baseline if name in baseline else args.contender))
+    print(
+        "%d compared, %d regressions, %d improvements "
+        "(alpha %.3g, threshold %.1f%%, correction %s)"
+        % (len(rows), regressions, improvements, args.alpha,
+           100 * args.threshold, args.correction)
+    )
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+    )
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    run_parser = commands.add_parser("run", help="run a benchmark binary")
+    run_parser.add_argument("binary")
+    run_parser.add_argument("-o", "--output", required=True)
+    run_parser.add_argument("--repetitions", type=int, default=15,
+                            help="repetitions to keep; with 15 a change of a "
+                            "single benchmark among 10000 can be significant")
+    run_parser.add_argument("--warmup", type=int, default=1,
+                            help="repetitions to run first and discard")
+    run_parser.add_argument("--confidence", type=float, default=0.95)
+    run_parser.add_argument("--filter", help="--benchmark_filter regex")
+    run_parser.set_defaults(handler=run)
+
+    compare_parser = commands.add_parser("compare", help="compare two results")
+    compare_parser.add_argument("baseline")
+    compare_parser.add_argument("contender")
+    compare_parser.add_argument("--alpha", type=float, default=0.01,
+                                help="significance level of the test")
+    compare_parser.add_argument("--threshold", type=float, default=0.02,
+                                help="smallest relative change to flag")
+    compare_parser.add_argument("--warmup", type=int, default=0,
+                                help="repetitions to discard from raw reports")
+    compare_parser.add_argument("--correction",
+                                choices=("bh", "holm", "none"), default="bh",
+                                help="adjustment of p-values for the number "
+                                "of benchmarks compared: Benjamini-Hochberg "
+                                "(false discovery rate) or Holm-Bonferroni "
+                                "(family-wise error rate)")
+    compare_parser.add_argument("--only-significant", action="store_true")
+    compare_parser.set_defaults(handler=compare)
+
+    # Whatever follows -- goes to the benchmark binary as is.
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1 :]
+        argv = argv[: argv.index("--")]
+    args = parser.parse_args(argv)
+    args.benchmark_args = extra
+    try:
+        return args.handler(args)
+    except (OSError, ValueError, KeyError) as error:
+        print("error:", error, file=sys.stderr)
+        return 2
+
+
+if __name__ == "__main__":
+    sys.exit(main())